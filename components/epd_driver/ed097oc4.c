@@ -1,5 +1,9 @@
 #include "ed097oc4.h"
+#include "epd_bus.h"
+#include "driver/rtc_io.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "i2s_data_bus.h"
 #include "rmt_pulse.h"
 
@@ -17,16 +21,55 @@
 
 static epd_config_register_t config_reg;
 
+/// Timing parameters of the display.
+static const EpdDisplay *display;
+
+/// A queued row operation, executed from the peripheral interrupts.
+typedef struct {
+  /// CKV high time in RMT ticks.
+  uint16_t high_time;
+  /// CKV low time in RMT ticks.
+  uint16_t low_time;
+  /// Latch the previous row and transmit the line buffer of this slot.
+  bool output;
+} row_command_t;
+
+/// Time to wait for the I2S FIFO to drain before retrying to start a row,
+/// in RMT ticks of 0.1us.
+#define FIFO_DRAIN_RETRY_TICKS 10
+
+/// Row commands, one per line buffer of the I2S ring.
+static row_command_t row_queue[I2S_LINE_BUFFERS];
+/// Number of rows submitted so far.
+static volatile uint32_t rows_submitted = 0;
+/// Number of rows started by the row engine.
+static volatile uint32_t rows_started = 0;
+/// Number of rows whose line buffers can be reused.
+static volatile uint32_t rows_done = 0;
+/// Indicates the row engine is working through the queue.
+static volatile bool row_engine_running = false;
+/// Given from the interrupts when a row is done.
+static SemaphoreHandle_t row_done_smphr = NULL;
+static portMUX_TYPE row_queue_mux = portMUX_INITIALIZER_UNLOCKED;
+
 /*
  * Write bits directly using the registers.
- * Won't work for some pins (>= 32).
+ * Pins are compile-time constants, so the branch is optimized away.
  */
-inline static void fast_gpio_set_hi(gpio_num_t gpio_num) {
-  GPIO.out_w1ts = (1 << gpio_num);
+inline static void IRAM_ATTR fast_gpio_set_hi(gpio_num_t gpio_num) {
+  if (gpio_num < 32) {
+    GPIO.out_w1ts = (1 << gpio_num);
+  } else {
+    GPIO.out1_w1ts.val = (1 << (gpio_num - 32));
+  }
 }
 
-inline static void fast_gpio_set_lo(gpio_num_t gpio_num) {
-  GPIO.out_w1tc = (1 << gpio_num);
+inline static void IRAM_ATTR fast_gpio_set_lo(gpio_num_t gpio_num) {
+  if (gpio_num < 32) {
+    GPIO.out_w1tc = (1 << gpio_num);
+  } else {
+    GPIO.out1_w1tc.val = (1 << (gpio_num - 32));
+  }
 }
 
 void IRAM_ATTR busy_delay(uint32_t cycles) {
@@ -35,18 +78,134 @@ void IRAM_ATTR busy_delay(uint32_t cycles) {
   };
 }
 
+/*
+ * Shift a bit into the config register.
+ * This is done for every row on boards without a dedicated latch pin,
+ * so the pins are written directly instead of using `gpio_set_level`.
+ */
 inline static void IRAM_ATTR push_cfg_bit(bool bit) {
-  gpio_set_level(CFG_CLK, 0);
+  fast_gpio_set_lo(CFG_CLK);
   if (bit) {
-    gpio_set_level(CFG_DATA, 1);
+    fast_gpio_set_hi(CFG_DATA);
   } else {
-    gpio_set_level(CFG_DATA, 0);
+    fast_gpio_set_lo(CFG_DATA);
+  }
+  fast_gpio_set_hi(CFG_CLK);
+}
+
+/*
+ * Latch the transmitted row to the source driver outputs.
+ * Called from the peripheral interrupts, so it must stay in IRAM.
+ */
+static inline void IRAM_ATTR latch_row() {
+#if defined(CONFIG_EPD_BOARD_REVISION_V2_V3) || defined(CONFIG_EPD_BOARD_REVISION_LILYGO_T5_47)
+  config_reg.ep_latch_enable = true;
+  push_cfg(&config_reg);
+
+  config_reg.ep_latch_enable = false;
+  push_cfg(&config_reg);
+#else
+#if defined(CONFIG_EPD_BOARD_REVISION_V4) || defined(CONFIG_EPD_BOARD_REVISION_V5)
+  fast_gpio_set_hi(V4_LATCH_ENABLE);
+  fast_gpio_set_lo(V4_LATCH_ENABLE);
+#else
+#error "unknown revision"
+#endif
+#endif
+}
+
+/*
+ * Start the next queued row, if any.
+ * Must only be called with `row_queue_mux` held,
+ * when both the I2S and RMT peripheral are idle.
+ */
+static void IRAM_ATTR row_engine_step() {
+  // the previous row is done, so its buffer is free again.
+  rows_done = rows_started;
+  if (rows_started == rows_submitted) {
+    row_engine_running = false;
+    return;
+  }
+  int slot = rows_started % I2S_LINE_BUFFERS;
+  const row_command_t *cmd = &row_queue[slot];
+  if (cmd->output) {
+    latch_row();
+    rmt_pulse_start(cmd->high_time, cmd->low_time);
+    i2s_start_line_output(slot);
+  } else {
+    rmt_pulse_start(cmd->high_time, cmd->low_time);
+  }
+  rows_started++;
+}
+
+/*
+ * Called from the I2S and RMT interrupts.
+ * The next row is started once both peripherals are done.
+ */
+static void IRAM_ATTR row_engine_isr_cb() {
+  bool stepped = false;
+  portENTER_CRITICAL_ISR(&row_queue_mux);
+  if (row_engine_running && !rmt_busy()) {
+    if (!i2s_is_busy()) {
+      row_engine_step();
+      stepped = true;
+    } else if (i2s_is_draining()) {
+      // the DMA is done, but the FIFO is not empty yet. Instead of spinning
+      // in the interrupt, try again when a short RMT delay is over.
+      rmt_delay_start(FIFO_DRAIN_RETRY_TICKS);
+    }
+  }
+  portEXIT_CRITICAL_ISR(&row_queue_mux);
+
+  if (stepped) {
+    BaseType_t task_awoken = pdFALSE;
+    xSemaphoreGiveFromISR(row_done_smphr, &task_awoken);
+    if (task_awoken == pdTRUE) {
+      portYIELD_FROM_ISR();
+    }
+  }
+}
+
+/*
+ * Wait until the line buffer of the next row to submit is free.
+ */
+static void IRAM_ATTR row_engine_wait_slot() {
+  while (rows_submitted - rows_done >= I2S_LINE_BUFFERS) {
+    xSemaphoreTake(row_done_smphr, portMAX_DELAY);
   }
-  gpio_set_level(CFG_CLK, 1);
 }
 
-void epd_base_init(uint32_t epd_row_width) {
+/*
+ * Wait until all queued rows are output.
+ */
+static void IRAM_ATTR row_engine_wait_idle() {
+  while (row_engine_running) {
+    xSemaphoreTake(row_done_smphr, portMAX_DELAY);
+  }
+  i2s_wait_idle();
+  rmt_wait_idle();
+}
 
+static void IRAM_ATTR row_engine_submit(uint16_t high_time, uint16_t low_time,
+                                        bool output) {
+  row_engine_wait_slot();
+  row_command_t *cmd = &row_queue[rows_submitted % I2S_LINE_BUFFERS];
+  cmd->high_time = high_time;
+  cmd->low_time = low_time;
+  cmd->output = output;
+
+  portENTER_CRITICAL(&row_queue_mux);
+  rows_submitted++;
+  if (!row_engine_running) {
+    row_engine_running = true;
+    row_engine_step();
+  }
+  portEXIT_CRITICAL(&row_queue_mux);
+}
+
+void epd_base_init(const EpdDisplay *disp) {
+
+  display = disp;
   config_reg_init(&config_reg);
 
   /* Power Control Output/Off */
@@ -67,10 +226,15 @@ void epd_base_init(uint32_t epd_row_width) {
 
   push_cfg(&config_reg);
 
+  if (row_done_smphr == NULL) {
+    row_done_smphr = xSemaphoreCreateBinary();
+  }
+
   // Setup I2S
   i2s_bus_config i2s_config;
   // add an offset off dummy bytes to allow for enough timing headroom
-  i2s_config.epd_row_width = epd_row_width + 32;
+  i2s_config.epd_row_width = display->width + 32;
+  i2s_config.clock_mhz = display->bus_clock_mhz;
   i2s_config.clock = CKH;
   i2s_config.start_pulse = STH;
   i2s_config.data_0 = D0;
@@ -81,24 +245,29 @@ void epd_base_init(uint32_t epd_row_width) {
   i2s_config.data_5 = D5;
   i2s_config.data_6 = D6;
   i2s_config.data_7 = D7;
+  i2s_config.done_cb = row_engine_isr_cb;
 
   i2s_bus_init(&i2s_config);
 
-  rmt_pulse_init(CKV);
+  rmt_pulse_init(CKV, row_engine_isr_cb);
 }
 
-void epd_poweron() { cfg_poweron(&config_reg); }
+void epd_base_poweron() { cfg_poweron(&config_reg); }
 
-void epd_poweroff() { cfg_poweroff(&config_reg); }
+void epd_base_poweroff() { cfg_poweroff(&config_reg); }
 
 void epd_base_deinit(){
-  epd_poweroff();
+#if defined(CONFIG_EPD_BOARD_REVISION_V5)
+  gpio_reset_pin(CKH);
+  rtc_gpio_isolate(CKH);
+#endif
+  epd_base_poweroff();
+  rmt_pulse_deinit();
   i2s_deinit();
 }
 
 void epd_start_frame() {
-  while (i2s_is_busy() || rmt_busy()) {
-  };
+  row_engine_wait_idle();
   config_reg.ep_mode = true;
   push_cfg(&config_reg);
 
@@ -119,52 +288,16 @@ void epd_start_frame() {
   pulse_ckv_us(1, 1, true);
 }
 
-static inline void latch_row() {
-#if defined(CONFIG_EPD_BOARD_REVISION_V2_V3) || defined(CONFIG_EPD_BOARD_REVISION_LILYGO_T5_47)
-  config_reg.ep_latch_enable = true;
-  push_cfg(&config_reg);
-
-  config_reg.ep_latch_enable = false;
-  push_cfg(&config_reg);
-#else
-#if defined(CONFIG_EPD_BOARD_REVISION_V4) || defined(CONFIG_EPD_BOARD_REVISION_V5)
-  fast_gpio_set_hi(V4_LATCH_ENABLE);
-  fast_gpio_set_lo(V4_LATCH_ENABLE);
-#else
-#error "unknown revision"
-#endif
-#endif
-}
-
 void IRAM_ATTR epd_skip() {
-#if defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2) ||                               \
-    defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
-  pulse_ckv_ticks(2, 2, false);
-#else
-  // According to the spec, the OC4 maximum CKV frequency is 200kHz.
-  pulse_ckv_ticks(45, 5, false);
-#endif
+  row_engine_submit(display->skip_ckv_high, display->skip_ckv_low, false);
 }
 
 void IRAM_ATTR epd_output_row(uint32_t output_time_dus) {
-
-  while (i2s_is_busy() || rmt_busy()) {
-  };
-
-  latch_row();
-
-#if defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2) ||                               \
-    defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
-  pulse_ckv_ticks(output_time_dus, 1, false);
-#else
-  pulse_ckv_ticks(output_time_dus, 50, false);
-#endif
-
-  i2s_start_line_output();
-  i2s_switch_buffer();
+  row_engine_submit(output_time_dus, display->row_ckv_low, true);
 }
 
 void epd_end_frame() {
+  row_engine_wait_idle();
   config_reg.ep_output_enable = false;
   push_cfg(&config_reg);
   config_reg.ep_mode = false;
@@ -173,7 +306,20 @@ void epd_end_frame() {
   pulse_ckv_us(1, 1, true);
 }
 
-void IRAM_ATTR epd_switch_buffer() { i2s_switch_buffer(); }
 uint8_t IRAM_ATTR *epd_get_current_buffer() {
-  return (uint8_t *)i2s_get_current_buffer();
+  row_engine_wait_slot();
+  return (uint8_t *)i2s_get_buffer(rows_submitted % I2S_LINE_BUFFERS);
+};
+
+const EpdBusBackend epd_bus_esp32 = {
+    .name = "esp32",
+    .init = epd_base_init,
+    .deinit = epd_base_deinit,
+    .poweron = epd_base_poweron,
+    .poweroff = epd_base_poweroff,
+    .start_frame = epd_start_frame,
+    .end_frame = epd_end_frame,
+    .output_row = epd_output_row,
+    .skip = epd_skip,
+    .get_current_buffer = epd_get_current_buffer,
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "driver/gpio.h"
+#include "epd_driver.h"
 
 #if defined(CONFIG_EPD_BOARD_REVISION_V5)
 #define D7 GPIO_NUM_23
@@ -61,10 +62,12 @@
 
 #endif
 
-void epd_base_init(uint32_t epd_row_width);
+void epd_base_init(const EpdDisplay *display);
 void epd_base_deinit();
-void epd_poweron();
-void epd_poweroff();
+/** Switch on the display power supply, see `epd_power.h` for sessions. */
+void epd_base_poweron();
+/** Switch off the display power supply. */
+void epd_base_poweroff();
 
 /**
  * Start a draw cycle.
@@ -77,32 +80,28 @@ void epd_start_frame();
 void epd_end_frame();
 
 /**
- * Waits until all previously submitted data has been written.
- * Then, the following operations are initiated:
+ * Queues the current line buffer for output.
+ * Once all previously queued rows have been written,
+ * the following operations are initiated from the peripheral interrupts:
  *
  *  - Previously submitted data is latched to the output register.
  *  - The RMT peripheral is set up to pulse the vertical (gate) driver for
  *  `output_time_dus` / 10 microseconds.
- *  - The I2S peripheral starts transmission of the current buffer to
+ *  - The I2S peripheral starts transmission of the queued buffer to
  *  the source driver.
- *  - The line buffers are switched.
  *
  * This sequence of operations allows for pipelining data preparation and
  * transfer, reducing total refresh times.
+ * Blocks only if all line buffers are queued.
  */
 void IRAM_ATTR epd_output_row(uint32_t output_time_dus);
 
-/** Skip a row without writing to it. */
+/** Queue skipping a row without writing to it. */
 void IRAM_ATTR epd_skip();
 
 /**
  * Get the currently writable line buffer.
+ * Its contents are undefined and must be written completely.
+ * If all line buffers are queued, this blocks until one is free.
  */
 uint8_t IRAM_ATTR *epd_get_current_buffer();
-
-/**
- * Switches front and back line buffer.
- * If the switched-to line buffer is currently in use,
- * this function blocks until transmission is done.
- */
-void IRAM_ATTR epd_switch_buffer();
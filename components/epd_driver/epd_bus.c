@@ -0,0 +1,24 @@
+#include "epd_bus.h"
+#include "epd_bus_mock.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+#endif
+
+#if defined(CONFIG_EPD_BUS_MOCK)
+static const EpdBusBackend *bus_backend = &epd_bus_mock;
+#elif defined(ESP_PLATFORM)
+static const EpdBusBackend *bus_backend = &epd_bus_esp32;
+#else
+static const EpdBusBackend *bus_backend = &epd_bus_mock;
+#endif
+
+void epd_set_bus_backend(const EpdBusBackend *backend) {
+  assert(backend != NULL);
+  bus_backend = backend;
+}
+
+const EpdBusBackend *epd_bus() { return bus_backend; }
@@ -0,0 +1,228 @@
+#include "epd_bus_mock.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// CKV pulses and delays issued by the ESP32 backend at the start and end of
+// a frame, in 0.1us.
+#define FRAME_START_TIME 350
+#define FRAME_END_TIME 40
+
+static const EpdDisplay *display = NULL;
+static uint32_t row_bytes = 0;
+// transfer time of a row, in 0.1us.
+static uint32_t transfer_time = 0;
+
+/// Line buffer written by the driver.
+static uint8_t *line_buf = NULL;
+/// Source driver shift register, holding the last transmitted row.
+static uint8_t *shift_reg = NULL;
+/// Source driver output register, holding the latched row.
+static uint8_t *output_reg = NULL;
+
+static EpdBusEvent *events = NULL;
+static size_t event_capacity = 0;
+static size_t event_count = 0;
+static epd_bus_mock_row_cb row_cb = NULL;
+static void *row_cb_ctx = NULL;
+
+static bool in_frame = false;
+/*
+ * Row driven by the next gate pulse. Row data is latched one row after it is
+ * transmitted, so a frame starts one row before the first display row.
+ */
+static int32_t gate_row = -1;
+/// Time when the gate driver (CKV) is idle.
+static uint64_t ckv_free = 0;
+/// Time when the data bus is idle.
+static uint64_t bus_free = 0;
+
+static enum EpdBusMockWait wait_mode = EPD_BUS_MOCK_NO_WAIT;
+/// Real time in us at simulated time 0, when waiting in real time.
+static int64_t wall_origin = 0;
+/// Real and CPU time of draw cycles.
+static uint64_t frame_wall_us = 0;
+static uint64_t frame_cpu_us = 0;
+static int64_t frame_wall_start = 0;
+static uint64_t frame_cpu_start = 0;
+
+static uint64_t idle_time() { return ckv_free > bus_free ? ckv_free : bus_free; }
+
+static uint64_t thread_cpu_us() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+  return 0;
+#endif
+}
+
+/*
+ * Wait in real time until simulated time `time`.
+ * If the caller is already late, the bus would have started late as well,
+ * so the simulated time is moved along.
+ */
+static void wait_until(uint64_t time) {
+  if (wait_mode == EPD_BUS_MOCK_NO_WAIT) {
+    return;
+  }
+  int64_t until = wall_origin + (int64_t)(time / 10);
+  int64_t remaining = until - esp_timer_get_time();
+  if (remaining < 0) {
+    wall_origin -= remaining;
+    return;
+  }
+  if (wait_mode == EPD_BUS_MOCK_BLOCK &&
+      remaining > CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US) {
+    usleep(remaining);
+  }
+  while (esp_timer_get_time() < until) {
+  };
+}
+
+static void record(enum EpdBusEventType type, uint64_t time,
+                   uint16_t high_time, uint16_t low_time) {
+  if (events != NULL && event_count < event_capacity) {
+    EpdBusEvent *ev = &events[event_count];
+    ev->type = type;
+    ev->time = time;
+    ev->row = gate_row;
+    ev->high_time = high_time;
+    ev->low_time = low_time;
+  }
+  event_count++;
+}
+
+/*
+ * Pulse the gate driver at `time`, driving the current row with the
+ * contents of the output register.
+ */
+static void pulse_ckv(uint64_t time, uint16_t high_time, uint16_t low_time) {
+  record(EPD_BUS_EVENT_CKV, time, high_time, low_time);
+  if (in_frame && row_cb != NULL && gate_row >= 0 &&
+      gate_row < display->height) {
+    row_cb(gate_row, output_reg, high_time, row_cb_ctx);
+  }
+  gate_row++;
+  ckv_free = time + high_time + low_time;
+}
+
+static void mock_init(const EpdDisplay *disp) {
+  display = disp;
+  row_bytes = display->width / 4;
+  // the ESP32 backend transmits 32 dummy pixels per row,
+  // one byte per 4 bus clock cycles.
+  transfer_time = (display->width + 32) / 4 * 40 / display->bus_clock_mhz;
+
+  free(line_buf);
+  free(shift_reg);
+  free(output_reg);
+  line_buf = calloc(1, row_bytes);
+  shift_reg = calloc(1, row_bytes);
+  output_reg = calloc(1, row_bytes);
+  assert(line_buf != NULL && shift_reg != NULL && output_reg != NULL);
+  epd_bus_mock_reset();
+}
+
+static void mock_deinit() {
+  free(line_buf);
+  free(shift_reg);
+  free(output_reg);
+  line_buf = NULL;
+  shift_reg = NULL;
+  output_reg = NULL;
+}
+
+static void mock_poweron() {}
+
+static void mock_poweroff() {}
+
+static void mock_start_frame() {
+  uint64_t now = idle_time();
+  frame_wall_start = esp_timer_get_time();
+  frame_cpu_start = thread_cpu_us();
+  wall_origin = frame_wall_start - (int64_t)(now / 10);
+  gate_row = -1;
+  in_frame = true;
+  record(EPD_BUS_EVENT_FRAME_START, now, 0, 0);
+  ckv_free = bus_free = now + FRAME_START_TIME;
+}
+
+static void mock_end_frame() {
+  uint64_t now = idle_time();
+  wait_until(now);
+  in_frame = false;
+  record(EPD_BUS_EVENT_FRAME_END, now, 0, 0);
+  ckv_free = bus_free = now + FRAME_END_TIME;
+  wait_until(ckv_free);
+  frame_wall_us += esp_timer_get_time() - frame_wall_start;
+  frame_cpu_us += thread_cpu_us() - frame_cpu_start;
+}
+
+static void mock_output_row(uint32_t output_time_dus) {
+  // like the row engine, a row starts when both CKV and data bus are idle.
+  uint64_t now = idle_time();
+  wait_until(now);
+  memcpy(output_reg, shift_reg, row_bytes);
+  record(EPD_BUS_EVENT_LATCH, now, 0, 0);
+  pulse_ckv(now, output_time_dus, display->row_ckv_low);
+  memcpy(shift_reg, line_buf, row_bytes);
+  bus_free = now + transfer_time;
+}
+
+static void mock_skip() {
+  wait_until(idle_time());
+  pulse_ckv(idle_time(), display->skip_ckv_high, display->skip_ckv_low);
+}
+
+static uint8_t *mock_get_current_buffer() { return line_buf; }
+
+const EpdBusBackend epd_bus_mock = {
+    .name = "mock",
+    .init = mock_init,
+    .deinit = mock_deinit,
+    .poweron = mock_poweron,
+    .poweroff = mock_poweroff,
+    .start_frame = mock_start_frame,
+    .end_frame = mock_end_frame,
+    .output_row = mock_output_row,
+    .skip = mock_skip,
+    .get_current_buffer = mock_get_current_buffer,
+};
+
+void epd_bus_mock_configure(EpdBusEvent *event_buf, size_t capacity,
+                            epd_bus_mock_row_cb cb, void *ctx) {
+  events = event_buf;
+  event_capacity = capacity;
+  row_cb = cb;
+  row_cb_ctx = ctx;
+  epd_bus_mock_reset();
+}
+
+void epd_bus_mock_reset() {
+  event_count = 0;
+  frame_wall_us = 0;
+  frame_cpu_us = 0;
+  gate_row = -1;
+  in_frame = false;
+  ckv_free = 0;
+  bus_free = 0;
+}
+
+size_t epd_bus_mock_event_count() { return event_count; }
+
+uint64_t epd_bus_mock_time() { return idle_time(); }
+
+void epd_bus_mock_set_wait(enum EpdBusMockWait wait) { wait_mode = wait; }
+
+void epd_bus_mock_frame_times(uint64_t *wall_us, uint64_t *cpu_us) {
+  *wall_us = frame_wall_us;
+  *cpu_us = frame_cpu_us;
+}
@@ -0,0 +1,102 @@
+/**
+ * A software display bus which records the bus activity.
+ *
+ * The mock models the source driver (shift and output register) and the gate
+ * driver of a panel in plain C, so the drawing pipeline can be exercised on
+ * any host. Time is simulated from the CKV timings of the display and the
+ * transfer time of a row, in units of 0.1us, which makes recordings
+ * deterministic.
+ */
+
+#pragma once
+
+#include "epd_bus.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// Type of a recorded bus event.
+enum EpdBusEventType {
+  /// A draw cycle started.
+  EPD_BUS_EVENT_FRAME_START,
+  /// A draw cycle ended.
+  EPD_BUS_EVENT_FRAME_END,
+  /// The transmitted row data was latched to the output register.
+  EPD_BUS_EVENT_LATCH,
+  /// The gate driver was pulsed, driving `row` with the latched data.
+  /// Row -1 is the pulse latching the first row of a frame.
+  EPD_BUS_EVENT_CKV,
+};
+
+/// A recorded bus event.
+typedef struct {
+  enum EpdBusEventType type;
+  /// Simulated time of the event in 0.1us since the last reset.
+  uint64_t time;
+  /// Gate row of the event.
+  int32_t row;
+  /// CKV high time in 0.1us, for `EPD_BUS_EVENT_CKV`.
+  uint16_t high_time;
+  /// CKV low time in 0.1us, for `EPD_BUS_EVENT_CKV`.
+  uint16_t low_time;
+} EpdBusEvent;
+
+/**
+ * Called for every gate pulse on a display row during a draw cycle.
+ * `data` is the latched row in output order, `width / 4` bytes with 2 bits
+ * per pixel, `high_time` the gate pulse length in 0.1us.
+ */
+typedef void (*epd_bus_mock_row_cb)(int32_t row, const uint8_t *data,
+                                    uint16_t high_time, void *ctx);
+
+/// How the mock waits for the modeled bus time, see `epd_bus_mock_set_wait`.
+enum EpdBusMockWait {
+  /// Return immediately, only the simulated time advances.
+  EPD_BUS_MOCK_NO_WAIT,
+  /// Busy-wait until the bus is idle, like the driver used to.
+  EPD_BUS_MOCK_SPIN,
+  /// Sleep through waits longer than
+  /// `CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US`, like the ESP32 backend.
+  EPD_BUS_MOCK_BLOCK,
+};
+
+/// The recording software backend.
+extern const EpdBusBackend epd_bus_mock;
+
+/**
+ * Set where events are recorded to and the row callback.
+ * `events` may be NULL to only count events, `row_cb` may be NULL.
+ * Resets the recording.
+ */
+void epd_bus_mock_configure(EpdBusEvent *events, size_t capacity,
+                            epd_bus_mock_row_cb row_cb, void *ctx);
+
+/**
+ * Clear the recorded events and reset the simulated time.
+ */
+void epd_bus_mock_reset();
+
+/**
+ * Number of events recorded since the last reset.
+ * Events beyond the capacity are counted, but not stored.
+ */
+size_t epd_bus_mock_event_count();
+
+/**
+ * Simulated time in 0.1us since the last reset,
+ * when the bus is idle after all issued operations.
+ */
+uint64_t epd_bus_mock_time();
+
+/**
+ * Make the bus operations take the modeled bus time in real time,
+ * so the CPU time left to other tasks can be compared between waiting
+ * strategies. Recorded events keep using the simulated time.
+ */
+void epd_bus_mock_set_wait(enum EpdBusMockWait wait);
+
+/**
+ * Get the real time spent in draw cycles and the CPU time the tasks
+ * running them used, in microseconds since the last reset.
+ * The CPU time is only measured on hosts with per-thread CPU clocks.
+ */
+void epd_bus_mock_frame_times(uint64_t *wall_us, uint64_t *cpu_us);
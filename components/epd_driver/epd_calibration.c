@@ -0,0 +1,86 @@
+#include "epd_driver.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include <string.h>
+
+#define CALIBRATION_NAMESPACE "epd_cal"
+#define CALIBRATION_KEY "waveform"
+#define CALIBRATION_VERSION 2
+
+// The stored blob, tied to the panel type it was measured on.
+// Several panel types share a resolution, so the name is stored as well.
+typedef struct {
+  uint16_t version;
+  uint16_t width;
+  uint16_t height;
+  char name[16];
+  EpdCalibration calibration;
+} StoredCalibration;
+
+static void display_name(char name[16]) {
+  const EpdDisplay *display = epd_current_display();
+  memset(name, 0, 16);
+  if (display != NULL && display->name != NULL) {
+    strncpy(name, display->name, 15);
+  }
+}
+
+esp_err_t epd_save_calibration(const EpdCalibration *calibration) {
+  StoredCalibration stored = {.version = CALIBRATION_VERSION,
+                              .width = epd_width(),
+                              .height = epd_height(),
+                              .calibration = *calibration};
+  display_name(stored.name);
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CALIBRATION_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = nvs_set_blob(handle, CALIBRATION_KEY, &stored, sizeof(stored));
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  return err;
+}
+
+esp_err_t epd_load_calibration(EpdCalibration *calibration) {
+  StoredCalibration stored;
+  size_t size = sizeof(stored);
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CALIBRATION_NAMESPACE, NVS_READONLY, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = nvs_get_blob(handle, CALIBRATION_KEY, &stored, &size);
+  nvs_close(handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  char name[16];
+  display_name(name);
+  if (size != sizeof(stored) || stored.version != CALIBRATION_VERSION ||
+      stored.width != epd_width() || stored.height != epd_height() ||
+      memcmp(stored.name, name, sizeof(name)) != 0) {
+    ESP_LOGW("epd_calibration", "stored calibration is for another display.");
+    return ESP_ERR_INVALID_VERSION;
+  }
+  *calibration = stored.calibration;
+  return ESP_OK;
+}
+
+esp_err_t epd_erase_calibration() {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CALIBRATION_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  err = nvs_erase_key(handle, CALIBRATION_KEY);
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  return err;
+}
@@ -0,0 +1,222 @@
+#include "epd_compositor.h"
+
+#include "esp_attr.h"
+#include <string.h>
+
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+
+static bool intersect(Rect_t a, Rect_t b, Rect_t *out) {
+  int x0 = max_int(a.x, b.x);
+  int y0 = max_int(a.y, b.y);
+  int x1 = min_int(a.x + a.width, b.x + b.width);
+  int y1 = min_int(a.y + a.height, b.y + b.height);
+  if (x1 <= x0 || y1 <= y0) {
+    return false;
+  }
+  out->x = x0;
+  out->y = y0;
+  out->width = x1 - x0;
+  out->height = y1 - y0;
+  return true;
+}
+
+static Rect_t bounds(Rect_t a, Rect_t b) {
+  int x0 = min_int(a.x, b.x);
+  int y0 = min_int(a.y, b.y);
+  Rect_t out = {.x = x0,
+                .y = y0,
+                .width = max_int(a.x + a.width, b.x + b.width) - x0,
+                .height = max_int(a.y + a.height, b.y + b.height) - y0};
+  return out;
+}
+
+static int area_of(Rect_t r) { return r.width * r.height; }
+
+static void mark_dirty(EpdCompositor *compositor, Rect_t area) {
+  Rect_t screen = epd_full_screen();
+  if (!intersect(area, screen, &area)) {
+    return;
+  }
+  // absorb overlapping dirty areas, until none overlaps anymore.
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (int i = 0; i < compositor->dirty_count; i++) {
+      Rect_t overlap;
+      if (intersect(compositor->dirty[i], area, &overlap)) {
+        area = bounds(compositor->dirty[i], area);
+        compositor->dirty[i] = compositor->dirty[--compositor->dirty_count];
+        merged = true;
+        break;
+      }
+    }
+  }
+  if (compositor->dirty_count < EPD_MAX_DIRTY_RECTS) {
+    compositor->dirty[compositor->dirty_count++] = area;
+    return;
+  }
+  // no free slot, grow the area which grows the least.
+  int best = 0;
+  int best_growth = INT32_MAX;
+  for (int i = 0; i < compositor->dirty_count; i++) {
+    int growth = area_of(bounds(compositor->dirty[i], area)) -
+                 area_of(compositor->dirty[i]);
+    if (growth < best_growth) {
+      best = i;
+      best_growth = growth;
+    }
+  }
+  Rect_t grown = bounds(compositor->dirty[best], area);
+  compositor->dirty[best] = compositor->dirty[--compositor->dirty_count];
+  mark_dirty(compositor, grown);
+}
+
+static Rect_t layer_rect(const EpdLayer *layer) {
+  Rect_t rect = {.x = layer->x,
+                 .y = layer->y,
+                 .width = layer->width,
+                 .height = layer->height};
+  return rect;
+}
+
+void epd_compositor_init(EpdCompositor *compositor) {
+  memset(compositor, 0, sizeof(EpdCompositor));
+  compositor->clear_cycles = 3;
+}
+
+bool epd_compositor_add_layer(EpdCompositor *compositor, EpdLayer *layer) {
+  if (compositor->layer_count >= EPD_MAX_LAYERS) {
+    return false;
+  }
+  compositor->layers[compositor->layer_count++] = layer;
+  if (!layer->hidden) {
+    mark_dirty(compositor, layer_rect(layer));
+  }
+  return true;
+}
+
+void epd_layer_changed(EpdCompositor *compositor, const EpdLayer *layer,
+                       Rect_t area) {
+  Rect_t changed;
+  Rect_t whole = {.x = 0, .y = 0, .width = layer->width, .height = layer->height};
+  if (layer->hidden || !intersect(area, whole, &changed)) {
+    return;
+  }
+  changed.x += layer->x;
+  changed.y += layer->y;
+  mark_dirty(compositor, changed);
+}
+
+void epd_layer_move(EpdCompositor *compositor, EpdLayer *layer, int x, int y) {
+  if (!layer->hidden) {
+    mark_dirty(compositor, layer_rect(layer));
+  }
+  layer->x = x;
+  layer->y = y;
+  if (!layer->hidden) {
+    mark_dirty(compositor, layer_rect(layer));
+  }
+}
+
+void epd_layer_set_hidden(EpdCompositor *compositor, EpdLayer *layer,
+                          bool hidden) {
+  if (layer->hidden != hidden) {
+    layer->hidden = hidden;
+    mark_dirty(compositor, layer_rect(layer));
+  }
+}
+
+void epd_compositor_render(EpdCompositor *compositor) {
+  for (int i = 0; i < compositor->dirty_count; i++) {
+    epd_draw_composite(compositor->dirty[i], compositor);
+  }
+  compositor->dirty_count = 0;
+}
+
+static inline uint8_t IRAM_ATTR get_nibble(const uint8_t *row, int x) {
+  return x % 2 ? row[x / 2] >> 4 : row[x / 2] & 0x0F;
+}
+
+static inline void IRAM_ATTR set_nibble(uint8_t *row, int x, uint8_t v) {
+  uint8_t *byte = &row[x / 2];
+  *byte = x % 2 ? (*byte & 0x0F) | (v << 4) : (*byte & 0xF0) | v;
+}
+
+/*
+ * Copy pixels between equally aligned rows, whole bytes in the middle.
+ */
+static void IRAM_ATTR copy_span(uint8_t *line, int x0, int x1,
+                                const uint8_t *src, int sx0) {
+  if (x0 % 2) {
+    set_nibble(line, x0++, get_nibble(src, sx0++));
+  }
+  int bytes = (x1 - x0) / 2;
+  memcpy(line + x0 / 2, src + sx0 / 2, bytes);
+  x0 += bytes * 2;
+  sx0 += bytes * 2;
+  if (x0 < x1) {
+    set_nibble(line, x0, get_nibble(src, sx0));
+  }
+}
+
+void IRAM_ATTR epd_compose_row(const EpdCompositor *compositor, int y, int x0,
+                               int x1, uint8_t *line) {
+  // white background.
+  int bx = x0;
+  if (bx % 2 && bx < x1) {
+    set_nibble(line, bx++, 0xF);
+  }
+  memset(line + bx / 2, 0xFF, (x1 - bx) / 2);
+  bx += (x1 - bx) / 2 * 2;
+  if (bx < x1) {
+    set_nibble(line, bx, 0xF);
+  }
+
+  for (int l = 0; l < compositor->layer_count; l++) {
+    const EpdLayer *layer = compositor->layers[l];
+    int ly = y - layer->y;
+    if (layer->hidden || ly < 0 || ly >= layer->height) {
+      continue;
+    }
+    int lx0 = max_int(x0, layer->x);
+    int lx1 = min_int(x1, layer->x + layer->width);
+    if (lx1 <= lx0) {
+      continue;
+    }
+    const uint8_t *src = layer->data + ly * ((layer->width + 1) / 2);
+    int offset = layer->x;
+
+    switch (layer->blend) {
+    case EPD_BLEND_OPAQUE:
+      if ((lx0 - offset) % 2 == lx0 % 2) {
+        copy_span(line, lx0, lx1, src, lx0 - offset);
+        break;
+      }
+      for (int x = lx0; x < lx1; x++) {
+        set_nibble(line, x, get_nibble(src, x - offset));
+      }
+      break;
+    case EPD_BLEND_KEY:
+      for (int x = lx0; x < lx1; x++) {
+        uint8_t v = get_nibble(src, x - offset);
+        if (v != layer->key) {
+          set_nibble(line, x, v);
+        }
+      }
+      break;
+    case EPD_BLEND_ALPHA: {
+      int alpha = min_int(layer->alpha, 15);
+      if (alpha == 0) {
+        break;
+      }
+      for (int x = lx0; x < lx1; x++) {
+        uint8_t v = get_nibble(src, x - offset);
+        uint8_t below = get_nibble(line, x);
+        set_nibble(line, x, (v * alpha + below * (15 - alpha) + 7) / 15);
+      }
+      break;
+    }
+    }
+  }
+}
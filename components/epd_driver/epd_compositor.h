@@ -0,0 +1,22 @@
+/**
+ * Row composition of layer stacks, see `EpdCompositor`.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include <stdint.h>
+
+/**
+ * Compose the pixels `x0` to `x1 - 1` of screen row `y` into `line`,
+ * a display row of 4bpp pixels. Other pixels of `line` are not touched.
+ */
+void epd_compose_row(const EpdCompositor *compositor, int y, int x0, int x1,
+                     uint8_t *line);
+
+/**
+ * Clear an area with the compositor's `clear_cycles`, if any,
+ * and draw the composed layers to it.
+ * Implemented by the driver, which composes the rows while drawing.
+ */
+void epd_draw_composite(Rect_t area, const EpdCompositor *compositor);
@@ -0,0 +1,600 @@
+#include "epd_display_list.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+
+static bool intersects(Rect_t a, Rect_t b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+         b.y < a.y + a.height;
+}
+
+/*
+ * Bounds of the points (x[i], y[i]), including the pixels at the points.
+ */
+static Rect_t point_bounds(const int *x, const int *y, int n) {
+  int x0 = x[0], x1 = x[0], y0 = y[0], y1 = y[0];
+  for (int i = 1; i < n; i++) {
+    x0 = min_int(x0, x[i]);
+    x1 = max_int(x1, x[i]);
+    y0 = min_int(y0, y[i]);
+    y1 = max_int(y1, y[i]);
+  }
+  Rect_t bounds = {.x = x0, .y = y0, .width = x1 - x0 + 1,
+                   .height = y1 - y0 + 1};
+  return bounds;
+}
+
+void epd_display_list_init(EpdDisplayList *list) {
+  memset(list, 0, sizeof(EpdDisplayList));
+}
+
+void epd_display_list_clear(EpdDisplayList *list) {
+  for (int i = 0; i < list->count; i++) {
+    if (list->commands[i].type == EPD_CMD_TEXT) {
+      free(list->commands[i].text.string);
+    }
+  }
+  list->count = 0;
+}
+
+void epd_display_list_free(EpdDisplayList *list) {
+  epd_display_list_clear(list);
+  free(list->commands);
+  epd_display_list_init(list);
+}
+
+/*
+ * Append a command, growing the list if necessary.
+ * Returns NULL if out of memory.
+ */
+static EpdDrawCommand *append(EpdDisplayList *list,
+                              enum EpdDrawCommandType type, uint8_t color) {
+  if (list->count == list->capacity) {
+    int capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+    EpdDrawCommand *commands = (EpdDrawCommand *)realloc(
+        list->commands, capacity * sizeof(EpdDrawCommand));
+    if (commands == NULL) {
+      return NULL;
+    }
+    list->commands = commands;
+    list->capacity = capacity;
+  }
+  EpdDrawCommand *cmd = &list->commands[list->count++];
+  memset(cmd, 0, sizeof(EpdDrawCommand));
+  cmd->type = type;
+  cmd->color = color;
+  return cmd;
+}
+
+static bool append_shape(EpdDisplayList *list, enum EpdDrawCommandType type,
+                         uint8_t color, Rect_t bounds, int a0, int a1, int a2,
+                         int a3, int a4, int a5) {
+  EpdDrawCommand *cmd = append(list, type, color);
+  if (cmd == NULL) {
+    return false;
+  }
+  cmd->bounds = bounds;
+  cmd->args[0] = a0;
+  cmd->args[1] = a1;
+  cmd->args[2] = a2;
+  cmd->args[3] = a3;
+  cmd->args[4] = a4;
+  cmd->args[5] = a5;
+  return true;
+}
+
+bool epd_display_list_draw_pixel(EpdDisplayList *list, int x, int y,
+                                 uint8_t color) {
+  Rect_t bounds = {.x = x, .y = y, .width = 1, .height = 1};
+  return append_shape(list, EPD_CMD_PIXEL, color, bounds, x, y, 0, 0, 0, 0);
+}
+
+bool epd_display_list_draw_hline(EpdDisplayList *list, int x, int y,
+                                 int length, uint8_t color) {
+  Rect_t bounds = {.x = x, .y = y, .width = length, .height = 1};
+  return append_shape(list, EPD_CMD_HLINE, color, bounds, x, y, length, 0, 0,
+                      0);
+}
+
+bool epd_display_list_draw_vline(EpdDisplayList *list, int x, int y,
+                                 int length, uint8_t color) {
+  Rect_t bounds = {.x = x, .y = y, .width = 1, .height = length};
+  return append_shape(list, EPD_CMD_VLINE, color, bounds, x, y, length, 0, 0,
+                      0);
+}
+
+bool epd_display_list_draw_line(EpdDisplayList *list, int x0, int y0, int x1,
+                                int y1, uint8_t color) {
+  int xs[] = {x0, x1};
+  int ys[] = {y0, y1};
+  return append_shape(list, EPD_CMD_LINE, color, point_bounds(xs, ys, 2), x0,
+                      y0, x1, y1, 0, 0);
+}
+
+bool epd_display_list_draw_rect(EpdDisplayList *list, int x, int y, int w,
+                                int h, uint8_t color) {
+  Rect_t bounds = {.x = x, .y = y, .width = w, .height = h};
+  return append_shape(list, EPD_CMD_RECT, color, bounds, x, y, w, h, 0, 0);
+}
+
+bool epd_display_list_fill_rect(EpdDisplayList *list, int x, int y, int w,
+                                int h, uint8_t color) {
+  Rect_t bounds = {.x = x, .y = y, .width = w, .height = h};
+  return append_shape(list, EPD_CMD_FILL_RECT, color, bounds, x, y, w, h, 0,
+                      0);
+}
+
+bool epd_display_list_draw_circle(EpdDisplayList *list, int x, int y, int r,
+                                  uint8_t color) {
+  Rect_t bounds = {
+      .x = x - r, .y = y - r, .width = 2 * r + 1, .height = 2 * r + 1};
+  return append_shape(list, EPD_CMD_CIRCLE, color, bounds, x, y, r, 0, 0, 0);
+}
+
+bool epd_display_list_fill_circle(EpdDisplayList *list, int x, int y, int r,
+                                  uint8_t color) {
+  Rect_t bounds = {
+      .x = x - r, .y = y - r, .width = 2 * r + 1, .height = 2 * r + 1};
+  return append_shape(list, EPD_CMD_FILL_CIRCLE, color, bounds, x, y, r, 0, 0,
+                      0);
+}
+
+bool epd_display_list_draw_triangle(EpdDisplayList *list, int x0, int y0,
+                                    int x1, int y1, int x2, int y2,
+                                    uint8_t color) {
+  int xs[] = {x0, x1, x2};
+  int ys[] = {y0, y1, y2};
+  return append_shape(list, EPD_CMD_TRIANGLE, color, point_bounds(xs, ys, 3),
+                      x0, y0, x1, y1, x2, y2);
+}
+
+bool epd_display_list_fill_triangle(EpdDisplayList *list, int x0, int y0,
+                                    int x1, int y1, int x2, int y2,
+                                    uint8_t color) {
+  int xs[] = {x0, x1, x2};
+  int ys[] = {y0, y1, y2};
+  return append_shape(list, EPD_CMD_FILL_TRIANGLE, color,
+                      point_bounds(xs, ys, 3), x0, y0, x1, y1, x2, y2);
+}
+
+bool epd_display_list_copy_image(EpdDisplayList *list, Rect_t image_area,
+                                 const uint8_t *image_data) {
+  EpdDrawCommand *cmd = append(list, EPD_CMD_IMAGE, 0);
+  if (cmd == NULL) {
+    return false;
+  }
+  cmd->bounds = image_area;
+  cmd->image.area = image_area;
+  cmd->image.data = image_data;
+  return true;
+}
+
+bool epd_display_list_write(EpdDisplayList *list, const GFXfont *font,
+                            const char *string, int *cursor_x, int *cursor_y,
+                            const FontProperties *properties) {
+  FontProperties props = {.fg_color = 0, .bg_color = 15};
+  if (properties != NULL) {
+    props = *properties;
+  }
+  int x = *cursor_x, y = *cursor_y;
+  int x1, y1, w, h;
+  get_text_bounds(font, string, &x, &y, &x1, &y1, &w, &h, &props);
+  if (w < 0 || h < 0) {
+    return true;
+  }
+
+  char *copy = strdup(string);
+  if (copy == NULL) {
+    return false;
+  }
+  EpdDrawCommand *cmd = append(list, EPD_CMD_TEXT, 0);
+  if (cmd == NULL) {
+    free(copy);
+    return false;
+  }
+  // glyphs reach at most from the ascender to the descender line,
+  // the background is drawn from the cursor.
+  int left = min_int(x1, *cursor_x);
+  int right = max_int(x1, *cursor_x) + w;
+  int top = min_int(y1, *cursor_y - font->ascender);
+  int bottom = max_int(y1 + h, *cursor_y - font->descender);
+  Rect_t bounds = {
+      .x = left, .y = top, .width = right - left, .height = bottom - top};
+  cmd->bounds = bounds;
+  cmd->text.font = font;
+  cmd->text.string = copy;
+  cmd->text.x = *cursor_x;
+  cmd->text.y = *cursor_y;
+  cmd->text.props = props;
+  *cursor_x = x;
+  return true;
+}
+
+static void run_command(const EpdDrawCommand *cmd, const EpdBand *band,
+                        EpdGlyphDecoder *decoder) {
+  const int *a = cmd->args;
+  switch (cmd->type) {
+  case EPD_CMD_PIXEL:
+    epd_draw_pixel_band(a[0], a[1], cmd->color, band);
+    break;
+  case EPD_CMD_HLINE:
+    epd_draw_hline_band(a[0], a[1], a[2], cmd->color, band);
+    break;
+  case EPD_CMD_VLINE:
+    epd_draw_vline_band(a[0], a[1], a[2], cmd->color, band);
+    break;
+  case EPD_CMD_LINE:
+    epd_draw_line_band(a[0], a[1], a[2], a[3], cmd->color, band);
+    break;
+  case EPD_CMD_RECT:
+    epd_draw_rect_band(a[0], a[1], a[2], a[3], cmd->color, band);
+    break;
+  case EPD_CMD_FILL_RECT:
+    epd_fill_rect_band(a[0], a[1], a[2], a[3], cmd->color, band);
+    break;
+  case EPD_CMD_CIRCLE:
+    epd_draw_circle_band(a[0], a[1], a[2], cmd->color, band);
+    break;
+  case EPD_CMD_FILL_CIRCLE:
+    epd_fill_circle_band(a[0], a[1], a[2], cmd->color, band);
+    break;
+  case EPD_CMD_TRIANGLE:
+    epd_draw_triangle_band(a[0], a[1], a[2], a[3], a[4], a[5], cmd->color,
+                           band);
+    break;
+  case EPD_CMD_FILL_TRIANGLE:
+    epd_fill_triangle_band(a[0], a[1], a[2], a[3], a[4], a[5], cmd->color,
+                           band);
+    break;
+  case EPD_CMD_IMAGE:
+    epd_copy_to_band(cmd->image.area, cmd->image.data, band);
+    break;
+  case EPD_CMD_TEXT: {
+    int x = cmd->text.x, y = cmd->text.y;
+    epd_write_band_decoder(cmd->text.font, cmd->text.string, &x, &y, band,
+                           &cmd->text.props, decoder);
+    break;
+  }
+  }
+}
+
+static void rasterize_commands(const EpdDisplayList *list,
+                               const EpdBand *band, EpdGlyphDecoder *decoder) {
+  for (int i = 0; i < list->count; i++) {
+    const EpdDrawCommand *cmd = &list->commands[i];
+    if (intersects(cmd->bounds, band->clip)) {
+      run_command(cmd, band, decoder);
+    }
+  }
+}
+
+void epd_display_list_rasterize(const EpdDisplayList *list,
+                                const EpdBand *band) {
+  EpdGlyphDecoder decoder = {0};
+  rasterize_commands(list, band, &decoder);
+  epd_glyph_decoder_free(&decoder);
+}
+
+/*
+ * Rasterize band `b` of the drawn area to `data`, on a white background.
+ */
+static void rasterize_band(EpdBandRaster *raster, int b, uint8_t *data) {
+  int64_t start = esp_timer_get_time();
+  const Rect_t clip = raster->clip;
+  int y = clip.y + b * raster->band_rows;
+  int rows = min_int(raster->band_rows, clip.y + clip.height - y);
+  memset(data, 0xFF, rows * epd_width() / 2);
+  EpdBand band = {
+      .data = data,
+      .clip = {.x = clip.x, .y = y, .width = clip.width, .height = rows}};
+  rasterize_commands(raster->list, &band, &raster->decoder);
+  raster->bands_rasterized++;
+  raster->raster_us += esp_timer_get_time() - start;
+}
+
+bool epd_band_raster_begin(EpdBandRaster *raster, const EpdDisplayList *list,
+                           Rect_t area) {
+  memset(raster, 0, sizeof(EpdBandRaster));
+  Rect_t screen = epd_full_screen();
+  int x0 = max_int(area.x, 0);
+  int y0 = max_int(area.y, 0);
+  int x1 = min_int(area.x + area.width, screen.width);
+  int y1 = min_int(area.y + area.height, screen.height);
+  raster->list = list;
+  raster->clip.x = x0;
+  raster->clip.y = y0;
+  raster->clip.width = max_int(x1 - x0, 0);
+  raster->clip.height = max_int(y1 - y0, 0);
+  raster->band_rows = CONFIG_EPD_BAND_ROWS;
+  raster->band_count =
+      (raster->clip.height + raster->band_rows - 1) / raster->band_rows;
+  raster->scratch_band = -1;
+  if (raster->clip.width == 0 || raster->band_count == 0) {
+    raster->band_count = 0;
+    return true;
+  }
+
+  raster->cached = (EpdCachedBand *)heap_caps_calloc(
+      raster->band_count, sizeof(EpdCachedBand), MALLOC_CAP_8BIT);
+  if (raster->cached == NULL) {
+    return false;
+  }
+  // cache bands while enough memory is left for the rest of the system.
+  const uint32_t band_size = raster->band_rows * epd_width() / 2;
+  int cached = 0;
+  while (cached < raster->band_count &&
+         heap_caps_get_free_size(MALLOC_CAP_8BIT) >=
+             band_size + CONFIG_EPD_BAND_CACHE_RESERVE) {
+    raster->cached[cached].data =
+        (uint8_t *)heap_caps_malloc(band_size, MALLOC_CAP_8BIT);
+    if (raster->cached[cached].data == NULL) {
+      break;
+    }
+    cached++;
+  }
+  if (cached < raster->band_count) {
+    raster->scratch = (uint8_t *)heap_caps_malloc(
+        band_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (raster->scratch == NULL && cached > 0) {
+      // give up the last cached band for the scratch band.
+      raster->scratch = raster->cached[--cached].data;
+      raster->cached[cached].data = NULL;
+    }
+    if (raster->scratch == NULL) {
+      epd_band_raster_end(raster);
+      return false;
+    }
+  }
+  return true;
+}
+
+const uint8_t *epd_band_raster_row(EpdBandRaster *raster, int y) {
+  int b = (y - raster->clip.y) / raster->band_rows;
+  int row = (y - raster->clip.y) % raster->band_rows;
+  EpdCachedBand *cached = &raster->cached[b];
+  uint8_t *data;
+  if (cached->data != NULL) {
+    if (!cached->ready) {
+      rasterize_band(raster, b, cached->data);
+      cached->ready = true;
+    }
+    data = cached->data;
+  } else {
+    if (raster->scratch_band != b) {
+      rasterize_band(raster, b, raster->scratch);
+      raster->scratch_band = b;
+    }
+    data = raster->scratch;
+  }
+  return data + row * epd_width() / 2;
+}
+
+void epd_band_raster_end(EpdBandRaster *raster) {
+  for (int b = 0; raster->cached != NULL && b < raster->band_count; b++) {
+    heap_caps_free(raster->cached[b].data);
+  }
+  heap_caps_free(raster->cached);
+  heap_caps_free(raster->scratch);
+  raster->cached = NULL;
+  raster->scratch = NULL;
+  epd_glyph_decoder_free(&raster->decoder);
+}
+
+// Tiles are at least this wide, so no byte is shared between tiles.
+#define MIN_TILE_SIZE 2
+#define RENDER_TASK_STACK_SIZE 4096
+
+/// Tiles of a framebuffer and the commands drawing to each of them.
+typedef struct {
+  const EpdDisplayList *list;
+  uint8_t *framebuffer;
+  int tile_size;
+  int tiles_x;
+  int tile_count;
+  /// Commands of tile t are `bins[bin_start[t]]` to `bins[bin_start[t + 1]]`.
+  uint32_t *bin_start;
+  uint16_t *bins;
+  /// Next tile to rasterize.
+  int next_tile;
+  portMUX_TYPE next_mux;
+  EpdRenderReport report;
+} TileRender;
+
+// The helper task is created once and waits for renders, starting a task
+// for every render took longer than rasterizing a few tiles.
+static TaskHandle_t helper_task = NULL;
+static SemaphoreHandle_t helper_start = NULL;
+static SemaphoreHandle_t helper_done = NULL;
+// Held by the render using the helper, concurrent renders run alone.
+static SemaphoreHandle_t helper_lock = NULL;
+static TileRender *helper_render = NULL;
+
+static Rect_t tile_rect(const TileRender *render, int t) {
+  Rect_t screen = epd_full_screen();
+  Rect_t rect = {.x = t % render->tiles_x * render->tile_size,
+                 .y = t / render->tiles_x * render->tile_size};
+  rect.width = min_int(render->tile_size, screen.width - rect.x);
+  rect.height = min_int(render->tile_size, screen.height - rect.y);
+  return rect;
+}
+
+/*
+ * Get the range of tiles covered by a command, false if it is off screen.
+ */
+static bool tile_range(const TileRender *render, Rect_t bounds, int *tx0,
+                       int *ty0, int *tx1, int *ty1) {
+  Rect_t screen = epd_full_screen();
+  if (!intersects(bounds, screen)) {
+    return false;
+  }
+  *tx0 = max_int(bounds.x, 0) / render->tile_size;
+  *ty0 = max_int(bounds.y, 0) / render->tile_size;
+  *tx1 = (min_int(bounds.x + bounds.width, screen.width) - 1) /
+         render->tile_size;
+  *ty1 = (min_int(bounds.y + bounds.height, screen.height) - 1) /
+         render->tile_size;
+  return true;
+}
+
+/*
+ * Sort the command indices into per-tile bins, in drawing order.
+ */
+static bool bin_commands(TileRender *render) {
+  const EpdDisplayList *list = render->list;
+  render->bin_start = (uint32_t *)heap_caps_calloc(
+      render->tile_count + 1, sizeof(uint32_t), MALLOC_CAP_8BIT);
+  if (render->bin_start == NULL) {
+    return false;
+  }
+  // count the commands of every tile, bin_start[t + 1] is the count of t.
+  uint32_t total = 0;
+  for (int i = 0; i < list->count; i++) {
+    int tx0, ty0, tx1, ty1;
+    if (!tile_range(render, list->commands[i].bounds, &tx0, &ty0, &tx1,
+                    &ty1)) {
+      continue;
+    }
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        render->bin_start[ty * render->tiles_x + tx + 1]++;
+      }
+    }
+    total += (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+  }
+  for (int t = 0; t < render->tile_count; t++) {
+    render->bin_start[t + 1] += render->bin_start[t];
+  }
+  render->report.binned_commands = total;
+
+  render->bins = (uint16_t *)heap_caps_malloc(
+      max_int(total, 1) * sizeof(uint16_t), MALLOC_CAP_8BIT);
+  uint32_t *fill = (uint32_t *)heap_caps_malloc(
+      render->tile_count * sizeof(uint32_t), MALLOC_CAP_8BIT);
+  if (render->bins == NULL || fill == NULL) {
+    heap_caps_free(fill);
+    return false;
+  }
+  memcpy(fill, render->bin_start, render->tile_count * sizeof(uint32_t));
+  for (int i = 0; i < list->count; i++) {
+    int tx0, ty0, tx1, ty1;
+    if (!tile_range(render, list->commands[i].bounds, &tx0, &ty0, &tx1,
+                    &ty1)) {
+      continue;
+    }
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        render->bins[fill[ty * render->tiles_x + tx]++] = i;
+      }
+    }
+  }
+  heap_caps_free(fill);
+  return true;
+}
+
+/*
+ * Rasterize tiles until none is left. `core` is 0 for the calling task
+ * and 1 for the helper task.
+ */
+static void render_tiles(TileRender *render, int core) {
+  int64_t start = esp_timer_get_time();
+  const int stride = epd_width() / 2;
+  EpdGlyphDecoder decoder = {0};
+  while (true) {
+    portENTER_CRITICAL(&render->next_mux);
+    int t = render->next_tile++;
+    portEXIT_CRITICAL(&render->next_mux);
+    if (t >= render->tile_count) {
+      break;
+    }
+    uint32_t first = render->bin_start[t];
+    uint32_t end = render->bin_start[t + 1];
+    if (first == end) {
+      continue;
+    }
+    Rect_t rect = tile_rect(render, t);
+    EpdBand band = {.data = render->framebuffer + rect.y * stride,
+                    .clip = rect};
+    for (uint32_t i = first; i < end; i++) {
+      run_command(&render->list->commands[render->bins[i]], &band, &decoder);
+    }
+    render->report.tiles_per_core[core]++;
+  }
+  epd_glyph_decoder_free(&decoder);
+  render->report.busy_us[core] = esp_timer_get_time() - start;
+}
+
+static void render_helper_task(void *arg) {
+  while (true) {
+    xSemaphoreTake(helper_start, portMAX_DELAY);
+    render_tiles(helper_render, 1);
+    xSemaphoreGive(helper_done);
+  }
+}
+
+void epd_display_list_render_init() {
+  if (helper_task != NULL) {
+    return;
+  }
+  helper_start = xSemaphoreCreateBinary();
+  helper_done = xSemaphoreCreateBinary();
+  helper_lock = xSemaphoreCreateMutex();
+  assert(helper_start != NULL && helper_done != NULL && helper_lock != NULL);
+  if (xTaskCreatePinnedToCore(render_helper_task, "epd_render_tiles",
+                              RENDER_TASK_STACK_SIZE, NULL,
+                              uxTaskPriorityGet(NULL), &helper_task,
+                              tskNO_AFFINITY) != pdPASS) {
+    abort();
+  }
+}
+
+void epd_display_list_render(const EpdDisplayList *list, uint8_t *framebuffer,
+                             EpdRenderReport *report) {
+  int64_t start = esp_timer_get_time();
+  Rect_t screen = epd_full_screen();
+  TileRender render = {
+      .list = list,
+      .framebuffer = framebuffer,
+      .tile_size = max_int(CONFIG_EPD_RENDER_TILE_SIZE & ~1, MIN_TILE_SIZE),
+      .next_mux = portMUX_INITIALIZER_UNLOCKED,
+  };
+  render.tiles_x = (screen.width + render.tile_size - 1) / render.tile_size;
+  render.tile_count = render.tiles_x * ((screen.height + render.tile_size - 1) /
+                                        render.tile_size);
+
+  bool binned = list->count <= UINT16_MAX && bin_commands(&render);
+  if (!binned) {
+    // draw everything in order, like the drawing functions would.
+    EpdBand band = {.data = framebuffer, .clip = screen};
+    epd_display_list_rasterize(list, &band);
+  } else {
+    bool helper = helper_task != NULL &&
+                  xSemaphoreTake(helper_lock, 0) == pdTRUE;
+    if (helper) {
+      helper_render = &render;
+      xSemaphoreGive(helper_start);
+    }
+    render_tiles(&render, 0);
+    if (helper) {
+      xSemaphoreTake(helper_done, portMAX_DELAY);
+      helper_render = NULL;
+      xSemaphoreGive(helper_lock);
+    }
+  }
+  heap_caps_free(render.bin_start);
+  heap_caps_free(render.bins);
+
+  if (report != NULL) {
+    render.report.tiles = render.tile_count;
+    render.report.time_us = esp_timer_get_time() - start;
+    *report = render.report;
+  }
+}
@@ -0,0 +1,104 @@
+/**
+ * Display list commands and their rasterization in bands,
+ * see `EpdDisplayList`.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include "epd_font.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+enum EpdDrawCommandType {
+  EPD_CMD_PIXEL,
+  EPD_CMD_HLINE,
+  EPD_CMD_VLINE,
+  EPD_CMD_LINE,
+  EPD_CMD_RECT,
+  EPD_CMD_FILL_RECT,
+  EPD_CMD_CIRCLE,
+  EPD_CMD_FILL_CIRCLE,
+  EPD_CMD_TRIANGLE,
+  EPD_CMD_FILL_TRIANGLE,
+  EPD_CMD_IMAGE,
+  EPD_CMD_TEXT,
+};
+
+/// A recorded drawing function call.
+typedef struct EpdDrawCommand {
+  enum EpdDrawCommandType type;
+  uint8_t color;
+  /// Screen area the command may draw to.
+  Rect_t bounds;
+  union {
+    /// Arguments of the shape commands, in the order of the
+    /// drawing function's arguments.
+    int args[6];
+    struct {
+      Rect_t area;
+      const uint8_t *data;
+    } image;
+    struct {
+      const GFXfont *font;
+      /// Copy of the text, owned by the display list.
+      char *string;
+      int x;
+      int y;
+      FontProperties props;
+    } text;
+  };
+} EpdDrawCommand;
+
+/// A band kept over all frames of a draw.
+typedef struct {
+  uint8_t *data;
+  bool ready;
+} EpdCachedBand;
+
+/// A display list drawn band by band, for the row producer.
+typedef struct {
+  const EpdDisplayList *list;
+  /// The drawn area, clipped to the screen.
+  Rect_t clip;
+  int band_rows;
+  int band_count;
+  /// `band_count` entries, `data` is NULL if a band is not cached.
+  EpdCachedBand *cached;
+  /// Buffer for bands which are rasterized in every frame.
+  uint8_t *scratch;
+  /// Band held in `scratch`, or -1.
+  int scratch_band;
+  /// Glyph buffers of the task rasterizing the bands.
+  EpdGlyphDecoder decoder;
+  /// Bands rasterized and the time spent on them,
+  /// collected into the draw statistics after every frame.
+  uint32_t bands_rasterized;
+  uint32_t raster_us;
+} EpdBandRaster;
+
+/**
+ * Prepare drawing a display list to `area`. As many bands as the free
+ * memory allows are cached, the others are rasterized again in every frame.
+ * Returns false if there is not enough memory for a single band.
+ */
+bool epd_band_raster_begin(EpdBandRaster *raster, const EpdDisplayList *list,
+                           Rect_t area);
+
+/**
+ * Get screen row `y` of the drawn area as `epd_width() / 2` bytes
+ * of 4bpp pixels, rasterizing its band if necessary. Pixels outside of
+ * the area are white. Rows must be requested in screen order in each frame.
+ */
+const uint8_t *epd_band_raster_row(EpdBandRaster *raster, int y);
+
+/**
+ * Free the band buffers.
+ */
+void epd_band_raster_end(EpdBandRaster *raster);
+
+/**
+ * Create the helper task of `epd_display_list_render`, once.
+ * Called by `epd_init`, renders before run on the calling task only.
+ */
+void epd_display_list_render_init();
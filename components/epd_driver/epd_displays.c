@@ -0,0 +1,117 @@
+#include "epd_driver.h"
+
+/* 4bpp Contrast cycles in order of contrast (Darkest first).  */
+static const int contrast_cycles_4_oc4[15] = {30, 30, 20, 20, 30,  30,  30, 40,
+                                              40, 50, 50, 50, 100, 200, 300};
+
+static const int contrast_cycles_4_white_oc4[15] = {
+    10, 10, 8, 8, 8, 8, 8, 10, 10, 15, 15, 20, 20, 100, 300};
+
+static const int contrast_cycles_4_tc2[15] = {15, 8,  8,  8,  8,  8,   10, 10,
+                                              10, 10, 20, 20, 50, 100, 200};
+
+static const int contrast_cycles_4_white_tc2[15] = {7, 8, 8, 6, 6, 6,  6,  6,
+                                                     6, 6, 6, 8, 8, 50, 150};
+
+static const int contrast_cycles_4_ut2[15] = {
+    60, 60, 40, 40, 60, 60, 60, 80, 80, 100, 100, 100, 200, 200, 300};
+
+static const int contrast_cycles_4_white_ut2[15] = {
+    50, 30, 30, 30, 30, 30, 30, 30, 30, 30, 50, 50, 50, 100, 200};
+
+const EpdDisplay epd_display_ed097oc4 = {
+    .name = "ED097OC4",
+    .width = 1200,
+    .height = 825,
+    .contrast_cycles_4 = contrast_cycles_4_oc4,
+    .contrast_cycles_4_white = contrast_cycles_4_white_oc4,
+    .clear_cycle_time = 12,
+    // According to the spec, the OC4 maximum CKV frequency is 200kHz.
+    .skip_ckv_high = 45,
+    .skip_ckv_low = 5,
+    .row_ckv_low = 50,
+    .bus_clock_mhz = 60,
+};
+
+const EpdDisplay epd_display_ed097oc4_lq = {
+    .name = "ED097OC4_LQ",
+    .width = 1200,
+    .height = 825,
+    .contrast_cycles_4 = contrast_cycles_4_oc4,
+    .contrast_cycles_4_white = contrast_cycles_4_white_oc4,
+    .clear_cycle_time = 12,
+    .skip_ckv_high = 45,
+    .skip_ckv_low = 5,
+    .row_ckv_low = 50,
+    .bus_clock_mhz = 120,
+};
+
+const EpdDisplay epd_display_ed097tc2 = {
+    .name = "ED097TC2",
+    .width = 1200,
+    .height = 825,
+    .contrast_cycles_4 = contrast_cycles_4_tc2,
+    .contrast_cycles_4_white = contrast_cycles_4_white_tc2,
+    .clear_cycle_time = 12,
+    .skip_ckv_high = 2,
+    .skip_ckv_low = 2,
+    .row_ckv_low = 1,
+    .bus_clock_mhz = 60,
+};
+
+const EpdDisplay epd_display_ed060sc4 = {
+    .name = "ED060SC4",
+    .width = 800,
+    .height = 600,
+    .contrast_cycles_4 = contrast_cycles_4_oc4,
+    .contrast_cycles_4_white = contrast_cycles_4_white_oc4,
+    .clear_cycle_time = 12,
+    .skip_ckv_high = 45,
+    .skip_ckv_low = 5,
+    .row_ckv_low = 50,
+    .bus_clock_mhz = 60,
+};
+
+const EpdDisplay epd_display_ed047tc1 = {
+    .name = "ED047TC1",
+    .width = 960,
+    .height = 540,
+    .contrast_cycles_4 = contrast_cycles_4_oc4,
+    .contrast_cycles_4_white = contrast_cycles_4_white_oc4,
+    .clear_cycle_time = 12,
+    .skip_ckv_high = 45,
+    .skip_ckv_low = 5,
+    .row_ckv_low = 50,
+    .bus_clock_mhz = 60,
+};
+
+const EpdDisplay epd_display_ed133ut2 = {
+    .name = "ED133UT2",
+    .width = 1600,
+    .height = 1200,
+    .contrast_cycles_4 = contrast_cycles_4_ut2,
+    .contrast_cycles_4_white = contrast_cycles_4_white_ut2,
+    .clear_cycle_time = 12,
+    .skip_ckv_high = 2,
+    .skip_ckv_low = 2,
+    .row_ckv_low = 1,
+    .bus_clock_mhz = 60,
+};
+
+const EpdDisplay *epd_default_display() {
+#if defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4)
+  return &epd_display_ed097oc4;
+#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4_LQ)
+  return &epd_display_ed097oc4_lq;
+#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2)
+  return &epd_display_ed097tc2;
+#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED060SC4)
+  return &epd_display_ed060sc4;
+#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED047TC1)
+  return &epd_display_ed047tc1;
+#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
+  return &epd_display_ed133ut2;
+#else
+#error "no display type defined!"
+#endif
+}
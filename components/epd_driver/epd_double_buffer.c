@@ -0,0 +1,169 @@
+#include "epd_driver.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+// Changed pixels are darkened in a few 1bpp passes before they are
+// lightened to their new level, giving the particles time to follow.
+#define DARKEN_PASSES 3
+#define DARKEN_TIME 200
+#define DARKEN_SETTLE_MS 20
+
+/*
+ * Allocate a buffer in PSRAM, or in internal RAM on boards without it.
+ */
+static uint8_t *alloc_buffer(size_t size) {
+  uint8_t *buf = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+  if (buf == NULL) {
+    buf = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+  return buf;
+}
+
+bool epd_double_buffer_init(EpdDoubleBuffer *buffer) {
+  int width = epd_width();
+  int height = epd_height();
+  buffer->front = alloc_buffer(width / 2 * height);
+  buffer->back = alloc_buffer(width / 2 * height);
+  buffer->mask = alloc_buffer(width / 8 * height);
+  buffer->changed_lines =
+      (bool *)heap_caps_malloc(height * sizeof(bool), MALLOC_CAP_8BIT);
+  if (buffer->front == NULL || buffer->back == NULL || buffer->mask == NULL ||
+      buffer->changed_lines == NULL) {
+    epd_double_buffer_free(buffer);
+    return false;
+  }
+  epd_double_buffer_reset(buffer);
+  return true;
+}
+
+void epd_double_buffer_free(EpdDoubleBuffer *buffer) {
+  heap_caps_free(buffer->front);
+  heap_caps_free(buffer->back);
+  heap_caps_free(buffer->mask);
+  heap_caps_free(buffer->changed_lines);
+  memset(buffer, 0, sizeof(EpdDoubleBuffer));
+}
+
+void epd_double_buffer_reset(EpdDoubleBuffer *buffer) {
+  memset(buffer->front, 0xFF, epd_width() / 2 * epd_height());
+  memset(buffer->back, 0xFF, epd_width() / 2 * epd_height());
+}
+
+/*
+ * Compare a row of the front and back image, setting a mask bit for every
+ * changed pixel. Returns the number of changed pixels, `darken_only` is
+ * cleared if a changed pixel is not white on the display.
+ */
+static uint32_t diff_row(const uint8_t *front, const uint8_t *back,
+                         uint8_t *mask, int width, bool *darken_only) {
+  uint32_t changed = 0;
+  memset(mask, 0, width / 8);
+  for (int i = 0; i < width / 2; i++) {
+    uint8_t diff = front[i] ^ back[i];
+    if (diff == 0) {
+      continue;
+    }
+    // pixel 2i is the low nibble, its mask bit is (2i) % 8 of byte i / 4.
+    uint8_t bits = ((diff & 0x0F) != 0) | ((diff & 0xF0) != 0) << 1;
+    mask[i / 4] |= bits << (i % 4 * 2);
+    changed += (bits & 1) + (bits >> 1);
+    if (((bits & 1) && (front[i] & 0x0F) != 0x0F) ||
+        ((bits & 2) && (front[i] & 0xF0) != 0xF0)) {
+      *darken_only = false;
+    }
+  }
+  return changed;
+}
+
+/*
+ * Replace the front row with the changed pixels of the back row,
+ * unchanged pixels get `keep`, the value not driven by the draw mode.
+ */
+static void mask_row(uint8_t *front, const uint8_t *back, const uint8_t *mask,
+                     int width, uint8_t keep) {
+  for (int i = 0; i < width / 2; i++) {
+    uint8_t bits = mask[i / 4] >> (i % 4 * 2);
+    uint8_t value = keep;
+    if (bits & 1) {
+      value = (value & 0xF0) | (back[i] & 0x0F);
+    }
+    if (bits & 2) {
+      value = (value & 0x0F) | (back[i] & 0xF0);
+    }
+    front[i] = value;
+  }
+}
+
+void epd_double_buffer_commit(EpdDoubleBuffer *buffer,
+                              EpdCommitReport *report) {
+  int width = epd_width();
+  int height = epd_height();
+  int stride = width / 2;
+  EpdCommitReport result = {.darken_only = true};
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t *front = buffer->front + y * stride;
+    const uint8_t *back = buffer->back + y * stride;
+    buffer->changed_lines[y] = memcmp(front, back, stride) != 0;
+    if (!buffer->changed_lines[y]) {
+      continue;
+    }
+    result.changed_lines++;
+    result.changed_pixels += diff_row(front, back, buffer->mask + y * width / 8,
+                                      width, &result.darken_only);
+  }
+  if (report != NULL) {
+    *report = result;
+  }
+  if (result.changed_lines == 0) {
+    return;
+  }
+
+  // The front image is not needed anymore, it holds the masked changes
+  // until it becomes the back image.
+  uint8_t keep = result.darken_only ? 0xFF : 0x00;
+  for (int y = 0; y < height; y++) {
+    if (buffer->changed_lines[y]) {
+      mask_row(buffer->front + y * stride, buffer->back + y * stride,
+               buffer->mask + y * width / 8, width, keep);
+    }
+  }
+
+  epd_poweron();
+  if (result.darken_only) {
+    epd_draw_image_lines(epd_full_screen(), buffer->front, BLACK_ON_WHITE,
+                         buffer->changed_lines);
+  } else {
+    for (int i = 0; i < DARKEN_PASSES; i++) {
+      int64_t start = esp_timer_get_time();
+      epd_draw_frame_1bit_lines(epd_full_screen(), buffer->mask,
+                                BLACK_ON_WHITE, DARKEN_TIME,
+                                buffer->changed_lines);
+      int elapsed_ms = (esp_timer_get_time() - start) / 1000;
+      if (elapsed_ms < DARKEN_SETTLE_MS) {
+        vTaskDelay((DARKEN_SETTLE_MS - elapsed_ms) / portTICK_PERIOD_MS);
+      }
+    }
+    epd_draw_image_lines(epd_full_screen(), buffer->front, WHITE_ON_BLACK,
+                         buffer->changed_lines);
+  }
+  epd_poweroff();
+
+  // The swap is not copy free: the old front image held the masked
+  // changes, so its changed rows are brought up to date for drawing.
+  uint8_t *displayed = buffer->back;
+  buffer->back = buffer->front;
+  buffer->front = displayed;
+  for (int y = 0; y < height; y++) {
+    if (buffer->changed_lines[y]) {
+      memcpy(buffer->back + y * stride, buffer->front + y * stride, stride);
+    }
+  }
+  if (report != NULL) {
+    report->copied_bytes = result.changed_lines * stride;
+  }
+}
@@ -1,17 +1,24 @@
 #include "epd_driver.h"
-#include "ed097oc4.h"
+#include "epd_bus.h"
+#include "epd_estimate.h"
+#include "epd_compositor.h"
+#include "epd_display_list.h"
+#include "epd_ghosting.h"
+#include "epd_power.h"
 #include "epd_temperature.h"
+#include "epd_trace.h"
 
 #include "esp_assert.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_types.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "xtensa/core-macros.h"
-#include "driver/rtc_io.h"
+#include <stdio.h>
 #include <string.h>
 
 #define RTOS_ERROR_CHECK(x)                                                    \
@@ -23,7 +30,7 @@
   } while (0)
 
 // number of bytes needed for one line of EPD pixel data.
-#define EPD_LINE_BYTES EPD_WIDTH / 4
+#define EPD_LINE_BYTES (display->width / 4)
 
 // status tracker for row skipping
 uint32_t skipping;
@@ -31,41 +38,6 @@ uint32_t skipping;
 #define CLEAR_BYTE 0B10101010
 #define DARK_BYTE 0B01010101
 
-#if defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4) ||                               \
-    defined(CONFIG_EPD_DISPLAY_TYPE_ED060SC4) ||                               \
-    defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4_LQ) ||                            \
-    defined(CONFIG_EPD_DISPLAY_TYPE_ED047TC1)
-
-/* 4bpp Contrast cycles in order of contrast (Darkest first).  */
-const int contrast_cycles_4[15] = {30, 30, 20, 20, 30,  30,  30, 40,
-                                   40, 50, 50, 50, 100, 200, 300};
-
-const int contrast_cycles_4_white[15] = {10, 10, 8,  8,  8,  8,   8,  10,
-                                         10, 15, 15, 20, 20, 100, 300};
-const int clear_cycle_time = 12;
-
-#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2)
-const int contrast_cycles_4[15] = {15, 8,  8,  8,  8,  8,   10, 10,
-                                   10, 10, 20, 20, 50, 100, 200};
-
-const int contrast_cycles_4_white[15] = {7, 8, 8, 6, 6, 6,  6,  6,
-                                         6, 6, 6, 8, 8, 50, 150};
-
-const int clear_cycle_time = 12;
-
-#elif defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
-const int contrast_cycles_4[15] = {60, 60,  40,  40,  60,  60,  60, 80,
-                                   80, 100, 100, 100, 200, 200, 300};
-
-const int contrast_cycles_4_white[15] = {50, 30, 30, 30, 30, 30,  30, 30,
-                                         30, 30, 50, 50, 50, 100, 200};
-
-const int clear_cycle_time = 12;
-
-#else
-#error "no display type defined!"
-#endif
-
 #ifndef _swap_int
 #define _swap_int(a, b)                                                        \
   {                                                                            \
@@ -75,11 +47,48 @@ const int clear_cycle_time = 12;
   }
 #endif
 
+// The display driven, set by `epd_init_display`.
+static const EpdDisplay *display = NULL;
+// The bus backend to output rows with.
+static const EpdBusBackend *bus = NULL;
+// Placement of the pipeline tasks.
+static EpdTaskConfig task_config;
+// The pipeline tasks, deleted by `epd_deinit`.
+static TaskHandle_t producer_task = NULL;
+static TaskHandle_t consumer_task = NULL;
+
+/*
+ * The display framebuffers are laid out for. Before `epd_init`,
+ * this is the configured display, so framebuffers can be prepared
+ * without an initialized driver.
+ */
+static inline const EpdDisplay *fb_display() {
+  return display != NULL ? display : epd_default_display();
+}
+
 // Heap space to use for the EPD output lookup table, which
 // is calculated for each cycle.
 static uint8_t *conversion_lut;
 static QueueHandle_t output_queue;
 
+// Row buffers, allocated for the display width.
+static uint8_t *fetch_line;
+static uint8_t *feed_line;
+static uint8_t *line_1bpp;
+static uint8_t *push_row;
+
+// Gray level each pixel value is drawn with, see `epd_set_gray_map`.
+static uint8_t gray_map[16];
+// Active contrast cycles, see `epd_set_contrast_cycles`.
+static int waveform[15];
+static int waveform_white[15];
+// Only guards copying the waveform, draws read it from the draw runner.
+static portMUX_TYPE waveform_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Internal RAM staging buffer for image rows, see `row_source_begin`.
+static uint8_t *prefetch_buf = NULL;
+static uint32_t prefetch_buf_size = 0;
+
 typedef struct {
   const uint8_t *data_ptr;
   SemaphoreHandle_t done_smphr;
@@ -88,34 +97,106 @@ typedef struct {
   int frame;
   enum DrawMode mode;
   const bool *drawn_lines;
+  // pixel values below this are not driven before this frame,
+  // see `epd_draw_image_progressive`.
+  uint8_t hold_below;
+  // if not NULL, rows are composed from these layers instead of read
+  // from `data_ptr`.
+  const EpdCompositor *compositor;
+  // if not NULL, rows are rasterized from a display list.
+  EpdBandRaster *raster;
 } OutputParams;
 
 static OutputParams fetch_params;
 static OutputParams feed_params;
 
+// Draw statistics, see `epd_get_stats`.
+static EpdDrawStats stats;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+// Nesting depth of draw operations and start of the outermost one.
+static int draw_depth = 0;
+static int64_t draw_start_us;
+
+static void draw_begin() {
+  if (draw_depth++ == 0) {
+    EPD_TRACE_BEGIN(EPD_TRACE_DRAW);
+    draw_start_us = esp_timer_get_time();
+  }
+}
+
+static void draw_end() {
+  if (--draw_depth > 0) {
+    return;
+  }
+  EPD_TRACE_END(EPD_TRACE_DRAW);
+  uint32_t duration = esp_timer_get_time() - draw_start_us;
+  portENTER_CRITICAL(&stats_mux);
+  stats.draws++;
+  stats.draw_time_us += duration;
+  stats.last_draw_time_us = duration;
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+/*
+ * Account a finished frame and calibrate the draw time estimate with it.
+ * `bus_time_us` is the modeled bus time of the frame.
+ */
+static void record_frame(int64_t frame_start_us, uint32_t bus_time_us) {
+  EPD_TRACE_END(EPD_TRACE_FRAME);
+  uint32_t duration = esp_timer_get_time() - frame_start_us;
+  epd_estimate_calibrate(bus_time_us, duration);
+  portENTER_CRITICAL(&stats_mux);
+  stats.frames++;
+  stats.frame_time_us += duration;
+  if (duration > stats.max_frame_time_us) {
+    stats.max_frame_time_us = duration;
+  }
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+// the contrast cycles (waveform) of a draw mode.
+static const int *contrast_cycles(enum DrawMode mode) {
+  if (mode == WHITE_ON_BLACK) {
+    return waveform_white;
+  }
+  return waveform;
+}
+
 // output a row to the display.
 static void write_row(uint32_t output_time_dus) {
+  EPD_TRACE_BEGIN(EPD_TRACE_WRITE_ROW);
   skipping = 0;
-  epd_output_row(output_time_dus);
+  stats.rows_driven++;
+  bus->output_row(output_time_dus);
+  EPD_TRACE_END(EPD_TRACE_WRITE_ROW);
 }
 
 void reorder_line_buffer(uint32_t *line_data);
 
+inline uint32_t min(uint32_t x, uint32_t y) { return x < y ? x : y; }
+inline uint32_t max(uint32_t x, uint32_t y) { return x > y ? x : y; }
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+
 // skip a display row
-void IRAM_ATTR skip_row(uint8_t pipeline_finish_time) {
+void IRAM_ATTR skip_row(uint32_t pipeline_finish_time) {
+  EPD_TRACE_BEGIN(EPD_TRACE_SKIP_ROW);
   // output previously loaded row, fill buffer with no-ops.
   if (skipping < 2) {
-    memset(epd_get_current_buffer(), 0, EPD_LINE_BYTES);
-    epd_output_row(pipeline_finish_time);
+    memset(bus->get_current_buffer(), 0, EPD_LINE_BYTES);
+    bus->output_row(pipeline_finish_time);
   } else {
-    epd_skip();
+    bus->skip();
   }
   skipping++;
+  stats.rows_skipped++;
+  EPD_TRACE_END(EPD_TRACE_SKIP_ROW);
 }
 
-void epd_push_pixels(Rect_t area, short time, int color) {
+static void push_pixels(Rect_t area, short time, int color) {
 
-  uint8_t row[EPD_LINE_BYTES] = {0};
+  uint8_t *row = push_row;
+  memset(row, 0, EPD_LINE_BYTES);
 
   for (uint32_t i = 0; i < area.width; i++) {
     uint32_t position = i + area.x % 4;
@@ -125,54 +206,185 @@ void epd_push_pixels(Rect_t area, short time, int color) {
   }
   reorder_line_buffer((uint32_t *)row);
 
-  epd_start_frame();
+  draw_begin();
+  epd_power_acquire();
+  EPD_TRACE_BEGIN(EPD_TRACE_FRAME);
+  int64_t frame_start = esp_timer_get_time();
+  bus->start_frame();
 
-  for (int i = 0; i < EPD_HEIGHT; i++) {
+  for (int i = 0; i < display->height; i++) {
     // before are of interest: skip
     if (i < area.y) {
-      skip_row(time);
-      // start area of interest: set row data
-    } else if (i == area.y) {
-      epd_switch_buffer();
-      memcpy(epd_get_current_buffer(), row, EPD_LINE_BYTES);
-      epd_switch_buffer();
-      memcpy(epd_get_current_buffer(), row, EPD_LINE_BYTES);
-
-      write_row(time * 10);
+      skip_row(time * 10);
       // load nop row if done with area
     } else if (i >= area.y + area.height) {
-      skip_row(time);
-      // output the same as before
+      skip_row(time * 10);
+      // area of interest: set row data
     } else {
+      memcpy(bus->get_current_buffer(), row, EPD_LINE_BYTES);
       write_row(time * 10);
     }
   }
   // Since we "pipeline" row output, we still have to latch out the last row.
+  memcpy(bus->get_current_buffer(), row, EPD_LINE_BYTES);
   write_row(time * 10);
 
-  epd_end_frame();
+  bus->end_frame();
+  record_frame(frame_start,
+               epd_estimate_frame_bus_time(area, NULL, time * 10, time * 10));
+  epd_power_release();
+  draw_end();
 }
 
 void epd_clear_area(Rect_t area) {
-  epd_clear_area_cycles(area, 3, clear_cycle_time);
+  epd_clear_area_cycles(area, 3, display->clear_cycle_time);
 }
 
-void epd_clear_area_cycles(Rect_t area, int cycles, int cycle_time) {
+/*
+ * Clear an area with `cycles` times `pushes` dark and `pushes` white frames.
+ */
+static void clear_area_pushes(Rect_t area, int cycles, int pushes,
+                              int cycle_time) {
   const short white_time = cycle_time;
   const short dark_time = cycle_time;
 
+  draw_begin();
+  epd_power_acquire();
   for (int c = 0; c < cycles; c++) {
-    for (int i = 0; i < 10; i++) {
-      epd_push_pixels(area, dark_time, 0);
+    for (int i = 0; i < pushes; i++) {
+      push_pixels(area, dark_time, 0);
+    }
+    for (int i = 0; i < pushes; i++) {
+      push_pixels(area, white_time, 1);
+    }
+  }
+  epd_power_release();
+  draw_end();
+}
+
+static void clear_area_cycles(Rect_t area, int cycles, int cycle_time) {
+  clear_area_pushes(area, cycles, 10, cycle_time);
+}
+
+// Rows of an adaptive clear are planned in bands of this height.
+#define ADAPTIVE_BAND_HEIGHT 16
+// Clear cycles for a band containing black pixels.
+#define ADAPTIVE_MAX_CYCLES 3
+
+// How to clear a band of rows, see `plan_band`.
+typedef struct {
+  bool changed;
+  int cycles;
+  int pushes;
+  // column range containing ink.
+  int x0;
+  int x1;
+} BandPlan;
+
+static inline uint8_t fb_pixel(const uint8_t *fb, int x, int y) {
+  uint8_t byte = fb[y * display->width / 2 + x / 2];
+  return x % 2 ? byte >> 4 : byte & 0x0F;
+}
+
+/*
+ * Plan the clear of rows `y0` to `y1` of an area.
+ * The cycles depend on the darkest old pixel,
+ * the pushes per cycle on the average darkness of the inked columns.
+ */
+static BandPlan plan_band(Rect_t area, int y0, int y1, const uint8_t *old_fb,
+                          const uint8_t *new_fb) {
+  BandPlan plan = {.changed = false, .cycles = 0, .pushes = 0};
+  int max_ink = 0;
+  uint32_t ink_sum = 0;
+  int x0 = area.x + area.width;
+  int x1 = area.x;
+  for (int y = y0; y < y1; y++) {
+    for (int x = area.x; x < area.x + area.width; x++) {
+      uint8_t old = fb_pixel(old_fb, x, y);
+      uint8_t new = new_fb != NULL ? fb_pixel(new_fb, x, y) : 0x0F;
+      plan.changed |= old != new;
+      int ink = 15 - gray_map[old];
+      if (ink > 0) {
+        max_ink = max(max_ink, ink);
+        ink_sum += ink;
+        x0 = min(x0, x);
+        x1 = max(x1, x + 1);
+      }
+    }
+  }
+  // unchanged bands are not cleared, already white bands need no clear.
+  if (!plan.changed || max_ink == 0) {
+    return plan;
+  }
+  uint32_t inked_pixels = (x1 - x0) * (y1 - y0);
+  plan.cycles = (ADAPTIVE_MAX_CYCLES * max_ink + 14) / 15;
+  plan.pushes = 3 + (7 * ink_sum + 15 * inked_pixels - 1) / (15 * inked_pixels);
+  plan.x0 = x0;
+  plan.x1 = x1;
+  return plan;
+}
+
+/*
+ * Clear the changed bands of an area, merging consecutive bands
+ * with the same plan into one clear.
+ */
+static void clear_area_adaptive(Rect_t area, const uint8_t *old_fb,
+                                const uint8_t *new_fb, bool *drawn_lines) {
+  // clip to the display, the drawn lines stay relative to the area.
+  int y_start = area.y < 0 ? 0 : area.y;
+  int y_end = area.y + area.height > display->height ? display->height
+                                                     : area.y + area.height;
+  int x_end = area.x + area.width > display->width ? display->width
+                                                   : area.x + area.width;
+  area.x = area.x < 0 ? 0 : area.x;
+  area.width = x_end - area.x;
+  if (drawn_lines != NULL) {
+    memset(drawn_lines, 0, area.height * sizeof(bool));
+  }
+
+  draw_begin();
+  Rect_t pending = {0};
+  int pending_cycles = 0;
+  int pending_pushes = 0;
+  for (int y = y_start; y < y_end; y += ADAPTIVE_BAND_HEIGHT) {
+    int band_end = min(y + ADAPTIVE_BAND_HEIGHT, y_end);
+    BandPlan plan = plan_band(area, y, band_end, old_fb, new_fb);
+    if (drawn_lines != NULL) {
+      for (int i = y; i < band_end; i++) {
+        drawn_lines[i - area.y] = plan.changed;
+      }
+    }
+    if (plan.cycles > 0 && plan.cycles == pending_cycles &&
+        plan.pushes == pending_pushes && pending.y + pending.height == y) {
+      int x1 = max(pending.x + pending.width, plan.x1);
+      pending.x = min(pending.x, plan.x0);
+      pending.width = x1 - pending.x;
+      pending.height = band_end - pending.y;
+      continue;
     }
-    for (int i = 0; i < 10; i++) {
-      epd_push_pixels(area, white_time, 1);
+    if (pending_cycles > 0) {
+      clear_area_pushes(pending, pending_cycles, pending_pushes,
+                        display->clear_cycle_time);
+      epd_ghosting_cleaned(pending);
     }
+    pending.x = plan.x0;
+    pending.y = y;
+    pending.width = plan.x1 - plan.x0;
+    pending.height = band_end - y;
+    pending_cycles = plan.cycles;
+    pending_pushes = plan.pushes;
   }
+  if (pending_cycles > 0) {
+    clear_area_pushes(pending, pending_cycles, pending_pushes,
+                      display->clear_cycle_time);
+    epd_ghosting_cleaned(pending);
+  }
+  draw_end();
 }
 
 Rect_t epd_full_screen() {
-  Rect_t area = {.x = 0, .y = 0, .width = EPD_WIDTH, .height = EPD_HEIGHT};
+  Rect_t area = {
+      .x = 0, .y = 0, .width = epd_width(), .height = epd_height()};
   return area;
 }
 
@@ -197,7 +409,7 @@ void IRAM_ATTR calc_epd_input_4bpp(const uint32_t *line_data,
 
   // this is reversed for little-endian, but this is later compensated
   // through the output peripheral.
-  for (uint32_t j = 0; j < EPD_WIDTH / 16; j++) {
+  for (uint32_t j = 0; j < display->width / 16; j++) {
 
     uint16_t v1 = *(line_data_16++);
     uint16_t v2 = *(line_data_16++);
@@ -299,7 +511,7 @@ void IRAM_ATTR calc_epd_input_1bpp(const uint8_t *line_data, uint8_t *epd_input,
 
   // this is reversed for little-endian, but this is later compensated
   // through the output peripheral.
-  for (uint32_t j = 0; j < EPD_WIDTH / 16; j++) {
+  for (uint32_t j = 0; j < display->width / 16; j++) {
     uint8_t v1 = *(line_data++);
     uint8_t v2 = *(line_data++);
     wide_epd_input[j] = (lut[v1] << 16) | lut[v2];
@@ -321,33 +533,44 @@ static void IRAM_ATTR reset_lut(uint8_t *lut_mem, enum DrawMode mode) {
   }
 }
 
-static void IRAM_ATTR update_LUT(uint8_t *lut_mem, uint8_t k,
-                                 enum DrawMode mode) {
-  if (mode == BLACK_ON_WHITE || mode == WHITE_ON_WHITE) {
-    k = 15 - k;
-  }
-
-  // reset the pixels which are not to be lightened / darkened
-  // any longer in the current frame
-  for (uint32_t l = k; l < (1 << 16); l += 16) {
+/*
+ * Stop driving the pixels with value `v`, in all four pixel positions.
+ */
+static void IRAM_ATTR lut_stop_value(uint8_t *lut_mem, uint8_t v) {
+  for (uint32_t l = v; l < (1 << 16); l += 16) {
     lut_mem[l] &= 0xFC;
   }
 
-  for (uint32_t l = (k << 4); l < (1 << 16); l += (1 << 8)) {
+  for (uint32_t l = (v << 4); l < (1 << 16); l += (1 << 8)) {
     for (uint32_t p = 0; p < 16; p++) {
       lut_mem[l + p] &= 0xF3;
     }
   }
-  for (uint32_t l = (k << 8); l < (1 << 16); l += (1 << 12)) {
+  for (uint32_t l = (v << 8); l < (1 << 16); l += (1 << 12)) {
     for (uint32_t p = 0; p < (1 << 8); p++) {
       lut_mem[l + p] &= 0xCF;
     }
   }
-  for (uint32_t p = (k << 12); p < ((k + 1) << 12); p++) {
+  for (uint32_t p = (v << 12); p < ((v + 1) << 12); p++) {
     lut_mem[p] &= 0x3F;
   }
 }
 
+static void IRAM_ATTR update_LUT(uint8_t *lut_mem, uint8_t k,
+                                 enum DrawMode mode) {
+  if (mode == BLACK_ON_WHITE || mode == WHITE_ON_WHITE) {
+    k = 15 - k;
+  }
+
+  // reset the pixels which are not to be lightened / darkened
+  // any longer in the current frame
+  for (uint8_t v = 0; v < 16; v++) {
+    if (gray_map[v] == k) {
+      lut_stop_value(lut_mem, v);
+    }
+  }
+}
+
 void IRAM_ATTR nibble_shift_buffer_right(uint8_t *buf, uint32_t len) {
   uint8_t carry = 0xF;
   for (uint32_t i = 0; i < len; i++) {
@@ -369,33 +592,67 @@ void IRAM_ATTR bit_shift_buffer_right(uint8_t *buf, uint32_t len, int shift) {
   }
 }
 
-inline uint32_t min(uint32_t x, uint32_t y) { return x < y ? x : y; }
-inline uint32_t max(uint32_t x, uint32_t y) { return x > y ? x : y; }
+/*
+ * A band covering the whole screen, to draw to a full framebuffer.
+ */
+static EpdBand framebuffer_band(uint8_t *framebuffer) {
+  EpdBand band = {.data = framebuffer, .clip = epd_full_screen()};
+  return band;
+}
 
-void epd_draw_hline(int x, int y, int length, uint8_t color,
-                    uint8_t *framebuffer) {
-  for (int i = 0; i < length; i++) {
-    int xx = x + i;
-    epd_draw_pixel(xx, y, color, framebuffer);
+/*
+ * Set pixels x0 to x1 - 1 of a row to `color`: The odd leading and
+ * trailing pixels share their bytes, the bytes in between are set at once.
+ */
+static void fill_span(uint8_t *row, int x0, int x1, uint8_t color) {
+  if (x0 >= x1) {
+    return;
+  }
+  if (x0 % 2) {
+    row[x0 / 2] = (row[x0 / 2] & 0x0F) | (color & 0xF0);
+    x0++;
   }
+  if (x1 % 2 && x0 < x1) {
+    x1--;
+    row[x1 / 2] = (row[x1 / 2] & 0xF0) | (color >> 4);
+  }
+  memset(&row[x0 / 2], (color & 0xF0) | (color >> 4), (x1 - x0) / 2);
 }
 
-void epd_draw_vline(int x, int y, int length, uint8_t color,
-                    uint8_t *framebuffer) {
-  for (int i = 0; i < length; i++) {
-    int yy = y + i;
-    epd_draw_pixel(x, yy, color, framebuffer);
+void epd_draw_hline_band(int x, int y, int length, uint8_t color,
+                         const EpdBand *band) {
+  const Rect_t clip = band->clip;
+  if (y < clip.y || y >= clip.y + clip.height) {
+    return;
   }
+  fill_span(&band->data[(y - clip.y) * epd_width() / 2],
+            max_int(x, clip.x), min_int(x + length, clip.x + clip.width),
+            color);
 }
 
-void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer) {
-  if (x < 0 || x >= EPD_WIDTH) {
+void epd_draw_vline_band(int x, int y, int length, uint8_t color,
+                         const EpdBand *band) {
+  const Rect_t clip = band->clip;
+  if (x < clip.x || x >= clip.x + clip.width) {
+    return;
+  }
+  int y0 = max_int(y, clip.y);
+  int y1 = min_int(y + length, clip.y + clip.height);
+  for (int yy = y0; yy < y1; yy++) {
+    epd_draw_pixel_band(x, yy, color, band);
+  }
+}
+
+void epd_draw_pixel_band(int x, int y, uint8_t color, const EpdBand *band) {
+  const Rect_t clip = band->clip;
+  if (x < clip.x || x >= clip.x + clip.width) {
     return;
   }
-  if (y < 0 || y >= EPD_HEIGHT) {
+  if (y < clip.y || y >= clip.y + clip.height) {
     return;
   }
-  uint8_t *buf_ptr = &framebuffer[y * EPD_WIDTH / 2 + x / 2];
+  uint8_t *buf_ptr =
+      &band->data[(y - clip.y) * epd_width() / 2 + x / 2];
   if (x % 2) {
     *buf_ptr = (*buf_ptr & 0x0F) | (color & 0xF0);
   } else {
@@ -403,18 +660,18 @@ void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer) {
   }
 }
 
-void epd_draw_circle(int x0, int y0, int r, uint8_t color,
-                     uint8_t *framebuffer) {
+void epd_draw_circle_band(int x0, int y0, int r, uint8_t color,
+                          const EpdBand *band) {
   int f = 1 - r;
   int ddF_x = 1;
   int ddF_y = -2 * r;
   int x = 0;
   int y = r;
 
-  epd_draw_pixel(x0, y0 + r, color, framebuffer);
-  epd_draw_pixel(x0, y0 - r, color, framebuffer);
-  epd_draw_pixel(x0 + r, y0, color, framebuffer);
-  epd_draw_pixel(x0 - r, y0, color, framebuffer);
+  epd_draw_pixel_band(x0, y0 + r, color, band);
+  epd_draw_pixel_band(x0, y0 - r, color, band);
+  epd_draw_pixel_band(x0 + r, y0, color, band);
+  epd_draw_pixel_band(x0 - r, y0, color, band);
 
   while (x < y) {
     if (f >= 0) {
@@ -426,25 +683,26 @@ void epd_draw_circle(int x0, int y0, int r, uint8_t color,
     ddF_x += 2;
     f += ddF_x;
 
-    epd_draw_pixel(x0 + x, y0 + y, color, framebuffer);
-    epd_draw_pixel(x0 - x, y0 + y, color, framebuffer);
-    epd_draw_pixel(x0 + x, y0 - y, color, framebuffer);
-    epd_draw_pixel(x0 - x, y0 - y, color, framebuffer);
-    epd_draw_pixel(x0 + y, y0 + x, color, framebuffer);
-    epd_draw_pixel(x0 - y, y0 + x, color, framebuffer);
-    epd_draw_pixel(x0 + y, y0 - x, color, framebuffer);
-    epd_draw_pixel(x0 - y, y0 - x, color, framebuffer);
+    epd_draw_pixel_band(x0 + x, y0 + y, color, band);
+    epd_draw_pixel_band(x0 - x, y0 + y, color, band);
+    epd_draw_pixel_band(x0 + x, y0 - y, color, band);
+    epd_draw_pixel_band(x0 - x, y0 - y, color, band);
+    epd_draw_pixel_band(x0 + y, y0 + x, color, band);
+    epd_draw_pixel_band(x0 - y, y0 + x, color, band);
+    epd_draw_pixel_band(x0 + y, y0 - x, color, band);
+    epd_draw_pixel_band(x0 - y, y0 - x, color, band);
   }
 }
 
-void epd_fill_circle(int x0, int y0, int r, uint8_t color,
-                     uint8_t *framebuffer) {
-  epd_draw_vline(x0, y0 - r, 2 * r + 1, color, framebuffer);
-  epd_fill_circle_helper(x0, y0, r, 3, 0, color, framebuffer);
+void epd_fill_circle_band(int x0, int y0, int r, uint8_t color,
+                          const EpdBand *band) {
+  epd_draw_vline_band(x0, y0 - r, 2 * r + 1, color, band);
+  epd_fill_circle_helper_band(x0, y0, r, 3, 0, color, band);
 }
 
-void epd_fill_circle_helper(int x0, int y0, int r, int corners, int delta,
-                            uint8_t color, uint8_t *framebuffer) {
+void epd_fill_circle_helper_band(int x0, int y0, int r, int corners,
+                                 int delta, uint8_t color,
+                                 const EpdBand *band) {
 
   int f = 1 - r;
   int ddF_x = 1;
@@ -469,38 +727,43 @@ void epd_fill_circle_helper(int x0, int y0, int r, int corners, int delta,
     // for the SSD1306 library which has an INVERT drawing mode.
     if (x < (y + 1)) {
       if (corners & 1)
-        epd_draw_vline(x0 + x, y0 - y, 2 * y + delta, color, framebuffer);
+        epd_draw_vline_band(x0 + x, y0 - y, 2 * y + delta, color, band);
       if (corners & 2)
-        epd_draw_vline(x0 - x, y0 - y, 2 * y + delta, color, framebuffer);
+        epd_draw_vline_band(x0 - x, y0 - y, 2 * y + delta, color, band);
     }
     if (y != py) {
       if (corners & 1)
-        epd_draw_vline(x0 + py, y0 - px, 2 * px + delta, color, framebuffer);
+        epd_draw_vline_band(x0 + py, y0 - px, 2 * px + delta, color, band);
       if (corners & 2)
-        epd_draw_vline(x0 - py, y0 - px, 2 * px + delta, color, framebuffer);
+        epd_draw_vline_band(x0 - py, y0 - px, 2 * px + delta, color, band);
       py = y;
     }
     px = x;
   }
 }
 
-void epd_draw_rect(int x, int y, int w, int h, uint8_t color,
-                   uint8_t *framebuffer) {
-  epd_draw_hline(x, y, w, color, framebuffer);
-  epd_draw_hline(x, y + h - 1, w, color, framebuffer);
-  epd_draw_vline(x, y, h, color, framebuffer);
-  epd_draw_vline(x + w - 1, y, h, color, framebuffer);
+void epd_draw_rect_band(int x, int y, int w, int h, uint8_t color,
+                        const EpdBand *band) {
+  epd_draw_hline_band(x, y, w, color, band);
+  epd_draw_hline_band(x, y + h - 1, w, color, band);
+  epd_draw_vline_band(x, y, h, color, band);
+  epd_draw_vline_band(x + w - 1, y, h, color, band);
 }
 
-void epd_fill_rect(int x, int y, int w, int h, uint8_t color,
-                   uint8_t *framebuffer) {
-  for (int i = x; i < x + w; i++) {
-    epd_draw_vline(i, y, h, color, framebuffer);
+void epd_fill_rect_band(int x, int y, int w, int h, uint8_t color,
+                        const EpdBand *band) {
+  const Rect_t clip = band->clip;
+  int x0 = max_int(x, clip.x);
+  int x1 = min_int(x + w, clip.x + clip.width);
+  int y1 = min_int(y + h, clip.y + clip.height);
+  const int stride = epd_width() / 2;
+  for (int yy = max_int(y, clip.y); yy < y1; yy++) {
+    fill_span(&band->data[(yy - clip.y) * stride], x0, x1, color);
   }
 }
 
-void epd_write_line(int x0, int y0, int x1, int y1, uint8_t color,
-                    uint8_t *framebuffer) {
+void epd_write_line_band(int x0, int y0, int x1, int y1, uint8_t color,
+                         const EpdBand *band) {
   int steep = abs(y1 - y0) > abs(x1 - x0);
   if (steep) {
     _swap_int(x0, y0);
@@ -525,11 +788,25 @@ void epd_write_line(int x0, int y0, int x1, int y1, uint8_t color,
     ystep = -1;
   }
 
+  // Only step through the part of the line within the band. The error
+  // term at the first step is the one the steps before would leave.
+  const Rect_t clip = band->clip;
+  int first = steep ? clip.y : clip.x;
+  int last = steep ? clip.y + clip.height - 1 : clip.x + clip.width - 1;
+  if (x0 < first && first <= x1) {
+    int64_t e = err - (int64_t)(first - x0) * dy;
+    int64_t steps = e < 0 ? (-e + dx - 1) / dx : 0;
+    y0 += steps * ystep;
+    err = e + steps * dx;
+    x0 = first;
+  }
+  x1 = min_int(x1, last);
+
   for (; x0 <= x1; x0++) {
     if (steep) {
-      epd_draw_pixel(y0, x0, color, framebuffer);
+      epd_draw_pixel_band(y0, x0, color, band);
     } else {
-      epd_draw_pixel(x0, y0, color, framebuffer);
+      epd_draw_pixel_band(x0, y0, color, band);
     }
     err -= dy;
     if (err < 0) {
@@ -539,31 +816,31 @@ void epd_write_line(int x0, int y0, int x1, int y1, uint8_t color,
   }
 }
 
-void epd_draw_line(int x0, int y0, int x1, int y1, uint8_t color,
-                   uint8_t *framebuffer) {
+void epd_draw_line_band(int x0, int y0, int x1, int y1, uint8_t color,
+                        const EpdBand *band) {
   // Update in subclasses if desired!
   if (x0 == x1) {
     if (y0 > y1)
       _swap_int(y0, y1);
-    epd_draw_vline(x0, y0, y1 - y0 + 1, color, framebuffer);
+    epd_draw_vline_band(x0, y0, y1 - y0 + 1, color, band);
   } else if (y0 == y1) {
     if (x0 > x1)
       _swap_int(x0, x1);
-    epd_draw_hline(x0, y0, x1 - x0 + 1, color, framebuffer);
+    epd_draw_hline_band(x0, y0, x1 - x0 + 1, color, band);
   } else {
-    epd_write_line(x0, y0, x1, y1, color, framebuffer);
+    epd_write_line_band(x0, y0, x1, y1, color, band);
   }
 }
 
-void epd_draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
-                       uint8_t color, uint8_t *framebuffer) {
-  epd_draw_line(x0, y0, x1, y1, color, framebuffer);
-  epd_draw_line(x1, y1, x2, y2, color, framebuffer);
-  epd_draw_line(x2, y2, x0, y0, color, framebuffer);
+void epd_draw_triangle_band(int x0, int y0, int x1, int y1, int x2, int y2,
+                            uint8_t color, const EpdBand *band) {
+  epd_draw_line_band(x0, y0, x1, y1, color, band);
+  epd_draw_line_band(x1, y1, x2, y2, color, band);
+  epd_draw_line_band(x2, y2, x0, y0, color, band);
 }
 
-void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
-                       uint8_t color, uint8_t *framebuffer) {
+void epd_fill_triangle_band(int x0, int y0, int x1, int y1, int x2, int y2,
+                            uint8_t color, const EpdBand *band) {
 
   int a, b, y, last;
 
@@ -591,7 +868,7 @@ void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
       a = x2;
     else if (x2 > b)
       b = x2;
-    epd_draw_hline(a, y0, b - a + 1, color, framebuffer);
+    epd_draw_hline_band(a, y0, b - a + 1, color, band);
     return;
   }
 
@@ -610,7 +887,13 @@ void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
   else
     last = y1 - 1; // Skip it
 
-  for (y = y0; y <= last; y++) {
+  // Only the scanlines within the band are drawn, start at the first one.
+  int clip_y0 = band->clip.y;
+  int clip_y1 = band->clip.y + band->clip.height - 1;
+  y = max_int(y0, min_int(clip_y0, last + 1));
+  sa = (int32_t)dx01 * (y - y0);
+  sb = (int32_t)dx02 * (y - y0);
+  for (; y <= min_int(last, clip_y1); y++) {
     a = x0 + sa / dy01;
     b = x0 + sb / dy02;
     sa += dx01;
@@ -621,14 +904,15 @@ void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
     */
     if (a > b)
       _swap_int(a, b);
-    epd_draw_hline(a, y, b - a + 1, color, framebuffer);
+    epd_draw_hline_band(a, y, b - a + 1, color, band);
   }
 
   // For lower part of triangle, find scanline crossings for segments
   // 0-2 and 1-2.  This loop is skipped if y1=y2.
+  y = max_int(last + 1, clip_y0);
   sa = (int32_t)dx12 * (y - y1);
   sb = (int32_t)dx02 * (y - y0);
-  for (; y <= y2; y++) {
+  for (; y <= min_int(y2, clip_y1); y++) {
     a = x1 + sa / dy12;
     b = x0 + sb / dy02;
     sa += dx12;
@@ -639,182 +923,481 @@ void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
     */
     if (a > b)
       _swap_int(a, b);
-    epd_draw_hline(a, y, b - a + 1, color, framebuffer);
+    epd_draw_hline_band(a, y, b - a + 1, color, band);
   }
 }
 
-void epd_copy_to_framebuffer(Rect_t image_area, const uint8_t *image_data,
-                             uint8_t *framebuffer) {
+void epd_copy_to_band(Rect_t image_area, const uint8_t *image_data,
+                      const EpdBand *band) {
+  assert(band->data != NULL);
+
+  const Rect_t clip = band->clip;
+  // images of uneven width have an additional nibble per row.
+  const int stride = image_area.width / 2 + image_area.width % 2;
+  int x0 = max_int(image_area.x, clip.x);
+  int x1 = min_int(image_area.x + image_area.width, clip.x + clip.width);
+  int y0 = max_int(image_area.y, clip.y);
+  int y1 = min_int(image_area.y + image_area.height, clip.y + clip.height);
+
+  for (int yy = y0; yy < y1; yy++) {
+    const uint8_t *src = image_data + (yy - image_area.y) * stride;
+    uint8_t *row = band->data + (yy - clip.y) * epd_width() / 2;
+    for (int xx = x0; xx < x1; xx++) {
+      int ix = xx - image_area.x;
+      uint8_t val = ix % 2 ? src[ix / 2] >> 4 : src[ix / 2] & 0x0F;
+      uint8_t *buf_ptr = &row[xx / 2];
+      if (xx % 2) {
+        *buf_ptr = (*buf_ptr & 0x0F) | (val << 4);
+      } else {
+        *buf_ptr = (*buf_ptr & 0xF0) | val;
+      }
+    }
+  }
+}
 
-  assert(framebuffer != NULL);
+void epd_draw_hline(int x, int y, int length, uint8_t color,
+                    uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_hline_band(x, y, length, color, &band);
+}
 
-  for (uint32_t i = 0; i < image_area.width * image_area.height; i++) {
+void epd_draw_vline(int x, int y, int length, uint8_t color,
+                    uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_vline_band(x, y, length, color, &band);
+}
 
-    uint32_t value_index = i;
-    // for images of uneven width,
-    // consume an additional nibble per row.
-    if (image_area.width % 2) {
-      value_index += i / image_area.width;
-    }
-    uint8_t val = (value_index % 2) ? (image_data[value_index / 2] & 0xF0) >> 4
-                                    : image_data[value_index / 2] & 0x0F;
+void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_pixel_band(x, y, color, &band);
+}
 
-    int xx = image_area.x + i % image_area.width;
-    if (xx < 0 || xx >= EPD_WIDTH) {
-      continue;
-    }
-    int yy = image_area.y + i / image_area.width;
-    if (yy < 0 || yy >= EPD_HEIGHT) {
-      continue;
-    }
-    uint8_t *buf_ptr = &framebuffer[yy * EPD_WIDTH / 2 + xx / 2];
-    if (xx % 2) {
-      *buf_ptr = (*buf_ptr & 0x0F) | (val << 4);
-    } else {
-      *buf_ptr = (*buf_ptr & 0xF0) | val;
-    }
-  }
+void epd_draw_circle(int x0, int y0, int r, uint8_t color,
+                     uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_circle_band(x0, y0, r, color, &band);
 }
 
-void IRAM_ATTR epd_draw_grayscale_image(Rect_t area, const uint8_t *data) {
-  epd_draw_image(area, data, BLACK_ON_WHITE);
+void epd_fill_circle(int x0, int y0, int r, uint8_t color,
+                     uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_fill_circle_band(x0, y0, r, color, &band);
 }
 
-void IRAM_ATTR provide_out(OutputParams *params) {
-  while (true) {
-    xSemaphoreTake(params->start_smphr, portMAX_DELAY);
+void epd_fill_circle_helper(int x0, int y0, int r, int corners, int delta,
+                            uint8_t color, uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_fill_circle_helper_band(x0, y0, r, corners, delta, color, &band);
+}
 
-    uint8_t line[EPD_WIDTH / 2];
-    memset(line, 255, EPD_WIDTH / 2);
-    Rect_t area = params->area;
-    const uint8_t *ptr = params->data_ptr;
+void epd_draw_rect(int x, int y, int w, int h, uint8_t color,
+                   uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_rect_band(x, y, w, h, color, &band);
+}
 
-    if (params->frame == 0) {
-      reset_lut(conversion_lut, params->mode);
-    }
+void epd_fill_rect(int x, int y, int w, int h, uint8_t color,
+                   uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_fill_rect_band(x, y, w, h, color, &band);
+}
 
-    update_LUT(conversion_lut, params->frame, params->mode);
+void epd_write_line(int x0, int y0, int x1, int y1, uint8_t color,
+                    uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_write_line_band(x0, y0, x1, y1, color, &band);
+}
 
-    if (area.x < 0) {
-      ptr += -area.x / 2;
-    }
-    if (area.y < 0) {
-      ptr += (area.width / 2 + area.width % 2) * -area.y;
-    }
+void epd_draw_line(int x0, int y0, int x1, int y1, uint8_t color,
+                   uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_line_band(x0, y0, x1, y1, color, &band);
+}
 
-    for (int i = 0; i < EPD_HEIGHT; i++) {
-      if (i < area.y || i >= area.y + area.height) {
-        continue;
-      }
-      if (params->drawn_lines != NULL && !params->drawn_lines[i - area.y]) {
-        ptr += area.width / 2 + area.width % 2;
-        continue;
-      }
+void epd_draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
+                       uint8_t color, uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_draw_triangle_band(x0, y0, x1, y1, x2, y2, color, &band);
+}
 
-      uint32_t *lp;
-      bool shifted = false;
-      if (area.width == EPD_WIDTH && area.x == 0) {
-        lp = (uint32_t *)ptr;
-        ptr += EPD_WIDTH / 2;
-      } else {
-        uint8_t *buf_start = (uint8_t *)line;
-        uint32_t line_bytes = area.width / 2 + area.width % 2;
-        if (area.x >= 0) {
-          buf_start += area.x / 2;
-        } else {
-          // reduce line_bytes to actually used bytes
-          line_bytes += area.x / 2;
-        }
-        line_bytes =
-            min(line_bytes, EPD_WIDTH / 2 - (uint32_t)(buf_start - line));
-        memcpy(buf_start, ptr, line_bytes);
-        ptr += area.width / 2 + area.width % 2;
-
-        // mask last nibble for uneven width
-        if (area.width % 2 == 1 &&
-            area.x / 2 + area.width / 2 + 1 < EPD_WIDTH) {
-          *(buf_start + line_bytes - 1) |= 0xF0;
-        }
-        if (area.x % 2 == 1 && area.x < EPD_WIDTH) {
-          shifted = true;
-          // shift one nibble to right
-          nibble_shift_buffer_right(
-              buf_start, min(line_bytes + 1, (uint32_t)line + EPD_WIDTH / 2 -
-                                                 (uint32_t)buf_start));
-        }
-        lp = (uint32_t *)line;
-      }
-      xQueueSendToBack(output_queue, lp, portMAX_DELAY);
-      if (shifted) {
-        memset(line, 255, EPD_WIDTH / 2);
-      }
-    }
+void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
+                       uint8_t color, uint8_t *framebuffer) {
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_fill_triangle_band(x0, y0, x1, y1, x2, y2, color, &band);
+}
 
-    xSemaphoreGive(params->done_smphr);
-  }
+void epd_copy_to_framebuffer(Rect_t image_area, const uint8_t *image_data,
+                             uint8_t *framebuffer) {
+  assert(framebuffer != NULL);
+  EpdBand band = framebuffer_band(framebuffer);
+  epd_copy_to_band(image_area, image_data, &band);
 }
 
-void IRAM_ATTR feed_display(OutputParams *params) {
-  while (true) {
-    xSemaphoreTake(params->start_smphr, portMAX_DELAY);
+void IRAM_ATTR epd_draw_grayscale_image(Rect_t area, const uint8_t *data) {
+  epd_draw_image(area, data, BLACK_ON_WHITE);
+}
 
-    Rect_t area = params->area;
-    const int *contrast_lut = contrast_cycles_4;
-    switch (params->mode) {
-    case WHITE_ON_WHITE:
-    case BLACK_ON_WHITE:
-      contrast_lut = contrast_cycles_4;
-      break;
-    case WHITE_ON_BLACK:
-      contrast_lut = contrast_cycles_4_white;
-      break;
-    }
+/*
+ * Prepare the conversion LUT for a frame.
+ * Returns the time taken in microseconds.
+ */
+static int64_t IRAM_ATTR prepare_lut(const OutputParams *params) {
+  int64_t start = esp_timer_get_time();
+  EPD_TRACE_BEGIN(EPD_TRACE_LUT);
+  if (params->frame == 0) {
+    reset_lut(conversion_lut, params->mode);
+  }
 
-    epd_start_frame();
-    for (int i = 0; i < EPD_HEIGHT; i++) {
-      if (i < area.y || i >= area.y + area.height) {
-        skip_row(contrast_lut[params->frame]);
-        continue;
-      }
-      if (params->drawn_lines != NULL && !params->drawn_lines[i - area.y]) {
-        skip_row(contrast_lut[params->frame]);
-        continue;
-      }
-      uint8_t output[EPD_WIDTH / 2];
-      xQueueReceive(output_queue, output, portMAX_DELAY);
-      calc_epd_input_4bpp((uint32_t *)output, epd_get_current_buffer(),
-                          params->frame, conversion_lut);
-      write_row(contrast_lut[params->frame]);
+  update_LUT(conversion_lut, params->frame, params->mode);
+  if (params->hold_below > 0 && params->frame < params->hold_below) {
+    // the held values were darkened by the preview already.
+    for (int v = 0; v < params->hold_below; v++) {
+      update_LUT(conversion_lut, 15 - v, params->mode);
     }
-    if (!skipping) {
-      // Since we "pipeline" row output, we still have to latch out the last
-      // row.
-      write_row(contrast_lut[params->frame]);
+  } else if (params->hold_below > 0 &&
+             params->frame == params->hold_below) {
+    // continue the held values where the preview left off.
+    reset_lut(conversion_lut, params->mode);
+    for (int k = 0; k <= params->frame; k++) {
+      update_LUT(conversion_lut, k, params->mode);
     }
-    epd_end_frame();
-
-    xSemaphoreGive(params->done_smphr);
   }
+  EPD_TRACE_END(EPD_TRACE_LUT);
+  return esp_timer_get_time() - start;
 }
 
-void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
-                                         enum DrawMode mode, int time,
-                                         const bool *drawn_lines) {
-  epd_start_frame();
-  uint8_t line[EPD_WIDTH / 8];
-  memset(line, 0, sizeof(line));
-
-  if (area.x < 0) {
-    ptr += -area.x / 8;
+/// Reads the drawn rows of an image area, in display order.
+typedef struct {
+  const OutputParams *params;
+  /// Next image row not staged yet, without the x offset.
+  const uint8_t *image;
+  /// Bytes per image row and offset of the first on screen byte.
+  uint32_t stride;
+  uint32_t x_offset;
+  /// On screen image rows not staged yet.
+  int rows_left;
+  /// Rows per block staged in `prefetch_buf`, 0 if rows are read in place.
+  int block_capacity;
+  /// Next staged row in `prefetch_buf` and staged rows left.
+  const uint8_t *block;
+  int block_rows;
+  int row;
+  /// The line buffer was shifted and must be reset for the next row.
+  bool shifted;
+  /// CPU cycles spent reading the image from its source memory,
+  /// and the bytes read.
+  uint32_t read_cycles;
+  uint32_t read_bytes;
+} RowSource;
+
+static void IRAM_ATTR row_source_begin(RowSource *src,
+                                       const OutputParams *params) {
+  Rect_t area = params->area;
+  src->params = params;
+  src->image = params->data_ptr;
+  src->stride = area.width / 2 + area.width % 2;
+  src->x_offset = area.x < 0 ? -area.x / 2 : 0;
+  src->rows_left =
+      max_int(min_int(area.y + area.height, display->height) -
+                  max_int(area.y, 0),
+              0);
+  src->block_capacity = 0;
+  src->block = NULL;
+  src->block_rows = 0;
+  src->row = 0;
+  src->shifted = false;
+  src->read_cycles = 0;
+  src->read_bytes = 0;
+  memset(fetch_line, 255, display->width / 2);
+
+  if (area.y < 0 && src->image != NULL) {
+    src->image += src->stride * -area.y;
   }
-
-  int ceil_byte_width = (area.width / 8 + (area.width % 8 > 0));
-  if (area.y < 0) {
-    ptr += ceil_byte_width * -area.y;
+  if (src->image == NULL || prefetch_buf == NULL) {
+    return;
   }
 
-  for (int i = 0; i < EPD_HEIGHT; i++) {
-    if (i < area.y || i >= area.y + area.height) {
+  // Every frame of a draw reads the whole image again, and images usually
+  // live in PSRAM. An on screen part that fits into `prefetch_buf` is copied
+  // there in the first frame and read from there afterwards. Larger images
+  // are staged through it in blocks of rows, so PSRAM is read in long
+  // bursts instead of a row at a time.
+  uint32_t len = src->rows_left * src->stride;
+  if (len > 0 && len <= prefetch_buf_size) {
+    if (params->frame == 0) {
+      uint32_t start = XTHAL_GET_CCOUNT();
+      memcpy(prefetch_buf, src->image, len);
+      src->read_cycles += XTHAL_GET_CCOUNT() - start;
+      src->read_bytes += len;
+    }
+    src->block = prefetch_buf;
+    src->block_rows = src->rows_left;
+    src->rows_left = 0;
+  }
+  src->block_capacity = prefetch_buf_size / src->stride;
+}
+
+/*
+ * Get the next on screen image row, starting at its first on screen byte.
+ * If `read` is false the row is skipped and NULL is returned.
+ * Staged rows are valid until the next call.
+ */
+static const uint8_t *IRAM_ATTR row_source_image_row(RowSource *src,
+                                                     bool read) {
+  const uint8_t *row;
+  if (src->block_capacity == 0) {
+    row = src->image;
+    src->image += src->stride;
+    return read ? row + src->x_offset : NULL;
+  }
+  if (src->block_rows == 0) {
+    if (!read) {
+      src->image += src->stride;
+      src->rows_left--;
+      return NULL;
+    }
+    int rows = min_int(src->block_capacity, src->rows_left);
+    uint32_t len = rows * src->stride;
+    uint32_t start = XTHAL_GET_CCOUNT();
+    memcpy(prefetch_buf, src->image, len);
+    src->read_cycles += XTHAL_GET_CCOUNT() - start;
+    src->read_bytes += len;
+    src->image += len;
+    src->rows_left -= rows;
+    src->block = prefetch_buf;
+    src->block_rows = rows;
+  }
+  row = src->block;
+  src->block += src->stride;
+  src->block_rows--;
+  return read ? row + src->x_offset : NULL;
+}
+
+/*
+ * Account the image reads of a frame.
+ */
+static void row_source_end(RowSource *src) {
+  portENTER_CRITICAL(&stats_mux);
+  stats.row_read_us +=
+      src->read_cycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+  stats.row_read_bytes += src->read_bytes;
+  EpdBandRaster *raster = src->params->raster;
+  if (raster != NULL) {
+    stats.raster_us += raster->raster_us;
+    stats.bands_rasterized += raster->bands_rasterized;
+    raster->raster_us = 0;
+    raster->bands_rasterized = 0;
+  }
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+/*
+ * Get the next drawn row as `display->width / 2` bytes of 4bpp pixels,
+ * or NULL after the last row. The row is valid until the next call.
+ */
+static const uint32_t *IRAM_ATTR row_source_next(RowSource *src) {
+  const int width = display->width;
+  const Rect_t area = src->params->area;
+  const bool *drawn_lines = src->params->drawn_lines;
+  uint8_t *line = fetch_line;
+
+  if (src->shifted) {
+    memset(line, 255, width / 2);
+    src->shifted = false;
+  }
+
+  for (; src->row < display->height; src->row++) {
+    int i = src->row;
+    if (i < area.y || i >= area.y + area.height) {
+      continue;
+    }
+    if (drawn_lines != NULL && !drawn_lines[i - area.y]) {
+      if (src->params->data_ptr != NULL) {
+        row_source_image_row(src, false);
+      }
+      continue;
+    }
+    src->row++;
+
+    if (src->params->compositor != NULL) {
+      epd_compose_row(src->params->compositor, i, max_int(area.x, 0),
+                      min_int(area.x + area.width, width), line);
+      return (const uint32_t *)line;
+    }
+    if (src->params->raster != NULL) {
+      return (const uint32_t *)epd_band_raster_row(src->params->raster, i);
+    }
+    const uint8_t *image_row = row_source_image_row(src, true);
+    // rows read in place are copied to `line`, so the read is timed.
+    bool in_place = src->block_capacity == 0;
+    if (area.width == width && area.x == 0 && !in_place) {
+      return (const uint32_t *)image_row;
+    }
+
+    uint8_t *buf_start = (uint8_t *)line;
+    uint32_t line_bytes = area.width / 2 + area.width % 2;
+    if (area.x >= 0) {
+      buf_start += area.x / 2;
+    } else {
+      // reduce line_bytes to actually used bytes
+      line_bytes += area.x / 2;
+    }
+    line_bytes = min(line_bytes, width / 2 - (uint32_t)(buf_start - line));
+    uint32_t read_start = XTHAL_GET_CCOUNT();
+    memcpy(buf_start, image_row, line_bytes);
+    if (in_place) {
+      src->read_cycles += XTHAL_GET_CCOUNT() - read_start;
+      src->read_bytes += line_bytes;
+    }
+
+    // mask last nibble for uneven width
+    if (area.width % 2 == 1 && area.x / 2 + area.width / 2 + 1 < width) {
+      *(buf_start + line_bytes - 1) |= 0xF0;
+    }
+    if (area.x % 2 == 1 && area.x < width) {
+      src->shifted = true;
+      // shift one nibble to right
+      nibble_shift_buffer_right(
+          buf_start,
+          min(line_bytes + 1,
+              (uint32_t)line + width / 2 - (uint32_t)buf_start));
+    }
+    return (const uint32_t *)line;
+  }
+  return NULL;
+}
+
+void IRAM_ATTR provide_out(OutputParams *params) {
+  while (true) {
+    xSemaphoreTake(params->start_smphr, portMAX_DELAY);
+
+    EPD_TRACE_BEGIN(EPD_TRACE_PROVIDE_OUT);
+    int64_t start = esp_timer_get_time();
+    int64_t wait_time = 0;
+    uint32_t full_count = 0;
+    int64_t lut_time = prepare_lut(params);
+
+    RowSource src;
+    row_source_begin(&src, params);
+    const uint32_t *lp;
+    while ((lp = row_source_next(&src)) != NULL) {
+      if (uxQueueSpacesAvailable(output_queue) == 0) {
+        int64_t wait_start = esp_timer_get_time();
+        full_count++;
+        EPD_TRACE_BEGIN(EPD_TRACE_QUEUE_FULL);
+        xQueueSendToBack(output_queue, lp, portMAX_DELAY);
+        EPD_TRACE_END(EPD_TRACE_QUEUE_FULL);
+        wait_time += esp_timer_get_time() - wait_start;
+      } else {
+        xQueueSendToBack(output_queue, lp, portMAX_DELAY);
+      }
+    }
+    row_source_end(&src);
+
+    portENTER_CRITICAL(&stats_mux);
+    stats.producer_busy_us += esp_timer_get_time() - start - wait_time;
+    stats.queue_full += full_count;
+    stats.lut_time_us += lut_time;
+    portEXIT_CRITICAL(&stats_mux);
+    EPD_TRACE_END(EPD_TRACE_PROVIDE_OUT);
+    xSemaphoreGive(params->done_smphr);
+  }
+}
+
+/*
+ * Outputs the rows of a frame.
+ * In single task mode, the rows are read here,
+ * otherwise they are received from `provide_out`.
+ */
+void IRAM_ATTR feed_display(OutputParams *params) {
+  while (true) {
+    xSemaphoreTake(params->start_smphr, portMAX_DELAY);
+
+    EPD_TRACE_BEGIN(EPD_TRACE_FEED_DISPLAY);
+    int64_t start = esp_timer_get_time();
+    int64_t wait_time = 0;
+    uint32_t starved_count = 0;
+    Rect_t area = params->area;
+    const int *contrast_lut = contrast_cycles(params->mode);
+
+    RowSource src;
+    if (task_config.single_task) {
+      int64_t lut_time = prepare_lut(params);
+      portENTER_CRITICAL(&stats_mux);
+      stats.lut_time_us += lut_time;
+      portEXIT_CRITICAL(&stats_mux);
+      row_source_begin(&src, params);
+    }
+
+    bus->start_frame();
+    for (int i = 0; i < display->height; i++) {
+      if (i < area.y || i >= area.y + area.height) {
+        skip_row(contrast_lut[params->frame]);
+        continue;
+      }
+      if (params->drawn_lines != NULL && !params->drawn_lines[i - area.y]) {
+        skip_row(contrast_lut[params->frame]);
+        continue;
+      }
+      uint8_t *output = feed_line;
+      if (task_config.single_task) {
+        memcpy(output, row_source_next(&src), display->width / 2);
+      } else if (uxQueueMessagesWaiting(output_queue) == 0) {
+        int64_t wait_start = esp_timer_get_time();
+        starved_count++;
+        EPD_TRACE_BEGIN(EPD_TRACE_QUEUE_EMPTY);
+        xQueueReceive(output_queue, output, portMAX_DELAY);
+        EPD_TRACE_END(EPD_TRACE_QUEUE_EMPTY);
+        wait_time += esp_timer_get_time() - wait_start;
+      } else {
+        xQueueReceive(output_queue, output, portMAX_DELAY);
+      }
+      calc_epd_input_4bpp((uint32_t *)output, bus->get_current_buffer(),
+                          params->frame, conversion_lut);
+      write_row(contrast_lut[params->frame]);
+    }
+    if (!skipping) {
+      // Since we "pipeline" row output, we still have to latch out the last
+      // row.
+      write_row(contrast_lut[params->frame]);
+    }
+    bus->end_frame();
+    if (task_config.single_task) {
+      row_source_end(&src);
+    }
+
+    portENTER_CRITICAL(&stats_mux);
+    stats.consumer_busy_us += esp_timer_get_time() - start - wait_time;
+    stats.queue_starved += starved_count;
+    portEXIT_CRITICAL(&stats_mux);
+    EPD_TRACE_END(EPD_TRACE_FEED_DISPLAY);
+    xSemaphoreGive(params->done_smphr);
+  }
+}
+
+static void IRAM_ATTR draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
+                                            enum DrawMode mode, int time,
+                                            const bool *drawn_lines) {
+  draw_begin();
+  epd_power_acquire();
+  EPD_TRACE_BEGIN(EPD_TRACE_FRAME);
+  int64_t frame_start = esp_timer_get_time();
+  bus->start_frame();
+  const int width = display->width;
+  uint8_t *line = line_1bpp;
+  memset(line, 0, width / 8);
+
+  if (area.x < 0) {
+    ptr += -area.x / 8;
+  }
+
+  int ceil_byte_width = (area.width / 8 + (area.width % 8 > 0));
+  if (area.y < 0) {
+    ptr += ceil_byte_width * -area.y;
+  }
+
+  for (int i = 0; i < display->height; i++) {
+    if (i < area.y || i >= area.y + area.height) {
       skip_row(time);
       continue;
     }
@@ -826,9 +1409,9 @@ void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
 
     const uint8_t *lp;
     bool shifted = 0;
-    if (area.width == EPD_WIDTH && area.x == 0) {
+    if (area.width == width && area.x == 0) {
       lp = ptr;
-      ptr += EPD_WIDTH / 8;
+      ptr += width / 8;
     } else {
       uint8_t *buf_start = (uint8_t *)line;
       uint32_t line_bytes = ceil_byte_width;
@@ -839,12 +1422,12 @@ void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
         line_bytes += area.x / 8;
       }
       line_bytes =
-          min(line_bytes, EPD_WIDTH / 8 - (uint32_t)(buf_start - line));
+          min(line_bytes, width / 8 - (uint32_t)(buf_start - line));
       memcpy(buf_start, ptr, line_bytes);
       ptr += ceil_byte_width;
 
       // mask last n bits if width is not divisible by 8
-      if (area.width % 8 != 0 && ceil_byte_width + 1 < EPD_WIDTH) {
+      if (area.width % 8 != 0 && ceil_byte_width + 1 < width) {
         uint8_t mask = 0;
         for (int s = 0; s < area.width % 8; s++) {
           mask = (mask << 1) | 1;
@@ -852,76 +1435,857 @@ void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
         *(buf_start + line_bytes - 1) &= mask;
       }
 
-      if (area.x % 8 != 0 && area.x < EPD_WIDTH) {
+      if (area.x % 8 != 0 && area.x < width) {
         // shift to right
         shifted = true;
         bit_shift_buffer_right(
             buf_start,
             min(line_bytes + 1,
-                (uint32_t)line + EPD_WIDTH / 8 - (uint32_t)buf_start),
+                (uint32_t)line + width / 8 - (uint32_t)buf_start),
             area.x % 8);
       }
       lp = line;
     }
-    calc_epd_input_1bpp(lp, epd_get_current_buffer(), mode);
+    calc_epd_input_1bpp(lp, bus->get_current_buffer(), mode);
     write_row(time);
     if (shifted) {
-      memset(line, 0, sizeof(line));
+      memset(line, 0, width / 8);
     }
   }
   if (!skipping) {
     write_row(time);
   }
-  epd_end_frame();
-}
-
-void IRAM_ATTR epd_draw_frame_1bit(Rect_t area, const uint8_t *ptr,
-                                   enum DrawMode mode, int time) {
-  epd_draw_frame_1bit_lines(area, ptr, mode, time, NULL);
+  bus->end_frame();
+  record_frame(frame_start,
+               epd_estimate_frame_bus_time(area, drawn_lines, time, time));
+  epd_power_release();
+  draw_end();
 }
 
-void IRAM_ATTR epd_draw_image(Rect_t area, const uint8_t *data,
-                              enum DrawMode mode) {
-  epd_draw_image_lines(area, data, mode, NULL);
-}
-
-void IRAM_ATTR epd_draw_image_lines(Rect_t area, const uint8_t *data,
-                                    enum DrawMode mode,
-                                    const bool *drawn_lines) {
-  uint8_t line[EPD_WIDTH / 2];
-  memset(line, 255, EPD_WIDTH / 2);
+/*
+ * Draw the 15 frames of an image, read from `data`, composed from
+ * the layers of `compositor` or rasterized by `raster`.
+ */
+static void IRAM_ATTR draw_image_frames(Rect_t area, const uint8_t *data,
+                                        const EpdCompositor *compositor,
+                                        EpdBandRaster *raster,
+                                        enum DrawMode mode,
+                                        const bool *drawn_lines,
+                                        uint8_t hold_below) {
   uint8_t frame_count = 15;
 
+  draw_begin();
+  epd_power_acquire();
   for (uint8_t k = 0; k < frame_count; k++) {
-    uint64_t frame_start = esp_timer_get_time() / 1000;
+    EPD_TRACE_BEGIN(EPD_TRACE_FRAME);
+    int64_t frame_start_us = esp_timer_get_time();
+    uint64_t frame_start = frame_start_us / 1000;
     fetch_params.area = area;
     fetch_params.data_ptr = data;
     fetch_params.frame = k;
     fetch_params.mode = mode;
     fetch_params.drawn_lines = drawn_lines;
+    fetch_params.hold_below = hold_below;
+    fetch_params.compositor = compositor;
+    fetch_params.raster = raster;
 
     feed_params.area = area;
     feed_params.data_ptr = data;
     feed_params.frame = k;
     feed_params.mode = mode;
     feed_params.drawn_lines = drawn_lines;
+    feed_params.hold_below = hold_below;
+    feed_params.compositor = compositor;
+    feed_params.raster = raster;
 
-    xSemaphoreGive(fetch_params.start_smphr);
+    if (!task_config.single_task) {
+      xSemaphoreGive(fetch_params.start_smphr);
+    }
     xSemaphoreGive(feed_params.start_smphr);
-    xSemaphoreTake(fetch_params.done_smphr, portMAX_DELAY);
+    if (!task_config.single_task) {
+      xSemaphoreTake(fetch_params.done_smphr, portMAX_DELAY);
+    }
     xSemaphoreTake(feed_params.done_smphr, portMAX_DELAY);
+    const int *contrast_lut = contrast_cycles(mode);
+    record_frame(frame_start_us,
+                 epd_estimate_frame_bus_time(area, drawn_lines, contrast_lut[k],
+                                             contrast_lut[k]));
 
     uint64_t frame_end = esp_timer_get_time() / 1000;
     if (frame_end - frame_start < MINIMUM_FRAME_TIME) {
+      int64_t delay_start = esp_timer_get_time();
+      EPD_TRACE_BEGIN(EPD_TRACE_FRAME_DELAY);
       vTaskDelay(min(MINIMUM_FRAME_TIME - (frame_end - frame_start),
                      MINIMUM_FRAME_TIME));
+      EPD_TRACE_END(EPD_TRACE_FRAME_DELAY);
+      int64_t delay = esp_timer_get_time() - delay_start;
+      portENTER_CRITICAL(&stats_mux);
+      stats.frame_delay_us += delay;
+      portEXIT_CRITICAL(&stats_mux);
     }
   }
+  epd_power_release();
+  draw_end();
+}
+
+static void IRAM_ATTR draw_image_lines(Rect_t area, const uint8_t *data,
+                                       enum DrawMode mode,
+                                       const bool *drawn_lines,
+                                       uint8_t hold_below) {
+  draw_image_frames(area, data, NULL, NULL, mode, drawn_lines, hold_below);
 }
 
-void epd_init() {
+static void draw_display_list(Rect_t area, const EpdDisplayList *list,
+                              enum DrawMode mode) {
+  EpdBandRaster raster;
+  if (!epd_band_raster_begin(&raster, list, area)) {
+    ESP_LOGE("epd_driver", "no memory for a band of %d rows!",
+             CONFIG_EPD_BAND_ROWS);
+    return;
+  }
+  draw_image_frames(area, NULL, NULL, &raster, mode, NULL, 0);
+  epd_band_raster_end(&raster);
+}
+
+// Gray values below this are part of the preview of a progressive draw.
+#define PREVIEW_THRESHOLD 8
+// Number of 1bpp frames of the preview.
+#define PREVIEW_FRAMES 2
+
+/*
+ * Draw a thresholded 1bpp preview of a black on white image,
+ * then refine it to the grayscale image.
+ *
+ * The preview applies the drive time of the first `PREVIEW_THRESHOLD`
+ * waveform frames to the pixels below the threshold, which is at most
+ * their full drive time. The refinement holds these pixels until their
+ * waveform reaches the preview, so they never get darker than intended.
+ */
+static void draw_image_progressive(Rect_t area, const uint8_t *data,
+                                   enum DrawMode mode) {
+  if (mode != BLACK_ON_WHITE) {
+    draw_image_lines(area, data, mode, NULL, 0);
+    return;
+  }
+  int stride = area.width / 2 + area.width % 2;
+  int stride_1bpp = area.width / 8 + (area.width % 8 > 0);
+  uint8_t *preview = (uint8_t *)heap_caps_malloc(stride_1bpp * area.height,
+                                                 MALLOC_CAP_8BIT);
+  if (preview == NULL) {
+    ESP_LOGW("epd_driver", "no memory for the preview, drawing directly.");
+    draw_image_lines(area, data, mode, NULL, 0);
+    return;
+  }
+  memset(preview, 0, stride_1bpp * area.height);
+  for (int y = 0; y < area.height; y++) {
+    const uint8_t *row = data + y * stride;
+    uint8_t *row_1bpp = preview + y * stride_1bpp;
+    for (int x = 0; x < area.width; x++) {
+      uint8_t v = x % 2 ? row[x / 2] >> 4 : row[x / 2] & 0x0F;
+      if (gray_map[v] < PREVIEW_THRESHOLD) {
+        row_1bpp[x / 8] |= 1 << (x % 8);
+      }
+    }
+  }
+
+  const int *contrast_lut = contrast_cycles(mode);
+  int preview_time = 0;
+  for (int k = 0; k < PREVIEW_THRESHOLD; k++) {
+    preview_time += contrast_lut[k];
+  }
+
+  draw_begin();
+  epd_power_acquire();
+  for (int i = 0; i < PREVIEW_FRAMES; i++) {
+    // the last frame takes the remainder of the preview time.
+    int time = preview_time / PREVIEW_FRAMES;
+    if (i == PREVIEW_FRAMES - 1) {
+      time += preview_time % PREVIEW_FRAMES;
+    }
+    draw_frame_1bit_lines(area, preview, mode, time, NULL);
+  }
+  heap_caps_free(preview);
+  draw_image_lines(area, data, mode, NULL, PREVIEW_THRESHOLD);
+  epd_power_release();
+  draw_end();
+}
+
+// FreeRTOS core id for a configured core.
+static BaseType_t task_core(int core) {
+  return core < 0 ? tskNO_AFFINITY : core;
+}
+
+/*
+ * Drive the pixels changed between two full screen 1bpp frames,
+ * darkening new black pixels and lightening new white pixels.
+ * `prev` is NULL for a white screen.
+ */
+static void IRAM_ATTR drive_frame_diff(const uint8_t *prev,
+                                       const uint8_t *next, const bool *lines,
+                                       int time) {
+  EPD_TRACE_BEGIN(EPD_TRACE_FRAME);
+  int64_t frame_start = esp_timer_get_time();
+  const int line_bytes = display->width / 8;
+  bus->start_frame();
+  for (int i = 0; i < display->height; i++) {
+    if (!lines[i]) {
+      skip_row(time);
+      continue;
+    }
+    const uint8_t *np = next + i * line_bytes;
+    const uint8_t *pp = prev != NULL ? prev + i * line_bytes : NULL;
+    uint32_t *wide_epd_input = (uint32_t *)bus->get_current_buffer();
+    for (int j = 0; j < display->width / 16; j++) {
+      uint8_t n1 = np[2 * j];
+      uint8_t n2 = np[2 * j + 1];
+      uint8_t p1 = pp != NULL ? pp[2 * j] : 0;
+      uint8_t p2 = pp != NULL ? pp[2 * j + 1] : 0;
+      uint32_t v1 = lut_1bpp_black[n1 & ~p1] | lut_1bpp_white[p1 & ~n1];
+      uint32_t v2 = lut_1bpp_black[n2 & ~p2] | lut_1bpp_white[p2 & ~n2];
+      wide_epd_input[j] = (v1 << 16) | v2;
+    }
+    write_row(time);
+  }
+  if (!skipping) {
+    write_row(time);
+  }
+  bus->end_frame();
+  record_frame(frame_start, epd_estimate_frame_bus_time(
+                                epd_full_screen(), lines, time, time));
+}
+
+// Number of frame buffers of an animation: the displayed frame,
+// the frame being driven and the frame being fetched.
+#define ANIMATION_BUFFERS 3
+
+// A fetched animation frame, `index` is -1 after the last frame.
+typedef struct {
+  int index;
+  int64_t ready_us;
+} AnimationFrame;
+
+typedef struct {
+  const EpdAnimation *animation;
+  uint8_t *buffers[ANIMATION_BUFFERS];
+  bool *lines[ANIMATION_BUFFERS];
+  QueueHandle_t free_buffers;
+  QueueHandle_t ready_frames;
+  uint64_t source_time_us;
+} AnimationPipeline;
+
+/*
+ * Fetches the frames of an animation and marks their changed lines,
+ * while the previous frame is driven.
+ */
+static void animation_fetch_task(AnimationPipeline *pipeline) {
+  const EpdAnimation *animation = pipeline->animation;
+  const int line_bytes = display->width / 8;
+  const uint8_t *prev = NULL;
+  while (true) {
+    AnimationFrame frame;
+    xQueueReceive(pipeline->free_buffers, &frame.index, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    uint8_t *buffer = pipeline->buffers[frame.index];
+    if (!animation->source(buffer, animation->ctx)) {
+      frame.index = -1;
+      xQueueSendToBack(pipeline->ready_frames, &frame, portMAX_DELAY);
+      break;
+    }
+    bool *lines = pipeline->lines[frame.index];
+    for (int y = 0; y < display->height; y++) {
+      const uint8_t *row = buffer + y * line_bytes;
+      if (prev != NULL) {
+        lines[y] = memcmp(row, prev + y * line_bytes, line_bytes) != 0;
+      } else {
+        lines[y] = false;
+        for (int x = 0; x < line_bytes && !lines[y]; x++) {
+          lines[y] = row[x] != 0;
+        }
+      }
+    }
+    prev = buffer;
+    frame.ready_us = esp_timer_get_time();
+    pipeline->source_time_us += frame.ready_us - start;
+    xQueueSendToBack(pipeline->ready_frames, &frame, portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+/*
+ * Drive the frames of a running animation pipeline.
+ */
+static void drive_animation(AnimationPipeline *pipeline,
+                            EpdAnimationReport *report) {
+  const EpdAnimation *animation = pipeline->animation;
+  const int passes = animation->passes > 0 ? animation->passes : 1;
+  const int64_t period_us = animation->fps > 0 ? 1000000 / animation->fps : 0;
+  uint64_t latency_sum = 0;
+  int shown = -1;
+
+  draw_begin();
+  epd_power_acquire();
+  int64_t start = esp_timer_get_time();
+  while (true) {
+    AnimationFrame frame;
+    xQueueReceive(pipeline->ready_frames, &frame, portMAX_DELAY);
+    if (frame.index < 0) {
+      break;
+    }
+    // hold the target frame rate.
+    int64_t deadline = start + report->frames * period_us;
+    int64_t now = esp_timer_get_time();
+    if (now < deadline) {
+      vTaskDelay((deadline - now) / 1000 / portTICK_PERIOD_MS);
+    }
+
+    int64_t drive_start = esp_timer_get_time();
+    const uint8_t *prev = shown >= 0 ? pipeline->buffers[shown] : NULL;
+    for (int i = 0; i < passes; i++) {
+      drive_frame_diff(prev, pipeline->buffers[frame.index],
+                       pipeline->lines[frame.index], animation->time);
+    }
+    int64_t shown_us = esp_timer_get_time();
+    report->drive_time_us += shown_us - drive_start;
+    report->passes += passes;
+
+    uint32_t latency = shown_us - frame.ready_us;
+    latency_sum += latency;
+    if (latency > report->max_latency_us) {
+      report->max_latency_us = latency;
+    }
+    if (period_us > 0 && shown_us > deadline + period_us) {
+      report->late_frames++;
+    }
+    report->frames++;
+
+    if (shown >= 0) {
+      xQueueSendToBack(pipeline->free_buffers, &shown, portMAX_DELAY);
+    }
+    shown = frame.index;
+  }
+  int64_t duration = esp_timer_get_time() - start;
+  epd_power_release();
+  draw_end();
+
+  report->source_time_us = pipeline->source_time_us;
+  if (report->frames > 0) {
+    report->fps = report->frames * 1e6f / duration;
+    report->avg_latency_us = latency_sum / report->frames;
+  }
+  ESP_LOGI("epd_driver",
+           "animation: %u frames, %.1f fps, %u late, latency %u us avg, "
+           "%u us max",
+           report->frames, report->fps, report->late_frames,
+           report->avg_latency_us, report->max_latency_us);
+}
+
+static void play_animation(const EpdAnimation *animation,
+                           EpdAnimationReport *report) {
+  memset(report, 0, sizeof(EpdAnimationReport));
+  AnimationPipeline pipeline = {.animation = animation, .source_time_us = 0};
+  const int frame_bytes = display->width / 8 * display->height;
+  bool allocated = true;
+  for (int i = 0; i < ANIMATION_BUFFERS; i++) {
+    pipeline.buffers[i] =
+        (uint8_t *)heap_caps_malloc(frame_bytes, MALLOC_CAP_8BIT);
+    pipeline.lines[i] = (bool *)heap_caps_malloc(
+        display->height * sizeof(bool), MALLOC_CAP_8BIT);
+    allocated &= pipeline.buffers[i] != NULL && pipeline.lines[i] != NULL;
+  }
+  pipeline.free_buffers = xQueueCreate(ANIMATION_BUFFERS, sizeof(int));
+  pipeline.ready_frames =
+      xQueueCreate(ANIMATION_BUFFERS, sizeof(AnimationFrame));
+  allocated &= pipeline.free_buffers != NULL && pipeline.ready_frames != NULL;
+
+  if (!allocated) {
+    ESP_LOGE("epd_driver", "no memory for animation buffers!");
+  } else {
+    for (int i = 0; i < ANIMATION_BUFFERS; i++) {
+      xQueueSendToBack(pipeline.free_buffers, &i, 0);
+    }
+    if (xTaskCreatePinnedToCore(
+            (void (*)(void *))animation_fetch_task, "epd_anim",
+            task_config.producer_stack_size, &pipeline,
+            task_config.producer_priority, NULL,
+            task_core(task_config.producer_core)) == pdPASS) {
+      drive_animation(&pipeline, report);
+    } else {
+      ESP_LOGE("epd_driver", "failed to create the animation fetch task!");
+    }
+  }
+
+  if (pipeline.free_buffers != NULL) {
+    vQueueDelete(pipeline.free_buffers);
+  }
+  if (pipeline.ready_frames != NULL) {
+    vQueueDelete(pipeline.ready_frames);
+  }
+  for (int i = 0; i < ANIMATION_BUFFERS; i++) {
+    heap_caps_free(pipeline.buffers[i]);
+    heap_caps_free(pipeline.lines[i]);
+  }
+}
+
+/*
+ * Draw operations are submitted to `draw_queue` and run by whichever
+ * submitting task finds the driver idle, so draws from different tasks
+ * are serialized without a dedicated draw task.
+ */
+enum DrawOp {
+  DRAW_PUSH_PIXELS,
+  DRAW_CLEAR,
+  DRAW_CLEAR_ADAPTIVE,
+  DRAW_FRAME_1BIT,
+  DRAW_IMAGE,
+  DRAW_IMAGE_PROGRESSIVE,
+  DRAW_ANIMATION,
+  DRAW_SET_GRAY_MAP,
+  DRAW_SET_WAVEFORM,
+  DRAW_COMPOSITE,
+  DRAW_DISPLAY_LIST
+};
+
+typedef struct {
+  enum DrawOp op;
+  Rect_t area;
+  const uint8_t *data;
+  enum DrawMode mode;
+  // push / frame time, or clear cycle time.
+  int time;
+  int color;
+  int cycles;
+  const bool *drawn_lines;
+  // new content and changed lines of an adaptive clear.
+  const uint8_t *new_data;
+  bool *changed_lines;
+  // animation to play and its report.
+  const EpdAnimation *animation;
+  EpdAnimationReport *report;
+  // contrast cycles to set.
+  const int *waveform;
+  const int *waveform_white;
+  // layers to compose.
+  const EpdCompositor *compositor;
+  // display list to rasterize.
+  const EpdDisplayList *display_list;
+  // given when the request is done.
+  SemaphoreHandle_t done;
+} DrawRequest;
+
+static QueueHandle_t draw_queue;
+// Held by the task running the queued draws.
+static SemaphoreHandle_t draw_runner;
+
+static bool rect_contains(Rect_t outer, Rect_t inner) {
+  return inner.x >= outer.x && inner.y >= outer.y &&
+         inner.x + inner.width <= outer.x + outer.width &&
+         inner.y + inner.height <= outer.y + outer.height;
+}
+
+/*
+ * If running one of two consecutive requests has the effect of running
+ * both, return that request. Otherwise return NULL.
+ * Pushes, images, frames and display lists add up on the panel,
+ * so they are never merged, not even when identical.
+ */
+static DrawRequest *merge_draws(DrawRequest *a, DrawRequest *b) {
+  if (a->op != b->op) {
+    return NULL;
+  }
+  switch (a->op) {
+  case DRAW_CLEAR:
+    // clearing is idempotent, the larger clear covers the smaller one.
+    if (a->time != b->time || a->cycles != b->cycles) {
+      return NULL;
+    }
+    if (rect_contains(a->area, b->area)) {
+      return a;
+    }
+    if (rect_contains(b->area, a->area)) {
+      return b;
+    }
+    return NULL;
+  case DRAW_SET_GRAY_MAP:
+  case DRAW_SET_WAVEFORM:
+    // the later selection replaces the earlier one.
+    return b;
+  case DRAW_COMPOSITE:
+    // composing the same layers again after a clear gives the same
+    // content, without the clear it darkens the area again.
+    if (memcmp(&a->area, &b->area, sizeof(Rect_t)) == 0 &&
+        a->compositor == b->compositor && a->cycles == b->cycles &&
+        a->cycles > 0) {
+      return a;
+    }
+    return NULL;
+  default:
+    return NULL;
+  }
+}
+
+static void run_draw(const DrawRequest *req) {
+  switch (req->op) {
+  case DRAW_PUSH_PIXELS:
+    push_pixels(req->area, req->time, req->color);
+    epd_ghosting_record(req->area, NULL, req->time * 10);
+    break;
+  case DRAW_CLEAR:
+    clear_area_cycles(req->area, req->cycles, req->time);
+    epd_ghosting_cleaned(req->area);
+    break;
+  case DRAW_CLEAR_ADAPTIVE:
+    clear_area_adaptive(req->area, req->data, req->new_data,
+                        req->changed_lines);
+    break;
+  case DRAW_SET_GRAY_MAP:
+    if (req->data != NULL) {
+      memcpy(gray_map, req->data, sizeof(gray_map));
+    } else {
+      for (int v = 0; v < 16; v++) {
+        gray_map[v] = display->gray_map != NULL ? display->gray_map[v] : v;
+      }
+    }
+    break;
+  case DRAW_COMPOSITE: {
+    draw_begin();
+    if (req->cycles > 0) {
+      clear_area_cycles(req->area, req->cycles, display->clear_cycle_time);
+      epd_ghosting_cleaned(req->area);
+    } else {
+      // drawn on top of the old content, only tiles waiting for a
+      // refresh are cleaned, like before a complete image.
+      Rect_t pending;
+      if (epd_ghosting_pending_in(req->area, &pending)) {
+        clear_area_cycles(pending, 3, display->clear_cycle_time);
+        epd_ghosting_cleaned(pending);
+      }
+    }
+    draw_image_frames(req->area, NULL, req->compositor, NULL, BLACK_ON_WHITE,
+                      NULL, 0);
+    draw_end();
+    const int *contrast_lut = contrast_cycles(BLACK_ON_WHITE);
+    uint32_t energy = 0;
+    for (int k = 0; k < 15; k++) {
+      energy += contrast_lut[k];
+    }
+    epd_ghosting_record(req->area, NULL, energy);
+    break;
+  }
+  case DRAW_SET_WAVEFORM:
+    portENTER_CRITICAL(&waveform_mux);
+    memcpy(waveform,
+           req->waveform != NULL ? req->waveform : display->contrast_cycles_4,
+           sizeof(waveform));
+    memcpy(waveform_white,
+           req->waveform_white != NULL ? req->waveform_white
+                                       : display->contrast_cycles_4_white,
+           sizeof(waveform_white));
+    portEXIT_CRITICAL(&waveform_mux);
+    break;
+  case DRAW_ANIMATION:
+    play_animation(req->animation, req->report);
+    epd_ghosting_record(epd_full_screen(), NULL,
+                        req->report->passes * req->animation->time);
+    break;
+  case DRAW_FRAME_1BIT:
+    draw_frame_1bit_lines(req->area, req->data, req->mode, req->time,
+                          req->drawn_lines);
+    epd_ghosting_record(req->area, req->drawn_lines, req->time);
+    break;
+  case DRAW_IMAGE:
+  case DRAW_IMAGE_PROGRESSIVE:
+  case DRAW_DISPLAY_LIST: {
+    // A complete black on white image redraws its whole area,
+    // so tiles waiting for a refresh can be cleaned right before it.
+    // The clean is accounted as part of the draw.
+    Rect_t pending;
+    bool clean = req->mode == BLACK_ON_WHITE && req->drawn_lines == NULL &&
+                 epd_ghosting_pending_in(req->area, &pending);
+    if (clean) {
+      draw_begin();
+      clear_area_cycles(pending, 3, display->clear_cycle_time);
+      epd_ghosting_cleaned(pending);
+    }
+    if (req->op == DRAW_IMAGE_PROGRESSIVE) {
+      draw_image_progressive(req->area, req->data, req->mode);
+    } else if (req->op == DRAW_DISPLAY_LIST) {
+      draw_display_list(req->area, req->display_list, req->mode);
+    } else {
+      draw_image_lines(req->area, req->data, req->mode, req->drawn_lines, 0);
+    }
+    if (clean) {
+      draw_end();
+    }
+    const int *contrast_lut = contrast_cycles(req->mode);
+    uint32_t energy = 0;
+    for (int k = 0; k < 15; k++) {
+      energy += contrast_lut[k];
+    }
+    epd_ghosting_record(req->area, req->drawn_lines, energy);
+    break;
+  }
+  }
+}
+
+/*
+ * Run a request together with the following queued requests it merges with.
+ */
+static void run_merged_draws(DrawRequest *req) {
+  DrawRequest *merged[CONFIG_EPD_DRAW_QUEUE_LENGTH];
+  int merged_count = 0;
+  DrawRequest *next;
+  while (merged_count < CONFIG_EPD_DRAW_QUEUE_LENGTH &&
+         xQueuePeek(draw_queue, &next, 0) == pdTRUE) {
+    DrawRequest *cover = merge_draws(req, next);
+    if (cover == NULL) {
+      break;
+    }
+    xQueueReceive(draw_queue, &next, 0);
+    merged[merged_count++] = cover == req ? next : req;
+    req = cover;
+  }
+
+  run_draw(req);
+  xSemaphoreGive(req->done);
+  for (int i = 0; i < merged_count; i++) {
+    xSemaphoreGive(merged[i]->done);
+  }
+  if (merged_count > 0) {
+    portENTER_CRITICAL(&stats_mux);
+    stats.draws_merged += merged_count;
+    portEXIT_CRITICAL(&stats_mux);
+  }
+}
+
+/*
+ * Queue a draw request and wait until it is done.
+ * If no other task is drawing, the draws are run by this task.
+ */
+static void submit_draw(DrawRequest *req) {
+  req->done = xSemaphoreCreateBinary();
+  assert(req->done != NULL);
+  xQueueSendToBack(draw_queue, &req, portMAX_DELAY);
+
+  // A request queued while the runner is finishing up is picked up
+  // by the runner re-checking the queue after giving up `draw_runner`.
+  DrawRequest *next;
+  while (uxQueueMessagesWaiting(draw_queue) > 0 &&
+         xSemaphoreTake(draw_runner, 0) == pdTRUE) {
+    while (xQueueReceive(draw_queue, &next, 0) == pdTRUE) {
+      run_merged_draws(next);
+    }
+    xSemaphoreGive(draw_runner);
+  }
+
+  xSemaphoreTake(req->done, portMAX_DELAY);
+  vSemaphoreDelete(req->done);
+}
+
+void epd_push_pixels(Rect_t area, short time, int color) {
+  DrawRequest req = {
+      .op = DRAW_PUSH_PIXELS, .area = area, .time = time, .color = color};
+  submit_draw(&req);
+}
+
+void epd_clear_area_cycles(Rect_t area, int cycles, int cycle_time) {
+  DrawRequest req = {
+      .op = DRAW_CLEAR, .area = area, .time = cycle_time, .cycles = cycles};
+  submit_draw(&req);
+}
+
+void epd_clear_area_adaptive(Rect_t area, const uint8_t *old_framebuffer,
+                             const uint8_t *new_framebuffer,
+                             bool *drawn_lines) {
+  DrawRequest req = {.op = DRAW_CLEAR_ADAPTIVE,
+                     .area = area,
+                     .data = old_framebuffer,
+                     .new_data = new_framebuffer,
+                     .changed_lines = drawn_lines};
+  submit_draw(&req);
+}
+
+void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
+                                         enum DrawMode mode, int time,
+                                         const bool *drawn_lines) {
+  DrawRequest req = {.op = DRAW_FRAME_1BIT,
+                     .area = area,
+                     .data = ptr,
+                     .mode = mode,
+                     .time = time,
+                     .drawn_lines = drawn_lines};
+  submit_draw(&req);
+}
+
+void IRAM_ATTR epd_draw_frame_1bit(Rect_t area, const uint8_t *ptr,
+                                   enum DrawMode mode, int time) {
+  epd_draw_frame_1bit_lines(area, ptr, mode, time, NULL);
+}
+
+void IRAM_ATTR epd_draw_image_lines(Rect_t area, const uint8_t *data,
+                                    enum DrawMode mode,
+                                    const bool *drawn_lines) {
+  DrawRequest req = {.op = DRAW_IMAGE,
+                     .area = area,
+                     .data = data,
+                     .mode = mode,
+                     .drawn_lines = drawn_lines};
+  submit_draw(&req);
+}
+
+void IRAM_ATTR epd_draw_image(Rect_t area, const uint8_t *data,
+                              enum DrawMode mode) {
+  epd_draw_image_lines(area, data, mode, NULL);
+}
+
+bool epd_set_gray_map(const uint8_t *map) {
+  for (int v = 0; map != NULL && v < 16; v++) {
+    if (map[v] > 15) {
+      ESP_LOGW("epd_driver", "invalid gray map, level %d of %d!", map[v], v);
+      return false;
+    }
+  }
+  // applied between draws, so no draw mixes two maps.
+  DrawRequest req = {.op = DRAW_SET_GRAY_MAP, .data = map};
+  submit_draw(&req);
+  return true;
+}
+
+static bool valid_waveform(const int *cycles) {
+  for (int k = 0; cycles != NULL && k < 15; k++) {
+    if (cycles[k] < 0 || cycles[k] > UINT16_MAX) {
+      ESP_LOGW("epd_driver", "invalid waveform, %d cycles in frame %d!",
+               cycles[k], k);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool epd_set_contrast_cycles(const int *cycles, const int *white_cycles) {
+  if (!valid_waveform(cycles) || !valid_waveform(white_cycles)) {
+    return false;
+  }
+  DrawRequest req = {.op = DRAW_SET_WAVEFORM,
+                     .waveform = cycles,
+                     .waveform_white = white_cycles};
+  submit_draw(&req);
+  return true;
+}
+
+void epd_get_contrast_cycles(int *cycles, int *white_cycles) {
+  portENTER_CRITICAL(&waveform_mux);
+  memcpy(cycles, waveform, sizeof(waveform));
+  memcpy(white_cycles, waveform_white, sizeof(waveform_white));
+  portEXIT_CRITICAL(&waveform_mux);
+}
+
+bool epd_apply_calibration(const EpdCalibration *calibration) {
+  for (int v = 0; v < 16; v++) {
+    if (calibration->gray_map[v] > 15) {
+      return false;
+    }
+  }
+  if (!epd_set_contrast_cycles(calibration->contrast_cycles_4,
+                               calibration->contrast_cycles_4_white)) {
+    return false;
+  }
+  return epd_set_gray_map(calibration->gray_map);
+}
+
+void epd_draw_composite(Rect_t area, const EpdCompositor *compositor) {
+  DrawRequest req = {.op = DRAW_COMPOSITE,
+                     .area = area,
+                     .cycles = compositor->clear_cycles,
+                     .compositor = compositor};
+  submit_draw(&req);
+}
+
+void epd_draw_display_list(Rect_t area, const EpdDisplayList *list,
+                           enum DrawMode mode) {
+  DrawRequest req = {.op = DRAW_DISPLAY_LIST,
+                     .area = area,
+                     .mode = mode,
+                     .display_list = list};
+  submit_draw(&req);
+}
+
+void epd_play_animation(const EpdAnimation *animation,
+                        EpdAnimationReport *report) {
+  EpdAnimationReport local_report;
+  DrawRequest req = {.op = DRAW_ANIMATION,
+                     .animation = animation,
+                     .report = report != NULL ? report : &local_report};
+  submit_draw(&req);
+}
+
+bool epd_frame_array_source(uint8_t *frame, void *ctx) {
+  EpdFrameArray *array = (EpdFrameArray *)ctx;
+  if (array->next >= array->count) {
+    return false;
+  }
+  const int frame_bytes = display->width / 8 * display->height;
+  memcpy(frame, array->frames + array->next * frame_bytes, frame_bytes);
+  array->next++;
+  return true;
+}
+
+bool epd_file_frame_source(uint8_t *frame, void *ctx) {
+  const size_t frame_bytes = display->width / 8 * display->height;
+  return fread(frame, 1, frame_bytes, (FILE *)ctx) == frame_bytes;
+}
+
+void epd_draw_image_progressive(Rect_t area, const uint8_t *data,
+                                enum DrawMode mode) {
+  DrawRequest req = {.op = DRAW_IMAGE_PROGRESSIVE,
+                     .area = area,
+                     .data = data,
+                     .mode = mode};
+  submit_draw(&req);
+}
+
+void epd_init() { epd_init_display(epd_default_display()); }
+
+EpdTaskConfig epd_default_task_config() {
+  EpdTaskConfig config = {
+      .producer_core = CONFIG_EPD_PRODUCER_CORE,
+      .producer_priority = CONFIG_EPD_PRODUCER_PRIORITY,
+      .producer_stack_size = CONFIG_EPD_PRODUCER_STACK_SIZE,
+      .consumer_core = CONFIG_EPD_CONSUMER_CORE,
+      .consumer_priority = CONFIG_EPD_CONSUMER_PRIORITY,
+      .consumer_stack_size = CONFIG_EPD_CONSUMER_STACK_SIZE,
+#if defined(CONFIG_EPD_SINGLE_TASK)
+      .single_task = true,
+#else
+      .single_task = false,
+#endif
+  };
+  return config;
+}
+
+void epd_init_display(const EpdDisplay *disp) {
+  epd_init_display_tasks(disp, NULL);
+}
+
+void epd_init_display_tasks(const EpdDisplay *disp,
+                            const EpdTaskConfig *tasks) {
+  assert(disp->width % 16 == 0);
+  // switching displays requires `epd_deinit` first.
+  assert(display == NULL);
+  display = disp;
+  task_config = tasks != NULL ? *tasks : epd_default_task_config();
   skipping = 0;
-  epd_base_init(EPD_WIDTH);
+  for (int v = 0; v < 16; v++) {
+    gray_map[v] = display->gray_map != NULL ? display->gray_map[v] : v;
+  }
+  memcpy(waveform, display->contrast_cycles_4, sizeof(waveform));
+  memcpy(waveform_white, display->contrast_cycles_4_white,
+         sizeof(waveform_white));
+  bus = epd_bus();
+  bus->init(display);
+  epd_estimate_init(display);
+  epd_ghosting_init(display);
+  epd_display_list_render_init();
+  epd_power_init();
   epd_temperature_init();
 
   fetch_params.done_smphr = xSemaphoreCreateBinary();
@@ -930,23 +2294,138 @@ void epd_init() {
   feed_params.done_smphr = xSemaphoreCreateBinary();
   feed_params.start_smphr = xSemaphoreCreateBinary();
 
-  RTOS_ERROR_CHECK(xTaskCreatePinnedToCore((void (*)(void *))provide_out,
-                                           "epd_out", 1 << 12, &fetch_params, 5,
-                                           NULL, 0));
-
-  RTOS_ERROR_CHECK(xTaskCreatePinnedToCore((void (*)(void *))feed_display,
-                                           "epd_render", 1 << 12, &feed_params,
-                                           5, NULL, 1));
+  draw_queue = xQueueCreate(CONFIG_EPD_DRAW_QUEUE_LENGTH, sizeof(DrawRequest *));
+  draw_runner = xSemaphoreCreateMutex();
+  assert(draw_queue != NULL && draw_runner != NULL);
+
+  fetch_line = (uint8_t *)heap_caps_malloc(display->width / 2, MALLOC_CAP_8BIT);
+  feed_line = (uint8_t *)heap_caps_malloc(display->width / 2, MALLOC_CAP_8BIT);
+  line_1bpp = (uint8_t *)heap_caps_malloc(display->width / 8, MALLOC_CAP_8BIT);
+  push_row = (uint8_t *)heap_caps_malloc(EPD_LINE_BYTES, MALLOC_CAP_8BIT);
+  assert(fetch_line != NULL && feed_line != NULL && line_1bpp != NULL &&
+         push_row != NULL);
+
+  prefetch_buf_size = CONFIG_EPD_PREFETCH_ROWS * display->width / 2;
+  if (prefetch_buf_size > 0) {
+    prefetch_buf = (uint8_t *)heap_caps_malloc(
+        prefetch_buf_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (prefetch_buf == NULL) {
+      ESP_LOGW("epd_driver", "no memory for row prefetching, disabled.");
+      prefetch_buf_size = 0;
+    }
+  }
 
   conversion_lut = (uint8_t *)heap_caps_malloc(1 << 16, MALLOC_CAP_8BIT);
   assert(conversion_lut != NULL);
-  output_queue = xQueueCreate(32, EPD_WIDTH / 2);
+  if (!task_config.single_task) {
+    output_queue = xQueueCreate(32, display->width / 2);
+
+    RTOS_ERROR_CHECK(xTaskCreatePinnedToCore(
+        (void (*)(void *))provide_out, "epd_out",
+        task_config.producer_stack_size, &fetch_params,
+        task_config.producer_priority, &producer_task,
+        task_core(task_config.producer_core)));
+  }
+
+  RTOS_ERROR_CHECK(xTaskCreatePinnedToCore(
+      (void (*)(void *))feed_display, "epd_render",
+      task_config.consumer_stack_size, &feed_params,
+      task_config.consumer_priority, &consumer_task,
+      task_core(task_config.consumer_core)));
+}
+
+uint32_t epd_estimate_draw_time(Rect_t area, enum DrawMode mode,
+                                const EpdDrawOptions *options) {
+  const EpdDrawOptions image_options = {.type = EPD_DRAW_IMAGE};
+  if (options == NULL) {
+    options = &image_options;
+  }
+
+  uint64_t total = 0;
+  switch (options->type) {
+  case EPD_DRAW_IMAGE: {
+    const int *contrast_lut = contrast_cycles(mode);
+    for (int k = 0; k < 15; k++) {
+      uint32_t frame_time = epd_estimate_frame_time(
+          area, options->drawn_lines, contrast_lut[k], contrast_lut[k]);
+      total += max(frame_time, MINIMUM_FRAME_TIME * 1000);
+    }
+    break;
+  }
+  case EPD_DRAW_FRAME_1BIT:
+    total = epd_estimate_frame_time(area, options->drawn_lines, options->time,
+                                    options->time);
+    break;
+  case EPD_DRAW_CLEAR:
+    // every cycle pushes 10 dark and 10 white frames.
+    total = (uint64_t)options->cycles * 20 *
+            epd_estimate_frame_time(area, NULL, options->time * 10,
+                                    options->time * 10);
+    break;
+  }
+  return total;
+}
+
+void epd_get_stats(EpdDrawStats *out) {
+  portENTER_CRITICAL(&stats_mux);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_mux);
 }
 
+void epd_reset_stats() {
+  portENTER_CRITICAL(&stats_mux);
+  memset(&stats, 0, sizeof(stats));
+  portEXIT_CRITICAL(&stats_mux);
+}
+
+const EpdDisplay *epd_current_display() { return display; }
+
+int epd_width() { return fb_display()->width; }
+
+int epd_height() { return fb_display()->height; }
+
 void epd_deinit(){
-#if defined(CONFIG_EPD_BOARD_REVISION_V5)
-  gpio_reset_pin(CKH);
-  rtc_gpio_isolate(CKH);
-#endif
-  epd_base_deinit();
+  if (display == NULL) {
+    return;
+  }
+  // stops the idle refresh, which draws itself.
+  epd_ghosting_deinit();
+  // run what is still queued, the pipeline tasks are idle afterwards.
+  xSemaphoreTake(draw_runner, portMAX_DELAY);
+  DrawRequest *next;
+  while (xQueueReceive(draw_queue, &next, 0) == pdTRUE) {
+    run_merged_draws(next);
+  }
+
+  if (producer_task != NULL) {
+    vTaskDelete(producer_task);
+    producer_task = NULL;
+    vQueueDelete(output_queue);
+    output_queue = NULL;
+  }
+  vTaskDelete(consumer_task);
+  consumer_task = NULL;
+
+  vSemaphoreDelete(fetch_params.done_smphr);
+  vSemaphoreDelete(fetch_params.start_smphr);
+  vSemaphoreDelete(feed_params.done_smphr);
+  vSemaphoreDelete(feed_params.start_smphr);
+  vQueueDelete(draw_queue);
+  draw_queue = NULL;
+  vSemaphoreDelete(draw_runner);
+  draw_runner = NULL;
+
+  heap_caps_free(fetch_line);
+  heap_caps_free(feed_line);
+  heap_caps_free(line_1bpp);
+  heap_caps_free(push_row);
+  heap_caps_free(prefetch_buf);
+  heap_caps_free(conversion_lut);
+  fetch_line = feed_line = line_1bpp = push_row = NULL;
+  prefetch_buf = conversion_lut = NULL;
+  prefetch_buf_size = 0;
+
+  epd_power_deinit();
+  bus->deinit();
+  display = NULL;
 }
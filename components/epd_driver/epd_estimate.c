@@ -0,0 +1,77 @@
+#include "epd_estimate.h"
+
+#include "freertos/FreeRTOS.h"
+#include <stddef.h>
+
+/// Time to start and end a frame, in us.
+#define FRAME_OVERHEAD_US 40
+
+/// Weight of a new measurement in the exponential filter.
+#define CALIBRATION_ALPHA 0.125f
+
+static const EpdDisplay *display = NULL;
+/// Transfer time of a row on the data bus, in 0.1us.
+static uint32_t transfer_time;
+
+/// Calibrated CPU overhead per row beyond the modeled bus time, in us,
+/// protected by `calibration_mux`.
+static float row_overhead_us = 0;
+static portMUX_TYPE calibration_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void epd_estimate_init(const EpdDisplay *disp) {
+  display = disp;
+  // 32 dummy pixels per row, one byte of 4 pixels per 4 bus clock cycles.
+  transfer_time = (display->width + 32) / 4 * 40 / display->bus_clock_mhz;
+}
+
+static inline uint32_t row_bus_time(uint32_t high_time, uint32_t low_time) {
+  uint32_t ckv_time = high_time + low_time;
+  return ckv_time > transfer_time ? ckv_time : transfer_time;
+}
+
+uint32_t epd_estimate_frame_bus_time(Rect_t area, const bool *drawn_lines,
+                                     uint32_t row_time, uint32_t skip_time) {
+  const uint32_t write_cost = row_bus_time(row_time, display->row_ckv_low);
+  const uint32_t skip_output_cost =
+      row_bus_time(skip_time, display->row_ckv_low);
+  const uint32_t skip_cost = display->skip_ckv_high + display->skip_ckv_low;
+
+  // mirrors the row skipping of the driver:
+  // the first two skipped rows are output to latch out no-op data.
+  uint64_t total = 0;
+  int skipping = 0;
+  for (int i = 0; i < display->height; i++) {
+    bool drawn = i >= area.y && i < area.y + area.height &&
+                 (drawn_lines == NULL || drawn_lines[i - area.y]);
+    if (drawn) {
+      total += write_cost;
+      skipping = 0;
+    } else {
+      total += skipping < 2 ? skip_output_cost : skip_cost;
+      skipping++;
+    }
+  }
+  if (!skipping) {
+    total += write_cost;
+  }
+  return total / 10 + FRAME_OVERHEAD_US;
+}
+
+uint32_t epd_estimate_frame_time(Rect_t area, const bool *drawn_lines,
+                                 uint32_t row_time, uint32_t skip_time) {
+  portENTER_CRITICAL(&calibration_mux);
+  float overhead = row_overhead_us;
+  portEXIT_CRITICAL(&calibration_mux);
+  return epd_estimate_frame_bus_time(area, drawn_lines, row_time, skip_time) +
+         (uint32_t)(overhead * (display->height + 1));
+}
+
+void epd_estimate_calibrate(uint32_t bus_time_us, uint32_t frame_time_us) {
+  float overhead = 0;
+  if (frame_time_us > bus_time_us) {
+    overhead = (float)(frame_time_us - bus_time_us) / (display->height + 1);
+  }
+  portENTER_CRITICAL(&calibration_mux);
+  row_overhead_us += CALIBRATION_ALPHA * (overhead - row_overhead_us);
+  portEXIT_CRITICAL(&calibration_mux);
+}
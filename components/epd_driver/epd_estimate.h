@@ -0,0 +1,39 @@
+/**
+ * Draw time model, calibrated from measured frame times.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Set the display to model.
+ */
+void epd_estimate_init(const EpdDisplay *display);
+
+/**
+ * Modeled bus time of a frame in microseconds, without the calibrated
+ * per-row overhead.
+ *
+ * @param row_time: Gate pulse time of a drawn row, in 0.1us.
+ * @param skip_time: Gate pulse time of the rows output when starting to skip.
+ */
+uint32_t epd_estimate_frame_bus_time(Rect_t area, const bool *drawn_lines,
+                                     uint32_t row_time, uint32_t skip_time);
+
+/**
+ * Estimated duration of a frame in microseconds,
+ * including the calibrated per-row overhead.
+ */
+uint32_t epd_estimate_frame_time(Rect_t area, const bool *drawn_lines,
+                                 uint32_t row_time, uint32_t skip_time);
+
+/**
+ * Update the per-row overhead from a measured frame.
+ *
+ * @param bus_time_us: Result of `epd_estimate_frame_bus_time` for the frame.
+ * @param frame_time_us: Measured duration of the frame.
+ */
+void epd_estimate_calibrate(uint32_t bus_time_us, uint32_t frame_time_us);
@@ -0,0 +1,33 @@
+/**
+ * Text drawing with reusable glyph decompression buffers.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include "esp32/rom/miniz.h"
+#include <stdint.h>
+
+/**
+ * Decompressor and bitmap buffer for the glyphs drawn by one task,
+ * allocated on first use. Zero-initialize before use, do not share
+ * between tasks.
+ */
+typedef struct {
+  tinfl_decompressor *decompressor;
+  uint8_t *bitmap;
+  uint32_t bitmap_size;
+} EpdGlyphDecoder;
+
+/**
+ * Free the buffers of a decoder.
+ */
+void epd_glyph_decoder_free(EpdGlyphDecoder *decoder);
+
+/**
+ * `write_band`, decompressing glyphs with the decoder of the calling task.
+ */
+void epd_write_band_decoder(const GFXfont *font, const char *string,
+                            int *cursor_x, int *cursor_y, const EpdBand *band,
+                            const FontProperties *properties,
+                            EpdGlyphDecoder *decoder);
@@ -0,0 +1,303 @@
+#include "epd_ghosting.h"
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TILE_SIZE CONFIG_EPD_GHOSTING_TILE_SIZE
+
+static const EpdDisplay *display = NULL;
+static int columns = 0;
+static int rows = 0;
+
+// Partial updates and accumulated drive energy since the last clean, per tile.
+static uint16_t *tile_updates = NULL;
+static uint32_t *tile_energy = NULL;
+static uint32_t refreshed_tiles = 0;
+static portMUX_TYPE ghosting_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t max_updates = CONFIG_EPD_GHOSTING_MAX_UPDATES;
+static uint32_t max_energy = CONFIG_EPD_GHOSTING_MAX_ENERGY;
+
+// Refreshes pending tiles after a period without draws. The timer only
+// wakes `idle_task`, clearing and redrawing takes far too long for the
+// esp_timer task.
+static esp_timer_handle_t idle_timer = NULL;
+static TaskHandle_t idle_task = NULL;
+static SemaphoreHandle_t idle_signal = NULL;
+// Held while refreshing, so the refresh cannot outlive `epd_deinit`.
+static SemaphoreHandle_t idle_lock = NULL;
+static uint32_t idle_ms = 0;
+static EpdRedrawCallback idle_redraw = NULL;
+static void *idle_redraw_ctx = NULL;
+
+static inline int min_int(int a, int b) { return a < b ? a : b; }
+static inline int max_int(int a, int b) { return a > b ? a : b; }
+
+static Rect_t tile_rect(int column, int row) {
+  Rect_t rect = {.x = column * TILE_SIZE,
+                 .y = row * TILE_SIZE,
+                 .width = min_int(TILE_SIZE, display->width - column * TILE_SIZE),
+                 .height =
+                     min_int(TILE_SIZE, display->height - row * TILE_SIZE)};
+  return rect;
+}
+
+static bool intersect(Rect_t a, Rect_t b, Rect_t *out) {
+  int x0 = max_int(a.x, b.x);
+  int y0 = max_int(a.y, b.y);
+  int x1 = min_int(a.x + a.width, b.x + b.width);
+  int y1 = min_int(a.y + a.height, b.y + b.height);
+  if (x1 <= x0 || y1 <= y0) {
+    return false;
+  }
+  out->x = x0;
+  out->y = y0;
+  out->width = x1 - x0;
+  out->height = y1 - y0;
+  return true;
+}
+
+/*
+ * Must be called with `ghosting_mux` held.
+ */
+static bool tile_pending(int index) {
+  return (max_updates > 0 && tile_updates[index] >= max_updates) ||
+         (max_energy > 0 && tile_energy[index] >= max_energy);
+}
+
+/*
+ * Tile range touched by an area, clipped to the display.
+ * Returns false if the area is off screen or ghosting is not set up,
+ * as for draws still queued when `epd_deinit` tears it down.
+ */
+static bool tile_range(Rect_t area, int *c0, int *r0, int *c1, int *r1) {
+  if (display == NULL) {
+    return false;
+  }
+  Rect_t screen = {
+      .x = 0, .y = 0, .width = display->width, .height = display->height};
+  Rect_t clipped;
+  if (!intersect(area, screen, &clipped)) {
+    return false;
+  }
+  *c0 = clipped.x / TILE_SIZE;
+  *r0 = clipped.y / TILE_SIZE;
+  *c1 = (clipped.x + clipped.width - 1) / TILE_SIZE;
+  *r1 = (clipped.y + clipped.height - 1) / TILE_SIZE;
+  return true;
+}
+
+static void restart_idle_timer() {
+  if (idle_timer == NULL) {
+    return;
+  }
+  esp_timer_stop(idle_timer);
+  if (idle_ms > 0 && idle_redraw != NULL) {
+    esp_timer_start_once(idle_timer, (uint64_t)idle_ms * 1000);
+  }
+}
+
+static void idle_expired(void *arg) { xSemaphoreGive(idle_signal); }
+
+static void idle_refresh_task(void *arg) {
+  while (true) {
+    xSemaphoreTake(idle_signal, portMAX_DELAY);
+    xSemaphoreTake(idle_lock, portMAX_DELAY);
+    EpdRedrawCallback redraw = idle_redraw;
+    void *ctx = idle_redraw_ctx;
+    Rect_t area;
+    if (display != NULL && redraw != NULL &&
+        epd_ghosting_pending_in(epd_full_screen(), &area)) {
+      epd_clear_area(area);
+      redraw(area, ctx);
+    }
+    xSemaphoreGive(idle_lock);
+  }
+}
+
+void epd_ghosting_init(const EpdDisplay *disp) {
+  display = disp;
+  columns = (display->width + TILE_SIZE - 1) / TILE_SIZE;
+  rows = (display->height + TILE_SIZE - 1) / TILE_SIZE;
+
+  free(tile_updates);
+  free(tile_energy);
+  tile_updates = (uint16_t *)heap_caps_malloc(
+      columns * rows * sizeof(uint16_t), MALLOC_CAP_8BIT);
+  tile_energy = (uint32_t *)heap_caps_malloc(
+      columns * rows * sizeof(uint32_t), MALLOC_CAP_8BIT);
+  assert(tile_updates != NULL && tile_energy != NULL);
+  memset(tile_updates, 0, columns * rows * sizeof(uint16_t));
+  memset(tile_energy, 0, columns * rows * sizeof(uint32_t));
+  refreshed_tiles = 0;
+
+  if (idle_timer == NULL) {
+    idle_signal = xSemaphoreCreateBinary();
+    idle_lock = xSemaphoreCreateMutex();
+    assert(idle_signal != NULL && idle_lock != NULL);
+    if (xTaskCreate(idle_refresh_task, "epd_idle",
+                    CONFIG_EPD_IDLE_REFRESH_STACK_SIZE, NULL,
+                    tskIDLE_PRIORITY + 1, &idle_task) != pdPASS) {
+      abort();
+    }
+    esp_timer_create_args_t timer_args = {
+        .callback = idle_expired,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "epd_ghosting",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &idle_timer));
+  }
+}
+
+void epd_ghosting_deinit() {
+  if (idle_timer == NULL) {
+    return;
+  }
+  // wait for a running refresh, its draws need the driver.
+  xSemaphoreTake(idle_lock, portMAX_DELAY);
+  esp_timer_stop(idle_timer);
+  free(tile_updates);
+  free(tile_energy);
+  tile_updates = NULL;
+  tile_energy = NULL;
+  display = NULL;
+  xSemaphoreGive(idle_lock);
+}
+
+void epd_ghosting_record(Rect_t area, const bool *drawn_lines,
+                         uint32_t energy) {
+  int c0, r0, c1, r1;
+  if (!tile_range(area, &c0, &r0, &c1, &r1)) {
+    return;
+  }
+  portENTER_CRITICAL(&ghosting_mux);
+  for (int r = r0; r <= r1; r++) {
+    if (drawn_lines != NULL) {
+      // only count tile rows with at least one drawn line.
+      int y0 = max_int(r * TILE_SIZE, area.y);
+      int y1 = min_int((r + 1) * TILE_SIZE, area.y + area.height);
+      bool drawn = false;
+      for (int y = y0; y < y1 && !drawn; y++) {
+        drawn = drawn_lines[y - area.y];
+      }
+      if (!drawn) {
+        continue;
+      }
+    }
+    for (int c = c0; c <= c1; c++) {
+      int index = r * columns + c;
+      if (tile_updates[index] < UINT16_MAX) {
+        tile_updates[index]++;
+      }
+      uint64_t total = (uint64_t)tile_energy[index] + energy;
+      tile_energy[index] = total > UINT32_MAX ? UINT32_MAX : total;
+    }
+  }
+  portEXIT_CRITICAL(&ghosting_mux);
+  restart_idle_timer();
+}
+
+void epd_ghosting_cleaned(Rect_t area) {
+  int c0, r0, c1, r1;
+  if (!tile_range(area, &c0, &r0, &c1, &r1)) {
+    return;
+  }
+  portENTER_CRITICAL(&ghosting_mux);
+  for (int r = r0; r <= r1; r++) {
+    for (int c = c0; c <= c1; c++) {
+      Rect_t tile = tile_rect(c, r);
+      Rect_t covered;
+      if (!intersect(tile, area, &covered) ||
+          memcmp(&covered, &tile, sizeof(Rect_t)) != 0) {
+        continue;
+      }
+      int index = r * columns + c;
+      if (tile_updates[index] > 0 || tile_energy[index] > 0) {
+        refreshed_tiles++;
+      }
+      tile_updates[index] = 0;
+      tile_energy[index] = 0;
+    }
+  }
+  portEXIT_CRITICAL(&ghosting_mux);
+  restart_idle_timer();
+}
+
+bool epd_ghosting_pending_in(Rect_t area, Rect_t *pending) {
+  int c0, r0, c1, r1;
+  if (!tile_range(area, &c0, &r0, &c1, &r1)) {
+    return false;
+  }
+  int x0 = INT32_MAX, y0 = INT32_MAX, x1 = 0, y1 = 0;
+  portENTER_CRITICAL(&ghosting_mux);
+  for (int r = r0; r <= r1; r++) {
+    for (int c = c0; c <= c1; c++) {
+      Rect_t tile = tile_rect(c, r);
+      Rect_t part;
+      if (!tile_pending(r * columns + c) || !intersect(tile, area, &part) ||
+          memcmp(&part, &tile, sizeof(Rect_t)) != 0) {
+        continue;
+      }
+      x0 = min_int(x0, tile.x);
+      y0 = min_int(y0, tile.y);
+      x1 = max_int(x1, tile.x + tile.width);
+      y1 = max_int(y1, tile.y + tile.height);
+    }
+  }
+  portEXIT_CRITICAL(&ghosting_mux);
+  if (x1 <= x0) {
+    return false;
+  }
+  pending->x = x0;
+  pending->y = y0;
+  pending->width = x1 - x0;
+  pending->height = y1 - y0;
+  return true;
+}
+
+void epd_set_ghosting_thresholds(uint32_t updates, uint32_t energy) {
+  portENTER_CRITICAL(&ghosting_mux);
+  max_updates = updates;
+  max_energy = energy;
+  portEXIT_CRITICAL(&ghosting_mux);
+}
+
+void epd_set_idle_refresh(uint32_t ms, EpdRedrawCallback redraw, void *ctx) {
+  esp_timer_stop(idle_timer);
+  idle_ms = ms;
+  idle_redraw = redraw;
+  idle_redraw_ctx = ctx;
+  restart_idle_timer();
+}
+
+void epd_get_ghosting_status(EpdGhostingStatus *status) {
+  if (display == NULL) {
+    *status = (EpdGhostingStatus){.tile_size = TILE_SIZE};
+    return;
+  }
+  Rect_t screen = {
+      .x = 0, .y = 0, .width = display->width, .height = display->height};
+  Rect_t empty = {0};
+  status->tile_size = TILE_SIZE;
+  status->columns = columns;
+  status->rows = rows;
+  status->pending_tiles = 0;
+  portENTER_CRITICAL(&ghosting_mux);
+  for (int i = 0; i < columns * rows; i++) {
+    status->pending_tiles += tile_pending(i);
+  }
+  status->refreshed_tiles = refreshed_tiles;
+  portEXIT_CRITICAL(&ghosting_mux);
+  if (!epd_ghosting_pending_in(screen, &status->pending_area)) {
+    status->pending_area = empty;
+  }
+}
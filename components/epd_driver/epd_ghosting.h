@@ -0,0 +1,39 @@
+/**
+ * Per-tile tracking of partial updates, for scheduling localized refreshes.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Set up the tile grid for a display.
+ */
+void epd_ghosting_init(const EpdDisplay *display);
+
+/**
+ * Stop the idle refresh and free the tile grid.
+ */
+void epd_ghosting_deinit();
+
+/**
+ * Account a draw to the tiles it touched.
+ *
+ * @param drawn_lines: Drawn lines of the area, may be NULL.
+ * @param energy: Summed gate pulse times of the draw's frames, in 0.1us.
+ */
+void epd_ghosting_record(Rect_t area, const bool *drawn_lines,
+                         uint32_t energy);
+
+/**
+ * Reset the tiles fully covered by a cleared area.
+ */
+void epd_ghosting_cleaned(Rect_t area);
+
+/**
+ * Get the bounding area of the tiles inside `area` waiting for a refresh.
+ * Returns false if there are none.
+ */
+bool epd_ghosting_pending_in(Rect_t area, Rect_t *pending);
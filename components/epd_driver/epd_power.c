@@ -0,0 +1,140 @@
+#include "epd_power.h"
+#include "epd_bus.h"
+#include "epd_driver.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <assert.h>
+
+/// Protects the session state and the power supply sequencing.
+static SemaphoreHandle_t power_mutex = NULL;
+/// Powers off the display after the hold-off time.
+static esp_timer_handle_t hold_off_timer = NULL;
+
+static uint32_t session_count = 0;
+static uint32_t hold_off_ms = CONFIG_EPD_POWER_HOLD_OFF_MS;
+static bool powered = false;
+
+static uint32_t power_on_count = 0;
+static int64_t power_on_time_us = 0;
+static int64_t total_on_time_us = 0;
+
+/*
+ * Must be called with `power_mutex` held.
+ */
+static void power_on() {
+  if (powered) {
+    return;
+  }
+  esp_timer_stop(hold_off_timer);
+  epd_bus()->poweron();
+  powered = true;
+  power_on_count++;
+  power_on_time_us = esp_timer_get_time();
+}
+
+/*
+ * Must be called with `power_mutex` held.
+ */
+static void power_off() {
+  if (!powered) {
+    return;
+  }
+  epd_bus()->poweroff();
+  powered = false;
+  total_on_time_us += esp_timer_get_time() - power_on_time_us;
+}
+
+static void hold_off_expired(void *arg) {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  // a new session may have started in the meantime.
+  if (session_count == 0) {
+    power_off();
+  }
+  xSemaphoreGive(power_mutex);
+}
+
+void epd_power_init() {
+  if (power_mutex != NULL) {
+    return;
+  }
+  power_mutex = xSemaphoreCreateMutex();
+  assert(power_mutex != NULL);
+
+  esp_timer_create_args_t timer_args = {
+      .callback = hold_off_expired,
+      .arg = NULL,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "epd_power",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &hold_off_timer));
+}
+
+void epd_power_deinit() {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  esp_timer_stop(hold_off_timer);
+  session_count = 0;
+  power_off();
+  xSemaphoreGive(power_mutex);
+}
+
+void epd_power_acquire() {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  session_count++;
+  esp_timer_stop(hold_off_timer);
+  power_on();
+  int64_t settled_us = power_on_time_us + CONFIG_EPD_POWER_SETTLE_MS * 1000;
+  xSemaphoreGive(power_mutex);
+
+  // wait for the supply voltages to settle after a power-up,
+  // also if another task powered up the display just before.
+  int64_t remaining_us = settled_us - esp_timer_get_time();
+  if (remaining_us > 0) {
+    const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+    vTaskDelay((remaining_us + tick_us - 1) / tick_us);
+  }
+}
+
+void epd_power_release() {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  if (session_count == 0) {
+    ESP_LOGW("epd_power", "power session released more often than acquired!");
+  } else {
+    session_count--;
+  }
+  if (session_count == 0) {
+    if (hold_off_ms == 0) {
+      power_off();
+    } else {
+      esp_timer_stop(hold_off_timer);
+      esp_timer_start_once(hold_off_timer, (uint64_t)hold_off_ms * 1000);
+    }
+  }
+  xSemaphoreGive(power_mutex);
+}
+
+void epd_poweron() { epd_power_acquire(); }
+
+void epd_poweroff() { epd_power_release(); }
+
+void epd_set_power_hold_off(uint32_t ms) {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  hold_off_ms = ms;
+  xSemaphoreGive(power_mutex);
+}
+
+void epd_get_power_stats(EpdPowerStats *stats) {
+  xSemaphoreTake(power_mutex, portMAX_DELAY);
+  stats->powered = powered;
+  stats->sessions = session_count;
+  stats->power_on_count = power_on_count;
+  stats->on_time_us = total_on_time_us;
+  if (powered) {
+    stats->on_time_us += esp_timer_get_time() - power_on_time_us;
+  }
+  xSemaphoreGive(power_mutex);
+}
@@ -0,0 +1,30 @@
+/**
+ * Reference-counted power sessions for the display power supply.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Initialize the power session manager.
+ */
+void epd_power_init();
+
+/**
+ * Stop the hold-off timer and power off the display, if powered.
+ */
+void epd_power_deinit();
+
+/**
+ * Acquire a power session. Powers on the display if necessary
+ * and waits until the supply has settled, see `CONFIG_EPD_POWER_SETTLE_MS`.
+ */
+void epd_power_acquire();
+
+/**
+ * Release a power session.
+ * If this was the last session, the display is powered off
+ * after the hold-off time.
+ */
+void epd_power_release();
@@ -1,6 +1,11 @@
+#include "epd_temperature.h"
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
 
 /// Use GPIO 35
 static const adc1_channel_t channel = ADC1_CHANNEL_7;
@@ -8,6 +13,63 @@ static esp_adc_cal_characteristics_t adc_chars;
 
 #define NUMBER_OF_SAMPLES 100
 
+/// Raw samples averaged for one background measurement.
+#define BACKGROUND_SAMPLES 16
+
+/// Weight of a new measurement in the exponential filter.
+#define FILTER_ALPHA 0.2
+
+/// A measurement is considered stale after this many sample periods.
+#define STALE_PERIODS 4
+
+/// Filtered temperature and the time of its last update,
+/// protected by `temperature_mux`.
+static float filtered_temperature;
+static int64_t last_sample_us = 0;
+static bool have_sample = false;
+static portMUX_TYPE temperature_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t sample_task = NULL;
+
+static float raw_to_temperature(uint32_t value) {
+  // voltage in mV
+  float voltage = esp_adc_cal_raw_to_voltage(value, &adc_chars);
+  return (voltage - 500.0) / 10.0;
+}
+
+static void temperature_sample_task(void *arg) {
+  while (true) {
+    uint32_t value = 0;
+    bool failed = false;
+    for (int i = 0; i < BACKGROUND_SAMPLES; i++) {
+      int raw = adc1_get_raw(channel);
+      if (raw < 0) {
+        failed = true;
+        break;
+      }
+      value += raw;
+    }
+
+    if (failed) {
+      ESP_LOGW("epd_temperature", "ADC read failed.");
+    } else {
+      float temperature = raw_to_temperature(value / BACKGROUND_SAMPLES);
+      portENTER_CRITICAL(&temperature_mux);
+      if (have_sample) {
+        filtered_temperature +=
+            FILTER_ALPHA * (temperature - filtered_temperature);
+      } else {
+        filtered_temperature = temperature;
+        have_sample = true;
+      }
+      last_sample_us = esp_timer_get_time();
+      portEXIT_CRITICAL(&temperature_mux);
+    }
+
+    vTaskDelay(CONFIG_EPD_TEMPERATURE_SAMPLE_PERIOD_MS / portTICK_PERIOD_MS);
+  }
+}
+
 void epd_temperature_init() {
   esp_adc_cal_value_t val_type = esp_adc_cal_characterize(
       ADC_UNIT_1, ADC_ATTEN_DB_6, ADC_WIDTH_BIT_12, 1100, &adc_chars);
@@ -20,15 +82,46 @@ void epd_temperature_init() {
   }
   adc1_config_width(ADC_WIDTH_BIT_12);
   adc1_config_channel_atten(channel, ADC_ATTEN_DB_6);
+
+  if (sample_task == NULL) {
+    xTaskCreate(temperature_sample_task, "epd_temperature", 1 << 11, NULL,
+                tskIDLE_PRIORITY + 1, &sample_task);
+  }
+}
+
+esp_err_t epd_get_ambient_temperature(float *temperature, uint32_t *age_ms) {
+  portENTER_CRITICAL(&temperature_mux);
+  bool valid = have_sample;
+  float value = filtered_temperature;
+  int64_t sample_time = last_sample_us;
+  portEXIT_CRITICAL(&temperature_mux);
+
+  if (!valid) {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  uint32_t age = (esp_timer_get_time() - sample_time) / 1000;
+  *temperature = value;
+  if (age_ms != NULL) {
+    *age_ms = age;
+  }
+  if (age > STALE_PERIODS * CONFIG_EPD_TEMPERATURE_SAMPLE_PERIOD_MS) {
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
 }
 
 float epd_ambient_temperature() {
+  float temperature;
+  if (epd_get_ambient_temperature(&temperature, NULL) == ESP_OK) {
+    return temperature;
+  }
+
+  // no recent background measurement, measure directly.
   uint32_t value = 0;
   for (int i = 0; i < NUMBER_OF_SAMPLES; i++) {
     value += adc1_get_raw(channel);
   }
   value /= NUMBER_OF_SAMPLES;
-  // voltage in mV
-  float voltage = esp_adc_cal_raw_to_voltage(value, &adc_chars);
-  return (voltage - 500.0) / 10.0;
+  return raw_to_temperature(value);
 }
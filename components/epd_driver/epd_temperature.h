@@ -1,7 +1,11 @@
 #pragma once
 
+#include "esp_err.h"
+#include <stdint.h>
+
 /**
- * Initialize the ADC for temperature measurement.
+ * Initialize the ADC for temperature measurement
+ * and start sampling it in the background.
  */
 void epd_temperature_init();
 
@@ -9,3 +13,8 @@ void epd_temperature_init();
  * Get the current ambient temperature in °C.
  */
 float epd_ambient_temperature();
+
+/**
+ * Get the filtered ambient temperature in °C without blocking.
+ */
+esp_err_t epd_get_ambient_temperature(float *temperature, uint32_t *age_ms);
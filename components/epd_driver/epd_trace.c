@@ -0,0 +1,130 @@
+#include "epd_trace.h"
+#include "epd_driver.h"
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "xtensa/core-macros.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(CONFIG_EPD_TRACE)
+
+#define TRACE_BUFFER_SIZE CONFIG_EPD_TRACE_BUFFER_SIZE
+_Static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0,
+               "the trace buffer size must be a power of two!");
+
+typedef struct {
+  uint32_t ccount;
+  uint8_t event;
+  uint8_t begin;
+  uint8_t core;
+} trace_entry_t;
+
+/// The cycle counters of the cores are not synchronized. Each core
+/// pairs its counter with the shared esp_timer clock now and then,
+/// so the events of both cores can be put on one timeline.
+typedef struct {
+  uint32_t ccount;
+  int64_t time_us;
+} clock_ref_t;
+
+/// Cycles after which a core takes a new clock reference, half a second.
+#define CLOCK_REF_PERIOD (CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ * 500000u)
+#define TRACE_CORES 2
+
+static const char *event_names[EPD_TRACE_EVENT_COUNT] = {
+    [EPD_TRACE_DRAW] = "draw",
+    [EPD_TRACE_FRAME] = "frame",
+    [EPD_TRACE_PROVIDE_OUT] = "provide_out",
+    [EPD_TRACE_FEED_DISPLAY] = "feed_display",
+    [EPD_TRACE_LUT] = "lut",
+    [EPD_TRACE_QUEUE_FULL] = "queue_full",
+    [EPD_TRACE_QUEUE_EMPTY] = "queue_empty",
+    [EPD_TRACE_WRITE_ROW] = "write_row",
+    [EPD_TRACE_SKIP_ROW] = "skip_row",
+    [EPD_TRACE_I2S_ISR] = "i2s_isr",
+    [EPD_TRACE_RMT_ISR] = "rmt_isr",
+    [EPD_TRACE_FRAME_DELAY] = "frame_delay",
+};
+
+static DRAM_ATTR trace_entry_t trace_buffer[TRACE_BUFFER_SIZE];
+/// Number of events recorded. Entries are claimed atomically,
+/// so both cores and interrupts can record concurrently.
+static DRAM_ATTR uint32_t trace_head = 0;
+static bool trace_enabled = true;
+static DRAM_ATTR clock_ref_t clock_refs[TRACE_CORES];
+
+/*
+ * Take a new clock reference if the core has none or it is old.
+ * Only interrupts on the same core may interleave, which can shift
+ * the reference by the duration of the interrupt at most.
+ */
+static inline void IRAM_ATTR update_clock_ref(int core, uint32_t ccount) {
+  clock_ref_t *ref = &clock_refs[core];
+  if (ref->time_us != 0 && ccount - ref->ccount < CLOCK_REF_PERIOD) {
+    return;
+  }
+  uint32_t before = XTHAL_GET_CCOUNT();
+  int64_t time_us = esp_timer_get_time();
+  uint32_t after = XTHAL_GET_CCOUNT();
+  ref->ccount = before + (after - before) / 2;
+  ref->time_us = time_us;
+}
+
+void IRAM_ATTR epd_trace_record(enum EpdTraceEvent event, bool begin) {
+  if (!trace_enabled) {
+    return;
+  }
+  uint32_t index = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+  trace_entry_t *entry = &trace_buffer[index & (TRACE_BUFFER_SIZE - 1)];
+  uint32_t ccount = XTHAL_GET_CCOUNT();
+  int core = xPortGetCoreID();
+  entry->ccount = ccount;
+  entry->event = event;
+  entry->begin = begin;
+  entry->core = core;
+  update_clock_ref(core, ccount);
+}
+
+void epd_trace_dump() {
+  // stop recording, so the buffer is not overwritten while printing.
+  trace_enabled = false;
+  uint32_t head = trace_head;
+  uint32_t count = head < TRACE_BUFFER_SIZE ? head : TRACE_BUFFER_SIZE;
+
+  printf("EPD_TRACE_START %d %u %u\n", CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, count,
+         head - count);
+  for (int core = 0; core < TRACE_CORES; core++) {
+    if (clock_refs[core].time_us != 0) {
+      printf("EPD_TRACE_CLOCK %d %u %lld\n", core, clock_refs[core].ccount,
+             (long long)clock_refs[core].time_us);
+    }
+  }
+  for (uint32_t i = head - count; i != head; i++) {
+    const trace_entry_t *entry = &trace_buffer[i & (TRACE_BUFFER_SIZE - 1)];
+    printf("%u %u %c %s\n", entry->ccount, entry->core,
+           entry->begin ? 'B' : 'E', event_names[entry->event]);
+  }
+  printf("EPD_TRACE_STOP\n");
+  trace_enabled = true;
+}
+
+void epd_trace_clear() {
+  trace_enabled = false;
+  trace_head = 0;
+  memset(trace_buffer, 0, sizeof(trace_buffer));
+  memset(clock_refs, 0, sizeof(clock_refs));
+  trace_enabled = true;
+}
+
+#else
+
+void epd_trace_dump() {
+  printf("EPD tracing is disabled, enable CONFIG_EPD_TRACE.\n");
+}
+
+void epd_trace_clear() {}
+
+#endif
@@ -0,0 +1,46 @@
+/**
+ * Timeline tracing of the drawing pipeline.
+ *
+ * With `CONFIG_EPD_TRACE`, pipeline stages record timestamped begin / end
+ * events into a ring buffer, which can be dumped with `epd_trace_dump()`
+ * and converted to Chrome trace format with `scripts/epd_trace_to_chrome.py`.
+ * Otherwise, the trace macros compile to nothing.
+ */
+
+#pragma once
+
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Traced pipeline stages.
+enum EpdTraceEvent {
+  EPD_TRACE_DRAW,
+  EPD_TRACE_FRAME,
+  EPD_TRACE_PROVIDE_OUT,
+  EPD_TRACE_FEED_DISPLAY,
+  EPD_TRACE_LUT,
+  EPD_TRACE_QUEUE_FULL,
+  EPD_TRACE_QUEUE_EMPTY,
+  EPD_TRACE_WRITE_ROW,
+  EPD_TRACE_SKIP_ROW,
+  EPD_TRACE_I2S_ISR,
+  EPD_TRACE_RMT_ISR,
+  EPD_TRACE_FRAME_DELAY,
+  EPD_TRACE_EVENT_COUNT,
+};
+
+#if defined(CONFIG_EPD_TRACE)
+/**
+ * Record the begin or end of a stage on the current core.
+ * Safe to call from interrupts.
+ */
+void IRAM_ATTR epd_trace_record(enum EpdTraceEvent event, bool begin);
+
+#define EPD_TRACE_BEGIN(event) epd_trace_record(event, true)
+#define EPD_TRACE_END(event) epd_trace_record(event, false)
+#else
+#define EPD_TRACE_BEGIN(event)
+#define EPD_TRACE_END(event)
+#endif
@@ -1,4 +1,5 @@
 #include "epd_driver.h"
+#include "epd_font.h"
 #include "esp_assert.h"
 #include "esp_heap_caps.h"
 #include "esp_log.h"
@@ -29,11 +30,6 @@ static utf_t *utf[] = {
     &(utf_t){0},
 };
 
-/**
- * static decompressor object for compressed fonts.
- */
-static tinfl_decompressor decomp;
-
 static inline int min(int x, int y) { return x < y ? x : y; }
 static inline int max(int x, int y) { return x > y ? x : y; }
 
@@ -92,14 +88,41 @@ void get_glyph(const GFXfont *font, uint32_t code_point,
   return;
 }
 
-static int uncompress(uint8_t *dest, uint32_t uncompressed_size, uint8_t *source, uint32_t source_size) {
-    if (uncompressed_size == 0 || dest == NULL || source_size == 0 || source == NULL) {
+void epd_glyph_decoder_free(EpdGlyphDecoder *decoder) {
+  free(decoder->decompressor);
+  free(decoder->bitmap);
+  decoder->decompressor = NULL;
+  decoder->bitmap = NULL;
+  decoder->bitmap_size = 0;
+}
+
+/*
+ * Decompress a glyph bitmap into `decoder->bitmap`,
+ * growing the buffers of the decoder as necessary.
+ */
+static int uncompress(EpdGlyphDecoder *decoder, uint32_t uncompressed_size, const uint8_t *source, uint32_t source_size) {
+    if (uncompressed_size == 0 || source_size == 0 || source == NULL) {
         return -1;
     }
-    tinfl_init(&decomp);
+    if (decoder->decompressor == NULL) {
+        decoder->decompressor = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+        if (decoder->decompressor == NULL) {
+            return -1;
+        }
+    }
+    if (decoder->bitmap_size < uncompressed_size) {
+        free(decoder->bitmap);
+        decoder->bitmap = (uint8_t *)malloc(uncompressed_size);
+        decoder->bitmap_size = decoder->bitmap != NULL ? uncompressed_size : 0;
+        if (decoder->bitmap == NULL) {
+            return -1;
+        }
+    }
+    tinfl_init(decoder->decompressor);
 
     // we know everything will fit into the buffer.
-    tinfl_status decomp_status = tinfl_decompress(&decomp, source, &source_size, dest, dest, &uncompressed_size, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+    uint8_t *dest = decoder->bitmap;
+    tinfl_status decomp_status = tinfl_decompress(decoder->decompressor, source, &source_size, dest, dest, &uncompressed_size, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
     if (decomp_status != TINFL_STATUS_DONE) {
         return decomp_status;
     }
@@ -108,11 +131,16 @@ static int uncompress(uint8_t *dest, uint32_t uncompressed_size, uint8_t *source
 
 /*!
    @brief   Draw a single character to a pre-allocated buffer.
+
+   The buffer holds the rows `clip.y` and below, `buf_width` bytes each.
+   Only pixels within `clip` are drawn. Compressed glyphs are
+   decompressed with `decoder`.
 */
 static void IRAM_ATTR draw_char(const GFXfont *font, uint8_t *buffer,
                                 int *cursor_x, int cursor_y, uint16_t buf_width,
-                                uint16_t buf_height, uint32_t cp,
-                                const FontProperties *props) {
+                                Rect_t clip, uint32_t cp,
+                                const FontProperties *props,
+                                EpdGlyphDecoder *decoder) {
 
   const GFXglyph *glyph;
   get_glyph(font, cp, &glyph);
@@ -129,17 +157,28 @@ static void IRAM_ATTR draw_char(const GFXfont *font, uint8_t *buffer,
   uint8_t width = glyph->width, height = glyph->height;
   int left = glyph->left;
 
+  int start_pos = *cursor_x + left;
+  int min_x = max(start_pos, clip.x);
+  int max_x = min(start_pos + width, clip.x + clip.width);
+  int top = cursor_y - glyph->top;
+  // nothing to draw, don't decompress the glyph.
+  if (min_x >= max_x || top + height <= clip.y ||
+      top >= clip.y + clip.height) {
+    *cursor_x += glyph->advance_x;
+    return;
+  }
+
   int byte_width = (width / 2 + width % 2);
   unsigned long bitmap_size = byte_width * height;
-  uint8_t *bitmap = NULL;
+  const uint8_t *bitmap = NULL;
   if (font->compressed) {
-    bitmap = (uint8_t *)malloc(bitmap_size);
-    if (bitmap == NULL && bitmap_size) {
-      ESP_LOGE("font", "malloc failed.");
+    if (uncompress(decoder, bitmap_size, &font->bitmap[offset],
+                   glyph->compressed_size) != 0) {
+      ESP_LOGE("font", "cannot decompress glyph %u.", (unsigned)cp);
+      *cursor_x += glyph->advance_x;
       return;
     }
-    uncompress(bitmap, bitmap_size, &font->bitmap[offset],
-               glyph->compressed_size);
+    bitmap = decoder->bitmap;
   } else {
     bitmap = &font->bitmap[offset];
   }
@@ -151,16 +190,13 @@ static void IRAM_ATTR draw_char(const GFXfont *font, uint8_t *buffer,
   }
 
   for (int y = 0; y < height; y++) {
-    int yy = cursor_y - glyph->top + y;
-    if (yy < 0 || yy >= buf_height) {
+    int yy = top + y;
+    if (yy < clip.y || yy >= clip.y + clip.height) {
       continue;
     }
-    int start_pos = *cursor_x + left;
-    bool byte_complete = start_pos % 2;
-    int x = max(0, -start_pos);
-    int max_x = min(start_pos + width, buf_width * 2);
-    for (int xx = start_pos; xx < max_x; xx++) {
-      uint32_t buf_pos = yy * buf_width + xx / 2;
+    int x = min_x - start_pos;
+    for (int xx = min_x; xx < max_x; xx++) {
+      uint32_t buf_pos = (yy - clip.y) * buf_width + xx / 2;
       uint8_t old = buffer[buf_pos];
       uint8_t bm = bitmap[y * byte_width + x / 2];
       if ((x & 1) == 0) {
@@ -174,13 +210,9 @@ static void IRAM_ATTR draw_char(const GFXfont *font, uint8_t *buffer,
       } else {
         buffer[buf_pos] = (old & 0x0F) | (color_lut[bm] << 4);
       }
-      byte_complete = !byte_complete;
       x++;
     }
   }
-  if (font->compressed) {
-    free(bitmap);
-  }
   *cursor_x += glyph->advance_x;
 }
 
@@ -254,9 +286,19 @@ void get_text_bounds(const GFXfont *font, const char *string, int *x, int *y,
   *h = maxy - miny;
 }
 
-void write_mode(const GFXfont *font, const char *string, int *cursor_x,
-                int *cursor_y, uint8_t *framebuffer, enum DrawMode mode,
+void write_band(const GFXfont *font, const char *string, int *cursor_x,
+                int *cursor_y, const EpdBand *band,
                 const FontProperties *properties) {
+  EpdGlyphDecoder decoder = {0};
+  epd_write_band_decoder(font, string, cursor_x, cursor_y, band, properties,
+                         &decoder);
+  epd_glyph_decoder_free(&decoder);
+}
+
+void epd_write_band_decoder(const GFXfont *font, const char *string,
+                            int *cursor_x, int *cursor_y, const EpdBand *band,
+                            const FontProperties *properties,
+                            EpdGlyphDecoder *decoder) {
 
   if (*string == '\0') {
     return;
@@ -280,59 +322,87 @@ void write_mode(const GFXfont *font, const char *string, int *cursor_x,
       return;
   }
 
-  uint8_t *buffer;
-  int buf_width;
-  int buf_height;
-  int baseline_height = *cursor_y - y1;
+  uint8_t bg = props.bg_color;
+  if (props.flags & DRAW_BACKGROUND) {
+    for (int l = *cursor_y - font->ascender; l < *cursor_y - font->descender;
+         l++) {
+      epd_draw_hline_band(*cursor_x, l, w, bg << 4, band);
+    }
+  }
+  uint32_t c;
+  while ((c = next_cp((const uint8_t **)&string))) {
+    draw_char(font, band->data, cursor_x, *cursor_y, epd_width() / 2,
+              band->clip, c, &props, decoder);
+  }
+}
 
-  // The local cursor position:
-  // 0, if drawing to a local temporary buffer
-  // the given cursor position, if drawing to a full frame buffer
-  int local_cursor_x = 0;
-  int local_cursor_y = 0;
-
-  if (framebuffer == NULL) {
-    buf_width = (w / 2 + w % 2);
-    buf_height = h;
-    buffer = (uint8_t *)malloc(buf_width * buf_height);
-    memset(buffer, 255, buf_width * buf_height);
-    local_cursor_y = buf_height - baseline_height;
+void write_mode(const GFXfont *font, const char *string, int *cursor_x,
+                int *cursor_y, uint8_t *framebuffer, enum DrawMode mode,
+                const FontProperties *properties) {
+
+  if (framebuffer != NULL) {
+    EpdBand band = {.data = framebuffer, .clip = epd_full_screen()};
+    write_band(font, string, cursor_x, cursor_y, &band, properties);
+    return;
+  }
+
+  if (*string == '\0') {
+    return;
+  }
+
+  FontProperties props;
+  if (properties == NULL) {
+    props = font_properties_default();
   } else {
-    buf_width = EPD_WIDTH / 2;
-    buf_height = EPD_HEIGHT;
-    buffer = framebuffer;
-    local_cursor_x = *cursor_x;
-    local_cursor_y = *cursor_y;
+    props = *properties;
   }
 
-  uint32_t c;
+  int x1 = 0, y1 = 0, w = 0, h = 0;
+  int tmp_cur_x = *cursor_x;
+  int tmp_cur_y = *cursor_y;
+  get_text_bounds(font, string, &tmp_cur_x, &tmp_cur_y, &x1, &y1, &w, &h,
+                  &props);
+
+  // no printable characters
+  if (w < 0 || h < 0) {
+      return;
+  }
 
-  int cursor_x_init = local_cursor_x;
-  int cursor_y_init = local_cursor_y;
+  // draw to a local temporary buffer, with the cursor at its left edge.
+  int buf_width = (w / 2 + w % 2);
+  int buf_height = h;
+  int baseline_height = *cursor_y - y1;
+  uint8_t *buffer = (uint8_t *)malloc(buf_width * buf_height);
+  memset(buffer, 255, buf_width * buf_height);
+  int local_cursor_x = 0;
+  int local_cursor_y = buf_height - baseline_height;
+  Rect_t clip = {.x = 0, .y = 0, .width = buf_width * 2, .height = buf_height};
 
   uint8_t bg = props.bg_color;
   if (props.flags & DRAW_BACKGROUND) {
-    for (int l = local_cursor_y - font->ascender;
-         l < local_cursor_y - font->descender; l++) {
-      epd_draw_hline(local_cursor_x, l, w, bg << 4, buffer);
+    // the background spans the whole buffer width.
+    int top = max(local_cursor_y - font->ascender, 0);
+    int bottom = min(local_cursor_y - font->descender, buf_height);
+    for (int l = top; l < bottom; l++) {
+      memset(&buffer[l * buf_width], bg | bg << 4, buf_width);
     }
   }
+  EpdGlyphDecoder decoder = {0};
+  uint32_t c;
   while ((c = next_cp((const uint8_t **)&string))) {
-    draw_char(font, buffer, &local_cursor_x, local_cursor_y, buf_width,
-              buf_height, c, &props);
+    draw_char(font, buffer, &local_cursor_x, local_cursor_y, buf_width, clip,
+              c, &props, &decoder);
   }
+  epd_glyph_decoder_free(&decoder);
 
-  *cursor_x += local_cursor_x - cursor_x_init;
-  *cursor_y += local_cursor_y - cursor_y_init;
+  *cursor_x += local_cursor_x;
 
-  if (framebuffer == NULL) {
-    Rect_t area = {
-        .x = x1, .y = *cursor_y - h + baseline_height, .width = w, .height = h};
+  Rect_t area = {
+      .x = x1, .y = *cursor_y - h + baseline_height, .width = w, .height = h};
 
-    epd_draw_image(area, buffer, mode);
+  epd_draw_image(area, buffer, mode);
 
-    free(buffer);
-  }
+  free(buffer);
 }
 
 void writeln(const GFXfont *font, const char *string, int *cursor_x,
@@ -1,25 +1,29 @@
 #include "i2s_data_bus.h"
 #include "driver/periph_ctrl.h"
 #include "esp32/rom/lldesc.h"
+#include "epd_trace.h"
 #include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
 #include "soc/i2s_reg.h"
 #include "soc/i2s_struct.h"
 #include "soc/rtc.h"
+#include "xtensa/core-macros.h"
+#include <assert.h>
 
-/// DMA descriptors for front and back line buffer.
-/// We use two buffers, so one can be filled while the other
-/// is transmitted.
+/// DMA descriptors and line buffers.
+/// The buffers form a ring, so several rows can be prepared
+/// while another one is transmitted.
 typedef struct {
-  volatile lldesc_t *dma_desc_a;
-  volatile lldesc_t *dma_desc_b;
+  volatile lldesc_t *dma_desc[I2S_LINE_BUFFERS];
 
-  /// Front and back line buffer.
-  uint8_t *buf_a;
-  uint8_t *buf_b;
+  /// Line buffers, one per descriptor.
+  uint8_t *buf[I2S_LINE_BUFFERS];
 } i2s_parallel_state_t;
 
-/// Indicates which line buffer is currently back / front.
-static int current_buffer = 0;
+_Static_assert((I2S_LINE_BUFFERS & (I2S_LINE_BUFFERS - 1)) == 0,
+               "the number of line buffers must be a power of two");
 
 /// The I2S state instance.
 static i2s_parallel_state_t i2s_state;
@@ -28,9 +32,19 @@ static intr_handle_t gI2S_intr_handle = NULL;
 
 /// Indicates the device has finished its transmission and is ready again.
 static volatile bool output_done = true;
+/// Given by the "done" interrupt, so waiting tasks can block instead of
+/// spinning.
+static SemaphoreHandle_t output_done_smphr;
+/// CPU cycle count at the start of the current transmission.
+static uint32_t output_start_ccount;
+/// Duration of the last transmission in CPU cycles,
+/// used to estimate the remaining time of the current one.
+static volatile uint32_t output_cycles = 0;
 /// The start pulse pin extracted from the configuration for use in the "done"
 /// interrupt.
 static gpio_num_t start_pulse_pin;
+/// Called from the "done" interrupt, see `i2s_bus_config`.
+static void (*output_done_cb)(void);
 
 /// Initializes a DMA descriptor.
 static void fill_dma_desc(volatile lldesc_t *dmadesc, uint8_t *buf,
@@ -45,12 +59,10 @@ static void fill_dma_desc(volatile lldesc_t *dmadesc, uint8_t *buf,
   dmadesc->offset = 0;
 }
 
-/// Address of the currently front DMA descriptor,
+/// Address of a DMA descriptor,
 /// which uses only the lower 20bits (according to TRM)
-uint32_t dma_desc_addr() {
-  return (uint32_t)(current_buffer ? i2s_state.dma_desc_a
-                                   : i2s_state.dma_desc_b) &
-         0x000FFFFF;
+static uint32_t IRAM_ATTR dma_desc_addr(int index) {
+  return (uint32_t)i2s_state.dma_desc[index] & 0x000FFFFF;
 }
 
 /// Set up a GPIO as output and route it to a signal.
@@ -64,17 +76,29 @@ static void gpio_setup_out(int gpio, int sig, bool invert) {
 
 /// Resets "Start Pulse" signal when the current row output is done.
 static void IRAM_ATTR i2s_int_hdl(void *arg) {
+  EPD_TRACE_BEGIN(EPD_TRACE_I2S_ISR);
   i2s_dev_t *dev = &I2S1;
-  if (dev->int_st.out_done) {
+  BaseType_t task_awoken = pdFALSE;
+  bool done = dev->int_st.out_done;
+  if (done) {
     gpio_set_level(start_pulse_pin, 1);
     output_done = true;
+    output_cycles = XTHAL_GET_CCOUNT() - output_start_ccount;
+    xSemaphoreGiveFromISR(output_done_smphr, &task_awoken);
   }
   // Clear the interrupt. Otherwise, the whole device would hang.
   dev->int_clr.val = dev->int_raw.val;
+  if (done && output_done_cb != NULL) {
+    output_done_cb();
+  }
+  EPD_TRACE_END(EPD_TRACE_I2S_ISR);
+  if (task_awoken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
 }
 
-volatile uint8_t IRAM_ATTR *i2s_get_current_buffer() {
-  return current_buffer ? i2s_state.dma_desc_a->buf : i2s_state.dma_desc_b->buf;
+volatile uint8_t IRAM_ATTR *i2s_get_buffer(int index) {
+  return i2s_state.buf[index];
 }
 
 bool IRAM_ATTR i2s_is_busy() {
@@ -82,15 +106,27 @@ bool IRAM_ATTR i2s_is_busy() {
   return !output_done || !I2S1.state.tx_idle;
 }
 
-void IRAM_ATTR i2s_switch_buffer() {
-  // either device is done transmitting or the switch must be away from the
-  // buffer currently used by the DMA engine.
-  while (i2s_is_busy() && dma_desc_addr() != I2S1.out_link.addr) {
+bool IRAM_ATTR i2s_is_draining() {
+  return output_done && !I2S1.state.tx_idle;
+}
+
+void IRAM_ATTR i2s_wait_idle() {
+  int32_t remaining_us =
+      (int32_t)(output_start_ccount + output_cycles - XTHAL_GET_CCOUNT()) /
+      CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+  if (!output_done && remaining_us > CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US) {
+    // drop a stale signal from a previous transmission
+    xSemaphoreTake(output_done_smphr, 0);
+    while (!output_done) {
+      xSemaphoreTake(output_done_smphr, portMAX_DELAY);
+    }
+  }
+  // the FIFO may still be draining after the DMA is done
+  while (i2s_is_busy()) {
   };
-  current_buffer = !current_buffer;
 }
 
-void IRAM_ATTR i2s_start_line_output() {
+void IRAM_ATTR i2s_start_line_output(int index) {
   output_done = false;
 
   i2s_dev_t *dev = &I2S1;
@@ -101,11 +137,12 @@ void IRAM_ATTR i2s_start_line_output() {
   dev->conf.tx_reset = 0;
   dev->conf.tx_fifo_reset = 0;
   dev->conf.rx_fifo_reset = 0;
-  dev->out_link.addr = dma_desc_addr();
+  dev->out_link.addr = dma_desc_addr(index);
   dev->out_link.start = 1;
 
   // sth is pulled up through peripheral interrupt
   gpio_set_level(start_pulse_pin, 0);
+  output_start_ccount = XTHAL_GET_CCOUNT();
   dev->conf.tx_start = 1;
 }
 
@@ -119,6 +156,7 @@ void i2s_bus_init(i2s_bus_config *cfg) {
   gpio_set_level(cfg->start_pulse, 1);
   // store pin in global variable for use in interrupt.
   start_pulse_pin = cfg->start_pulse;
+  output_done_cb = cfg->done_cb;
 
   // Use I2S1 with no signal offset (for some reason the offset seems to be
   // needed in 16-bit mode, but not in 8 bit mode.
@@ -162,13 +200,14 @@ void i2s_bus_init(i2s_bus_config *cfg) {
   // (Smallest possible divider according to the spec).
   dev->sample_rate_conf.tx_bck_div_num = 2;
 
-#if defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4_LQ)
-  // Initialize Audio Clock (APLL) for 120 Mhz.
-  rtc_clk_apll_enable(1, 0, 0, 8, 0);
-#else
-  // Initialize Audio Clock (APLL) for 60 Mhz.
-  rtc_clk_apll_enable(1, 0, 0, 5, 1);
-#endif
+  assert(cfg->clock_mhz == 60 || cfg->clock_mhz == 120);
+  if (cfg->clock_mhz == 120) {
+    // Initialize Audio Clock (APLL) for 120 Mhz.
+    rtc_clk_apll_enable(1, 0, 0, 8, 0);
+  } else {
+    // Initialize Audio Clock (APLL) for 60 Mhz.
+    rtc_clk_apll_enable(1, 0, 0, 5, 1);
+  }
 
   // Set Audio Clock Dividers
   dev->clkm_conf.val = 0;
@@ -197,15 +236,16 @@ void i2s_bus_init(i2s_bus_config *cfg) {
 
   dev->timing.val = 0;
 
-  // Allocate DMA descriptors
-  i2s_state.buf_a = heap_caps_malloc(cfg->epd_row_width / 4, MALLOC_CAP_DMA);
-  i2s_state.buf_b = heap_caps_malloc(cfg->epd_row_width / 4, MALLOC_CAP_DMA);
-  i2s_state.dma_desc_a = heap_caps_malloc(sizeof(lldesc_t), MALLOC_CAP_DMA);
-  i2s_state.dma_desc_b = heap_caps_malloc(sizeof(lldesc_t), MALLOC_CAP_DMA);
+  // Allocate DMA descriptors and fill them
+  for (int i = 0; i < I2S_LINE_BUFFERS; i++) {
+    i2s_state.buf[i] =
+        heap_caps_calloc(1, cfg->epd_row_width / 4, MALLOC_CAP_DMA);
+    i2s_state.dma_desc[i] = heap_caps_malloc(sizeof(lldesc_t), MALLOC_CAP_DMA);
+    assert(i2s_state.buf[i] != NULL && i2s_state.dma_desc[i] != NULL);
+    fill_dma_desc(i2s_state.dma_desc[i], i2s_state.buf[i], cfg);
+  }
 
-  // and fill them
-  fill_dma_desc(i2s_state.dma_desc_a, i2s_state.buf_a, cfg);
-  fill_dma_desc(i2s_state.dma_desc_b, i2s_state.buf_b, cfg);
+  output_done_smphr = xSemaphoreCreateBinary();
 
   // enable "done" interrupt
   SET_PERI_REG_BITS(I2S_INT_ENA_REG(1), I2S_OUT_DONE_INT_ENA_V, 1,
@@ -232,7 +272,7 @@ void i2s_bus_init(i2s_bus_config *cfg) {
   // Start dma on front buffer
   dev->lc_conf.val =
       I2S_OUT_DATA_BURST_EN | I2S_OUTDSCR_BURST_EN | I2S_OUT_DATA_BURST_EN;
-  dev->out_link.addr = ((uint32_t)(i2s_state.dma_desc_a));
+  dev->out_link.addr = ((uint32_t)(i2s_state.dma_desc[0]));
   dev->out_link.start = 1;
 
   dev->int_clr.val = dev->int_raw.val;
@@ -245,11 +285,12 @@ void i2s_bus_init(i2s_bus_config *cfg) {
 
 void i2s_deinit() {
   esp_intr_free(gI2S_intr_handle);
+  vSemaphoreDelete(output_done_smphr);
 
-  free(i2s_state.buf_a);
-  free(i2s_state.buf_b);
-  free((void *)i2s_state.dma_desc_a);
-  free((void *)i2s_state.dma_desc_b);
+  for (int i = 0; i < I2S_LINE_BUFFERS; i++) {
+    free(i2s_state.buf[i]);
+    free((void *)i2s_state.dma_desc[i]);
+  }
 
   rtc_clk_apll_enable(0, 0, 0, 8, 0);
   periph_module_disable(PERIPH_I2S1_MODULE);
@@ -7,8 +7,12 @@
 
 #include "driver/gpio.h"
 #include "esp_attr.h"
+#include "sdkconfig.h"
 #include <stdint.h>
 
+/// Number of line buffers in the DMA ring.
+#define I2S_LINE_BUFFERS CONFIG_EPD_ROW_BUFFERS
+
 /**
  * I2S bus configuration parameters.
  */
@@ -31,6 +35,14 @@ typedef struct {
 
   // Width of a display row in pixels.
   uint32_t epd_row_width;
+
+  /// Pixel clock in MHz. Supported: 60, 120.
+  uint32_t clock_mhz;
+
+  /// Called from the interrupt handler when the DMA transfer is done.
+  /// The FIFO may still be draining, see `i2s_is_draining`.
+  /// Must be placed in IRAM. May be NULL.
+  void (*done_cb)(void);
 } i2s_bus_config;
 
 /**
@@ -40,26 +52,35 @@ typedef struct {
 void i2s_bus_init(i2s_bus_config *cfg);
 
 /**
- * Get the currently writable line buffer.
+ * Get the line buffer with the given index in the ring.
+ * The caller is responsible for not writing to a buffer
+ * which is currently transmitted.
+ */
+volatile uint8_t IRAM_ATTR *i2s_get_buffer(int index);
+
+/**
+ * Start transmission of the line buffer with the given index.
+ * Can be called from an interrupt handler.
  */
-volatile uint8_t IRAM_ATTR *i2s_get_current_buffer();
+void IRAM_ATTR i2s_start_line_output(int index);
 
 /**
- * Switches front and back line buffer.
- * If the switched-to line buffer is currently in use,
- * this function blocks until transmission is done.
+ * Returns true if there is an ongoing transmission.
  */
-void IRAM_ATTR i2s_switch_buffer();
+bool IRAM_ATTR i2s_is_busy();
 
 /**
- * Start transmission of the current back buffer.
+ * Returns true if the DMA transfer is done, but the FIFO is still
+ * being sent out.
  */
-void IRAM_ATTR i2s_start_line_output();
+bool IRAM_ATTR i2s_is_draining();
 
 /**
- * Returns true if there is an ongoing transmission.
+ * Wait until the ongoing transmission is done.
+ * Long waits block the calling task until the "done" interrupt fires,
+ * short waits are busy-waited.
  */
-bool IRAM_ATTR i2s_is_busy();
+void IRAM_ATTR i2s_wait_idle();
 
 /**
  * Give up allocated resources.
@@ -0,0 +1,55 @@
+/**
+ * Backend interface for the display bus.
+ *
+ * The drawing pipeline only talks to the display through these operations,
+ * so it can run against the ESP32 I2S/RMT peripherals or a software model.
+ */
+
+#pragma once
+
+#include "epd_driver.h"
+#include <stdint.h>
+
+/// Operations of a display bus backend.
+typedef struct {
+  /// Human-readable backend name.
+  const char *name;
+  /// Set up the bus for the given display.
+  void (*init)(const EpdDisplay *display);
+  /// Release the bus resources. The display is powered off.
+  void (*deinit)();
+  /// Switch on the display power supply.
+  void (*poweron)();
+  /// Switch off the display power supply.
+  void (*poweroff)();
+  /// Start a draw cycle.
+  void (*start_frame)();
+  /// End a draw cycle, after all queued rows are output.
+  void (*end_frame)();
+  /**
+   * Latch the previously transmitted row, pulse the gate driver for
+   * `output_time_dus` / 10 microseconds and transmit the current line buffer.
+   */
+  void (*output_row)(uint32_t output_time_dus);
+  /// Advance the gate driver by one row without writing to it.
+  void (*skip)();
+  /**
+   * Get the currently writable line buffer of `width / 4` bytes.
+   * Its contents are undefined and must be written completely.
+   */
+  uint8_t *(*get_current_buffer)();
+} EpdBusBackend;
+
+/// The I2S / RMT backend driving a physical display.
+extern const EpdBusBackend epd_bus_esp32;
+
+/**
+ * Select the bus backend used by the driver, e.g. a custom backend for
+ * other display hardware. Must be called before `epd_init`.
+ */
+void epd_set_bus_backend(const EpdBusBackend *backend);
+
+/**
+ * The currently selected bus backend.
+ */
+const EpdBusBackend *epd_bus();
@@ -7,6 +7,7 @@ extern "C" {
 
 #pragma once
 #include "esp_attr.h"
+#include "esp_err.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -19,9 +20,11 @@ extern "C" {
 #if defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4) ||                               \
     defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2) ||                               \
     defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4_LQ)
-/// Width of the display area in pixels.
+/// Width of the default display area in pixels.
+/// Use `epd_width()` if the display is selected at runtime.
 #define EPD_WIDTH 1200
-/// Height of the display area in pixels.
+/// Height of the default display area in pixels.
+/// Use `epd_height()` if the display is selected at runtime.
 #define EPD_HEIGHT 825
 #elif defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
 #define EPD_WIDTH 1600
@@ -40,6 +43,43 @@ extern "C" {
 #error "no display type defined!"
 #endif
 
+/// Description of a display type: resolution, waveform and timing.
+typedef struct {
+  /// Panel type, e.g. "ED097OC4". Stored calibrations are only loaded
+  /// for the panel type they were saved for, see `epd_load_calibration`.
+  const char *name;
+  /// Width of the display area in pixels. Must be a multiple of 16.
+  int width;
+  /// Height of the display area in pixels.
+  int height;
+  /// 4bpp contrast cycles in order of contrast (Darkest first),
+  /// for `BLACK_ON_WHITE` and `WHITE_ON_WHITE`. 15 entries.
+  const int *contrast_cycles_4;
+  /// 4bpp contrast cycles for `WHITE_ON_BLACK`. 15 entries.
+  const int *contrast_cycles_4_white;
+  /// Cycle time used by `epd_clear_area`.
+  int clear_cycle_time;
+  /// Gate clock (CKV) high time for a skipped row, in 0.1us.
+  uint16_t skip_ckv_high;
+  /// Gate clock (CKV) low time for a skipped row, in 0.1us.
+  uint16_t skip_ckv_low;
+  /// Gate clock (CKV) low time after an output row, in 0.1us.
+  uint16_t row_ckv_low;
+  /// Pixel bus clock in MHz. Supported: 60, 120.
+  int bus_clock_mhz;
+  /// Gray level (0 - 15) each 4bpp pixel value is drawn with, to linearize
+  /// the gray levels of the panel. 16 entries. NULL draws values as they are.
+  const uint8_t *gray_map;
+} EpdDisplay;
+
+/// Built-in display descriptions.
+extern const EpdDisplay epd_display_ed097oc4;
+extern const EpdDisplay epd_display_ed097oc4_lq;
+extern const EpdDisplay epd_display_ed097tc2;
+extern const EpdDisplay epd_display_ed060sc4;
+extern const EpdDisplay epd_display_ed047tc1;
+extern const EpdDisplay epd_display_ed133ut2;
+
 /// An area on the display.
 typedef struct {
   /// Horizontal position.
@@ -83,18 +123,359 @@ typedef struct {
   uint32_t flags;
 } FontProperties;
 
-/** Initialize the ePaper display */
+/**
+ * The display selected in the configuration (`menuconfig`).
+ */
+const EpdDisplay *epd_default_display();
+
+/** Initialize the ePaper display selected in the configuration. */
 void epd_init();
 
-/** Deinit the ePaper display */
+/**
+ * Initialize the ePaper driver for a display selected at runtime.
+ * Buffers are allocated for the size of this display.
+ * To switch displays, call `epd_deinit()` first.
+ *
+ * @param display: The display description. Must stay valid until
+ *   `epd_deinit()`, e.g. one of the built-in `epd_display_*`.
+ */
+void epd_init_display(const EpdDisplay *display);
+
+/// Placement of the drawing pipeline tasks.
+typedef struct {
+  /// Core of the row producer task (`epd_out`), -1 for no affinity.
+  int producer_core;
+  /// Priority of the row producer task.
+  int producer_priority;
+  /// Stack size of the row producer task in bytes.
+  uint32_t producer_stack_size;
+  /// Core of the row output task (`epd_render`), -1 for no affinity.
+  int consumer_core;
+  /// Priority of the row output task.
+  int consumer_priority;
+  /// Stack size of the row output task in bytes.
+  uint32_t consumer_stack_size;
+  /// Read and output rows interleaved in the output task only.
+  /// No producer task is created, which leaves its core to other tasks
+  /// at the cost of slower grayscale draws.
+  bool single_task;
+} EpdTaskConfig;
+
+/**
+ * The task placement selected in the configuration (`menuconfig`).
+ */
+EpdTaskConfig epd_default_task_config();
+
+/**
+ * Initialize the ePaper driver for a display, with a custom placement
+ * of the drawing pipeline tasks.
+ *
+ * @param display: The display description, see `epd_init_display`.
+ * @param tasks: The task placement. NULL uses `epd_default_task_config()`.
+ */
+void epd_init_display_tasks(const EpdDisplay *display,
+                            const EpdTaskConfig *tasks);
+
+/** The initialized display, NULL before `epd_init`. */
+const EpdDisplay *epd_current_display();
+
+/**
+ * Width of the initialized display in pixels.
+ * Before `epd_init`, the width of the configured display, which the
+ * framebuffer drawing functions use then.
+ */
+int epd_width();
+
+/** Height of the initialized display in pixels, see `epd_width()`. */
+int epd_height();
+
+/**
+ * Set the gray level each 4bpp pixel value is drawn with, for example
+ * from calibration data. The map is applied when building the per-frame
+ * conversion tables, so it costs nothing per pixel.
+ * It takes effect after the draws already queued.
+ *
+ * @param map: 16 gray levels from 0 (black) to 15 (white), indexed by
+ *   pixel value. NULL restores the `gray_map` of the display.
+ * @returns false if the map contains invalid levels.
+ */
+bool epd_set_gray_map(const uint8_t *map);
+
+/**
+ * Replace the 4bpp contrast cycles (waveform) of the display at runtime,
+ * for example with timings from `epd_load_calibration`.
+ * It takes effect after the draws already queued.
+ *
+ * @param cycles: 15 gate times in 0.1us for `BLACK_ON_WHITE` and
+ *   `WHITE_ON_WHITE`, darkest first. NULL restores the display's cycles.
+ * @param white_cycles: 15 gate times for `WHITE_ON_BLACK`.
+ *   NULL restores the display's cycles.
+ * @returns false if a table contains invalid times.
+ */
+bool epd_set_contrast_cycles(const int *cycles, const int *white_cycles);
+
+/**
+ * Copy the active contrast cycles, 15 entries each.
+ */
+void epd_get_contrast_cycles(int *cycles, int *white_cycles);
+
+/// Waveform calibration of a panel, as stored by `epd_save_calibration`.
+typedef struct {
+  /// Contrast cycles for `BLACK_ON_WHITE` and `WHITE_ON_WHITE`.
+  int contrast_cycles_4[15];
+  /// Contrast cycles for `WHITE_ON_BLACK`.
+  int contrast_cycles_4_white[15];
+  /// Gray level each pixel value is drawn with.
+  uint8_t gray_map[16];
+} EpdCalibration;
+
+/**
+ * Store a calibration in NVS, so it survives reflashing the application.
+ * It is tagged with the name and resolution of the initialized display.
+ * The NVS partition must be initialized with `nvs_flash_init()`.
+ */
+esp_err_t epd_save_calibration(const EpdCalibration *calibration);
+
+/**
+ * Read the stored calibration.
+ *
+ * @returns ESP_ERR_NVS_NOT_FOUND if there is none,
+ *   ESP_ERR_INVALID_VERSION if it was made for a different display type
+ *   or by an older driver version.
+ */
+esp_err_t epd_load_calibration(EpdCalibration *calibration);
+
+/**
+ * Remove the stored calibration.
+ */
+esp_err_t epd_erase_calibration();
+
+/**
+ * Use the waveform and gray map of a calibration for the following draws.
+ *
+ * @returns false if the calibration contains invalid values.
+ */
+bool epd_apply_calibration(const EpdCalibration *calibration);
+
+/**
+ * Deinit the ePaper display.
+ * Queued draws are finished, then the pipeline tasks are deleted and
+ * the driver's buffers are freed. No draws may be started meanwhile.
+ * Afterwards, the driver can be initialized again, e.g. for another display.
+ */
 void epd_deinit();
 
-/** Enable display power supply. */
+/// Statistics of the display power supply.
+typedef struct {
+  /// The display is currently powered.
+  bool powered;
+  /// Number of currently open power sessions.
+  uint32_t sessions;
+  /// Number of times the display was powered on.
+  uint32_t power_on_count;
+  /// Total time the display was powered, in microseconds.
+  uint64_t on_time_us;
+} EpdPowerStats;
+
+/**
+ * Enable display power supply.
+ *
+ * This opens a power session, which is closed by `epd_poweroff()`.
+ * Drawing functions always open their own session, so calling this is
+ * only needed to keep the display powered between draws.
+ * If the display was not powered, this returns after the supply has
+ * settled, see `CONFIG_EPD_POWER_SETTLE_MS`. Draws wait the same way.
+ */
 void epd_poweron();
 
-/** Disable display power supply. */
+/**
+ * Disable display power supply after the hold-off time,
+ * unless a draw or another power session is still ongoing.
+ */
 void epd_poweroff();
 
+/**
+ * Set the time the display stays powered after the last draw,
+ * so bursts of updates share a single power-up.
+ *
+ * @param ms: Hold-off time in milliseconds. 0 powers off immediately.
+ *   Default: `CONFIG_EPD_POWER_HOLD_OFF_MS`.
+ */
+void epd_set_power_hold_off(uint32_t ms);
+
+/**
+ * Get power-on count and total on-time of the display.
+ */
+void epd_get_power_stats(EpdPowerStats *stats);
+
+/// Timing and pipeline statistics of draw operations.
+/// Times are in microseconds, summed over all draws since the last reset.
+typedef struct {
+  /// Number of draw operations.
+  uint32_t draws;
+  /// Number of queued draw operations merged into another one.
+  uint32_t draws_merged;
+  /// Number of frames (passes over the display) output.
+  uint32_t frames;
+  /// Total time spent in draw operations.
+  uint64_t draw_time_us;
+  /// Duration of the last draw operation.
+  uint32_t last_draw_time_us;
+  /// Total time spent outputting frames.
+  uint64_t frame_time_us;
+  /// Duration of the longest frame.
+  uint32_t max_frame_time_us;
+  /// Time the row producer (reading and cropping image rows) was busy,
+  /// excluding waits for space in the row queue.
+  uint64_t producer_busy_us;
+  /// Time the row consumer (converting and outputting rows) was busy,
+  /// excluding waits for rows from the producer.
+  uint64_t consumer_busy_us;
+  /// Number of times the consumer had to wait for the producer.
+  uint32_t queue_starved;
+  /// Number of times the producer had to wait for the consumer.
+  uint32_t queue_full;
+  /// Number of rows written to the display.
+  uint32_t rows_driven;
+  /// Number of rows skipped.
+  uint32_t rows_skipped;
+  /// Time spent building the pixel conversion lookup table.
+  uint64_t lut_time_us;
+  /// Time spent reading images from their source memory, in prefetched
+  /// blocks or row by row, see `CONFIG_EPD_PREFETCH_ROWS`.
+  uint64_t row_read_us;
+  /// Number of image bytes read from their source memory.
+  uint64_t row_read_bytes;
+  /// Time spent rasterizing display list bands, see `epd_draw_display_list`.
+  uint64_t raster_us;
+  /// Number of display list bands rasterized.
+  uint32_t bands_rasterized;
+  /// Time spent waiting for particles to settle between frames,
+  /// see `MINIMUM_FRAME_TIME`.
+  uint64_t frame_delay_us;
+} EpdDrawStats;
+
+/**
+ * Get the draw statistics collected since the last reset.
+ */
+void epd_get_stats(EpdDrawStats *stats);
+
+/**
+ * Reset the draw statistics.
+ */
+void epd_reset_stats();
+
+/// Ghosting state of the display. Partial updates are counted per tile
+/// of `CONFIG_EPD_GHOSTING_TILE_SIZE` pixels, until the tile is cleared.
+typedef struct {
+  /// Tile edge length in pixels.
+  int tile_size;
+  /// Number of tile columns.
+  int columns;
+  /// Number of tile rows.
+  int rows;
+  /// Number of tiles past a ghosting threshold, waiting for a refresh.
+  uint32_t pending_tiles;
+  /// Bounding area of the pending tiles, empty if there are none.
+  Rect_t pending_area;
+  /// Number of tiles refreshed by clears since initialization.
+  uint32_t refreshed_tiles;
+} EpdGhostingStatus;
+
+/**
+ * Set the ghosting thresholds, after which a tile waits for a refresh.
+ *
+ * Tiles waiting for a refresh are cleaned automatically right before a
+ * `BLACK_ON_WHITE` image without line mask is drawn over them,
+ * or by the idle refresh, see `epd_set_idle_refresh`.
+ * Clearing an area resets the tiles it fully covers.
+ *
+ * @param updates: Number of draws to a tile. 0 disables the threshold.
+ *   Default: `CONFIG_EPD_GHOSTING_MAX_UPDATES`.
+ * @param energy: Summed gate pulse time of the frames drawn to a tile,
+ *   in 0.1us. 0 disables the threshold.
+ *   Default: `CONFIG_EPD_GHOSTING_MAX_ENERGY`.
+ */
+void epd_set_ghosting_thresholds(uint32_t updates, uint32_t energy);
+
+/// Redraws the content of an area after it was cleared.
+typedef void (*EpdRedrawCallback)(Rect_t area, void *ctx);
+
+/**
+ * Refresh the tiles waiting for a refresh after a time without draws.
+ * Their bounding area is cleared, then `redraw` is called to draw the
+ * content of the area again. Both run on the driver's `epd_idle` task,
+ * see `CONFIG_EPD_IDLE_REFRESH_STACK_SIZE`.
+ *
+ * @param ms: Idle time in milliseconds. 0 disables the idle refresh.
+ * @param redraw: Redraws a cleared area. NULL disables the idle refresh.
+ * @param ctx: Passed to `redraw`.
+ */
+void epd_set_idle_refresh(uint32_t ms, EpdRedrawCallback redraw, void *ctx);
+
+/**
+ * Get the ghosting state of the display.
+ * Before `epd_init` and after `epd_deinit` the status is empty.
+ */
+void epd_get_ghosting_status(EpdGhostingStatus *status);
+
+/// Type of draw operation, for `epd_estimate_draw_time`.
+enum EpdDrawType {
+  /// `epd_draw_image` / `epd_draw_image_lines`.
+  EPD_DRAW_IMAGE,
+  /// `epd_draw_frame_1bit` / `epd_draw_frame_1bit_lines`.
+  EPD_DRAW_FRAME_1BIT,
+  /// `epd_clear_area_cycles`.
+  EPD_DRAW_CLEAR,
+};
+
+/// Parameters of a draw operation, for `epd_estimate_draw_time`.
+typedef struct {
+  enum EpdDrawType type;
+  /// The `time` of a 1bpp frame or the `cycle_time` of a clear.
+  int time;
+  /// The number of clear cycles.
+  int cycles;
+  /// Drawn lines of the area, see `epd_draw_image_lines`. May be NULL.
+  const bool *drawn_lines;
+} EpdDrawOptions;
+
+/**
+ * Estimate how long a draw operation will take, in microseconds.
+ *
+ * The estimate is based on the waveform and timings of the display,
+ * the number of drawn and skipped rows and the per-row overhead measured
+ * in previous draws, so it becomes more accurate after a few draws.
+ *
+ * @param area: The area to draw.
+ * @param mode: The draw mode, selecting the waveform for images.
+ * @param options: The kind of draw operation. NULL estimates `epd_draw_image`.
+ */
+uint32_t epd_estimate_draw_time(Rect_t area, enum DrawMode mode,
+                                const EpdDrawOptions *options);
+
+/**
+ * Print the recorded pipeline trace to the console.
+ * Convert it with `scripts/epd_trace_to_chrome.py` for viewing
+ * in chrome://tracing. Requires `CONFIG_EPD_TRACE`.
+ */
+void epd_trace_dump();
+
+/**
+ * Discard the recorded pipeline trace.
+ */
+void epd_trace_clear();
+
+/*
+ * The clear and draw functions below may be called from any task.
+ * Draws submitted concurrently are queued and run one after another,
+ * each call returns when its own draw is done. Clears covered by a
+ * queued clear with the same parameters, gray map and waveform changes
+ * replaced by a later one, and repeated clearing compositions of the
+ * same area are only run once. Pushes and draws add up on the panel and
+ * always run. See `CONFIG_EPD_DRAW_QUEUE_LENGTH`.
+ */
+
 /** Clear the whole screen by flashing it. */
 void epd_clear();
 
@@ -114,6 +495,32 @@ void epd_clear_area(Rect_t area);
  */
 void epd_clear_area_cycles(Rect_t area, int cycles, int cycle_time);
 
+/**
+ * Clear an area before drawing new content, with an effort depending
+ * on the old content. The area is cleared in bands of rows:
+ * Bands where the old and new content are equal are left as they are,
+ * already white bands are not cleared, and the number and length of
+ * the clear cycles of the other bands depend on the amount of ink
+ * in the old content.
+ *
+ * Afterwards, the new content should be drawn with `BLACK_ON_WHITE`
+ * and `drawn_lines`, for example:
+ *
+ *     bool lines[EPD_HEIGHT];
+ *     epd_clear_area_adaptive(epd_full_screen(), front, back, lines);
+ *     epd_draw_image_lines(epd_full_screen(), back, BLACK_ON_WHITE, lines);
+ *
+ * @param area: The area to clear.
+ * @param old_framebuffer: Framebuffer with the displayed content.
+ * @param new_framebuffer: Framebuffer with the content to draw next.
+ *   NULL if the area should be white afterwards.
+ * @param drawn_lines: If not NULL, an array of at least the height of the
+ *   area, which is set to whether a line must be drawn for the new content.
+ */
+void epd_clear_area_adaptive(Rect_t area, const uint8_t *old_framebuffer,
+                             const uint8_t *new_framebuffer,
+                             bool *drawn_lines);
+
 /**
  * Darken / lighten an area for a given time.
  *
@@ -168,6 +575,22 @@ void IRAM_ATTR epd_draw_image_lines(Rect_t area, const uint8_t *data,
                                     enum DrawMode mode,
                                     const bool *drawn_lines);
 
+/**
+ * Same as epd_draw_image, but shows a black and white preview first.
+ *
+ * The dark half of the gray levels is driven through the 1bpp path in
+ * two frames, so the content shows up quickly, then the image is refined
+ * to full grayscale. Preview pixels are never darker than their final
+ * gray level. Only `BLACK_ON_WHITE` draws a preview, other modes
+ * are drawn like with `epd_draw_image`.
+ *
+ * @param area: The display area to draw to, see `epd_draw_image`.
+ * @param data: The image data, see `epd_draw_image`.
+ * @param mode: Configure image color and assumptions of the display state.
+ */
+void epd_draw_image_progressive(Rect_t area, const uint8_t *data,
+                                enum DrawMode mode);
+
 void IRAM_ATTR epd_draw_frame_1bit(Rect_t area, const uint8_t *ptr,
                                    enum DrawMode mode, int time);
 
@@ -175,11 +598,255 @@ void IRAM_ATTR epd_draw_frame_1bit_lines(Rect_t area, const uint8_t *ptr,
                                          enum DrawMode mode, int time,
                                          const bool *drawn_lines);
 
+/**
+ * Provides the next frame of an animation.
+ *
+ * @param frame: Buffer for the full screen 1bpp frame, `epd_width() / 8`
+ *   bytes per row. A set bit is a black pixel.
+ * @param ctx: The context of the animation.
+ * @returns false after the last frame.
+ */
+typedef bool (*EpdFrameSource)(uint8_t *frame, void *ctx);
+
+/// An animation of full screen 1bpp frames, see `epd_play_animation`.
+typedef struct {
+  /// Provides the frames. Called from a separate task.
+  EpdFrameSource source;
+  /// Passed to `source`.
+  void *ctx;
+  /// Target frame rate. 0 plays as fast as possible.
+  int fps;
+  /// Gate pulse time of a drive pass, see `epd_draw_frame_1bit`.
+  int time;
+  /// Number of drive passes per frame. Default: 1.
+  int passes;
+} EpdAnimation;
+
+/// Playback report of an animation.
+typedef struct {
+  /// Number of frames shown.
+  uint32_t frames;
+  /// Number of drive passes.
+  uint32_t passes;
+  /// Number of frames shown more than a frame period after their time.
+  uint32_t late_frames;
+  /// Achieved frame rate.
+  float fps;
+  /// Average time from a frame being provided to it being shown, in us.
+  uint32_t avg_latency_us;
+  /// Maximum time from a frame being provided to it being shown, in us.
+  uint32_t max_latency_us;
+  /// Time spent in the frame source and finding changed lines, in us.
+  uint64_t source_time_us;
+  /// Time spent driving the display, in us.
+  uint64_t drive_time_us;
+} EpdAnimationReport;
+
+/**
+ * Play an animation of full screen 1bpp frames.
+ *
+ * Only the pixels changed since the previous frame are driven,
+ * darkening new black pixels and lightening new white ones,
+ * and unchanged rows are skipped. The next frame is fetched and
+ * compared by a separate task while the current one is driven.
+ * The screen is assumed to be white when the animation starts.
+ * Returns after the last frame was shown.
+ *
+ * @param animation: The animation to play.
+ * @param report: If not NULL, set to the playback report,
+ *   which is also logged.
+ */
+void epd_play_animation(const EpdAnimation *animation,
+                        EpdAnimationReport *report);
+
+/// Frames in memory, for `epd_frame_array_source`.
+typedef struct {
+  /// Consecutive full screen 1bpp frames.
+  const uint8_t *frames;
+  /// Number of frames.
+  uint32_t count;
+  /// Index of the next frame. Start with 0.
+  uint32_t next;
+} EpdFrameArray;
+
+/**
+ * Frame source for frames in memory. `ctx` is an `EpdFrameArray`.
+ */
+bool epd_frame_array_source(uint8_t *frame, void *ctx);
+
+/**
+ * Frame source for a file of consecutive raw frames. `ctx` is a `FILE *`.
+ */
+bool epd_file_frame_source(uint8_t *frame, void *ctx);
+
+/// A full screen framebuffer pair, see `epd_double_buffer_commit`.
+typedef struct {
+  /// The displayed image. Do not modify.
+  uint8_t *front;
+  /// The image to display next, draw into this one.
+  uint8_t *back;
+  /// Changed pixels of the current commit, 1bpp.
+  uint8_t *mask;
+  /// Changed rows of the current commit.
+  bool *changed_lines;
+} EpdDoubleBuffer;
+
+/// What `epd_double_buffer_commit` did.
+typedef struct {
+  /// Number of rows with changed pixels.
+  int changed_lines;
+  /// Number of changed pixels.
+  uint32_t changed_pixels;
+  /// Changes were drawn on white, without darkening them first.
+  bool darken_only;
+  /// Bytes copied to the new back image after the swap.
+  uint32_t copied_bytes;
+} EpdCommitReport;
+
+/**
+ * Allocate a framebuffer pair in PSRAM, or in internal RAM on boards
+ * without PSRAM. Both images are white,
+ * like the display after `epd_clear()`.
+ *
+ * @returns false if there is not enough memory.
+ */
+bool epd_double_buffer_init(EpdDoubleBuffer *buffer);
+
+/**
+ * Free the buffers of a framebuffer pair.
+ */
+void epd_double_buffer_free(EpdDoubleBuffer *buffer);
+
+/**
+ * Set both images to white, after the display was cleared.
+ */
+void epd_double_buffer_reset(EpdDoubleBuffer *buffer);
+
+/**
+ * Display the back image, driving only the pixels that differ from the
+ * front image. If all changed pixels are white on the display, they are
+ * drawn with `BLACK_ON_WHITE`. Otherwise the changed pixels are darkened
+ * first and then drawn with `WHITE_ON_BLACK`. Unchanged rows are skipped.
+ *
+ * Afterwards, the buffers are swapped. The swap is not copy free: the
+ * old front image is used to stage the masked changes, so the changed
+ * rows are copied from the new front image to the new back image, making
+ * both images equal again. This copies `changed_lines * epd_width() / 2`
+ * bytes, reported as `copied_bytes`.
+ *
+ * @param report: If not NULL, set to what was drawn.
+ */
+void epd_double_buffer_commit(EpdDoubleBuffer *buffer,
+                              EpdCommitReport *report);
+
+/// How a layer is combined with the layers below it.
+enum EpdLayerBlend {
+  /// All pixels of the layer are drawn.
+  EPD_BLEND_OPAQUE,
+  /// Pixels with the value `key` are transparent.
+  EPD_BLEND_KEY,
+  /// The layer is mixed with the layers below by `alpha`.
+  EPD_BLEND_ALPHA,
+};
+
+/// A 4bpp image placed on the screen, see `EpdCompositor`.
+typedef struct {
+  /// Pixel data, `(width + 1) / 2` bytes per row, like `epd_draw_image`.
+  const uint8_t *data;
+  /// Layer width in pixels.
+  int width;
+  /// Layer height in pixels.
+  int height;
+  /// Screen position of the top left pixel. May be off screen.
+  int x;
+  int y;
+  /// How the layer is combined with the layers below it.
+  enum EpdLayerBlend blend;
+  /// Transparent pixel value for `EPD_BLEND_KEY`.
+  uint8_t key;
+  /// Opacity from 0 (invisible) to 15 (opaque) for `EPD_BLEND_ALPHA`.
+  uint8_t alpha;
+  /// Hidden layers are not drawn. Change with `epd_layer_set_hidden`.
+  bool hidden;
+} EpdLayer;
+
+/// Maximum number of layers of a compositor.
+#define EPD_MAX_LAYERS 8
+/// Maximum number of separate dirty areas, more are merged.
+#define EPD_MAX_DIRTY_RECTS 8
+
+/// A stack of layers on a white background, redrawn where they changed.
+typedef struct {
+  /// The layers, bottom first.
+  EpdLayer *layers[EPD_MAX_LAYERS];
+  int layer_count;
+  /// Screen areas to redraw with the next `epd_compositor_render`.
+  Rect_t dirty[EPD_MAX_DIRTY_RECTS];
+  int dirty_count;
+  /// Clear cycles run on a dirty area before it is redrawn, 3 after
+  /// `epd_compositor_init`. With 0, the layers are drawn on top of the
+  /// old content, which can then only get darker: Use it when the dirty
+  /// areas are white, or only gain dark pixels, like after `epd_clear`.
+  int clear_cycles;
+} EpdCompositor;
+
+/**
+ * Initialize an empty compositor.
+ */
+void epd_compositor_init(EpdCompositor *compositor);
+
+/**
+ * Put a layer on top of the stack. Its area becomes dirty.
+ * The layer must stay valid while it is part of the compositor.
+ *
+ * @returns false if the stack is full.
+ */
+bool epd_compositor_add_layer(EpdCompositor *compositor, EpdLayer *layer);
+
+/**
+ * Mark a part of a layer as changed, after modifying its pixel data,
+ * key or alpha.
+ *
+ * @param area: The changed area in layer coordinates.
+ */
+void epd_layer_changed(EpdCompositor *compositor, const EpdLayer *layer,
+                       Rect_t area);
+
+/**
+ * Move a layer on the screen. Its old and new area become dirty.
+ */
+void epd_layer_move(EpdCompositor *compositor, EpdLayer *layer, int x, int y);
+
+/**
+ * Show or hide a layer. Its area becomes dirty.
+ */
+void epd_layer_set_hidden(EpdCompositor *compositor, EpdLayer *layer,
+                          bool hidden);
+
+/**
+ * Redraw the dirty areas: Each area is cleared with the compositor's
+ * `clear_cycles` and the layers are drawn to it with `BLACK_ON_WHITE`. The layers are combined row by row while
+ * the rows are sent to the display, so no framebuffer of the composed
+ * image is needed. Afterwards, nothing is dirty.
+ */
+void epd_compositor_render(EpdCompositor *compositor);
+
 /**
  * @returns Rectancle representing the whole screen area.
  */
 Rect_t epd_full_screen();
 
+/// Rows of a framebuffer the drawing functions can be clipped to,
+/// so pictures can be drawn in parts without a full screen framebuffer.
+typedef struct {
+  /// The framebuffer rows `clip.y` to `clip.y + clip.height - 1`,
+  /// `epd_width() / 2` bytes each.
+  uint8_t *data;
+  /// The screen area held by `data`, must be on the screen.
+  /// Pixels outside of it are not drawn.
+  Rect_t clip;
+} EpdBand;
+
 /**
  * Draw a picture to a given framebuffer.
  *
@@ -189,7 +856,7 @@ Rect_t epd_full_screen();
  * values. Pixel data is packed (two pixels per byte). A byte cannot wrap over
  * multiple rows, images of uneven width must add a padding nibble per line.
  * @param framebuffer: The framebuffer object,
- *   which must be `EPD_WIDTH / 2 * EPD_HEIGHT` large.
+ *   which must be `epd_width() / 2 * epd_height()` large.
  */
 void epd_copy_to_framebuffer(Rect_t image_area, const uint8_t *image_data,
                              uint8_t *framebuffer);
@@ -212,7 +879,7 @@ void epd_draw_pixel(int x, int y, uint8_t color, uint8_t *framebuffer);
  * @param length: Length of the line in pixels.
  * @param color: The gray value of the line (0-255);
  * @param framebuffer: The framebuffer to draw to,
- *  which must be `EPD_WIDTH / 2 * EPD_HEIGHT` bytes large.
+ *  which must be `epd_width() / 2 * epd_height()` bytes large.
  */
 void epd_draw_hline(int x, int y, int length, uint8_t color,
                     uint8_t *framebuffer);
@@ -225,7 +892,7 @@ void epd_draw_hline(int x, int y, int length, uint8_t color,
  * @param length: Length of the line in pixels.
  * @param color: The gray value of the line (0-255);
  * @param framebuffer: The framebuffer to draw to,
- *  which must be `EPD_WIDTH / 2 * EPD_HEIGHT` bytes large.
+ *  which must be `epd_width() / 2 * epd_height()` bytes large.
  */
 void epd_draw_vline(int x, int y, int length, uint8_t color,
                     uint8_t *framebuffer);
@@ -336,11 +1003,60 @@ void epd_draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
  */
 void epd_fill_triangle(int x0, int y0, int x1, int y1, int x2, int y2,
                        uint8_t color, uint8_t *framebuffer);
+
+/*
+ * Variants of the drawing functions above which draw to a band.
+ * Pixels outside of `band->clip` are not drawn.
+ */
+void epd_copy_to_band(Rect_t image_area, const uint8_t *image_data,
+                      const EpdBand *band);
+void epd_draw_pixel_band(int x, int y, uint8_t color, const EpdBand *band);
+void epd_draw_hline_band(int x, int y, int length, uint8_t color,
+                         const EpdBand *band);
+void epd_draw_vline_band(int x, int y, int length, uint8_t color,
+                         const EpdBand *band);
+void epd_fill_circle_helper_band(int x0, int y0, int r, int corners,
+                                 int delta, uint8_t color,
+                                 const EpdBand *band);
+void epd_draw_circle_band(int x, int y, int r, uint8_t color,
+                          const EpdBand *band);
+void epd_fill_circle_band(int x, int y, int r, uint8_t color,
+                          const EpdBand *band);
+void epd_draw_rect_band(int x, int y, int w, int h, uint8_t color,
+                        const EpdBand *band);
+void epd_fill_rect_band(int x, int y, int w, int h, uint8_t color,
+                        const EpdBand *band);
+void epd_write_line_band(int x0, int y0, int x1, int y1, uint8_t color,
+                         const EpdBand *band);
+void epd_draw_line_band(int x0, int y0, int x1, int y1, uint8_t color,
+                        const EpdBand *band);
+void epd_draw_triangle_band(int x0, int y0, int x1, int y1, int x2, int y2,
+                            uint8_t color, const EpdBand *band);
+void epd_fill_triangle_band(int x0, int y0, int x1, int y1, int x2, int y2,
+                            uint8_t color, const EpdBand *band);
+
 /**
  * Get the current ambient temperature in °C.
+ *
+ * Returns the filtered background measurement if it is recent,
+ * otherwise the temperature is measured directly.
  */
 float epd_ambient_temperature();
 
+/**
+ * Get the filtered ambient temperature in °C without blocking.
+ * The temperature is sampled in the background
+ * every `CONFIG_EPD_TEMPERATURE_SAMPLE_PERIOD_MS` milliseconds.
+ *
+ * @param temperature: Set to the filtered temperature.
+ * @param age_ms: If not NULL, set to the age of the last sample in ms.
+ * @returns ESP_OK on success,
+ *   ESP_ERR_INVALID_STATE if no sample was taken yet,
+ *   ESP_ERR_TIMEOUT if the last sample is stale, i.e. the ADC stalled.
+ *   `temperature` is still set in this case.
+ */
+esp_err_t epd_get_ambient_temperature(float *temperature, uint32_t *age_ms);
+
 /// Font data stored PER GLYPH
 typedef struct {
   uint8_t width;            ///< Bitmap dimensions in pixels
@@ -393,6 +1109,15 @@ void write_mode(const GFXfont *font, const char *string, int *cursor_x,
                 int *cursor_y, uint8_t *framebuffer, enum DrawMode mode,
                 const FontProperties *properties);
 
+/**
+ * Write text to a band, like `write_mode` to a framebuffer.
+ * Only the glyphs within `band->clip` are drawn,
+ * but the cursor is moved past the whole text.
+ */
+void write_band(const GFXfont *font, const char *string, int *cursor_x,
+                int *cursor_y, const EpdBand *band,
+                const FontProperties *properties);
+
 /**
  * Get the font glyph for a unicode code point.
  */
@@ -405,6 +1130,126 @@ void get_glyph(const GFXfont *font, uint32_t code_point,
 void write_string(const GFXfont *font, const char *string, int *cursor_x,
                   int *cursor_y, uint8_t *framebuffer);
 
+struct EpdDrawCommand;
+
+/**
+ * A recorded sequence of drawing operations, which is drawn to the display
+ * without a framebuffer: The rows are rasterized in bands of
+ * `CONFIG_EPD_BAND_ROWS` while they are sent to the display.
+ *
+ * The recording functions take the arguments of the respective drawing
+ * functions and return false if there is not enough memory for the command.
+ */
+typedef struct {
+  /// The recorded commands, in drawing order.
+  struct EpdDrawCommand *commands;
+  int count;
+  int capacity;
+} EpdDisplayList;
+
+/**
+ * Initialize an empty display list.
+ */
+void epd_display_list_init(EpdDisplayList *list);
+
+/**
+ * Remove all commands, keeping the memory for new ones.
+ */
+void epd_display_list_clear(EpdDisplayList *list);
+
+/**
+ * Free the memory of a display list. It is empty afterwards.
+ */
+void epd_display_list_free(EpdDisplayList *list);
+
+bool epd_display_list_draw_pixel(EpdDisplayList *list, int x, int y,
+                                 uint8_t color);
+bool epd_display_list_draw_hline(EpdDisplayList *list, int x, int y,
+                                 int length, uint8_t color);
+bool epd_display_list_draw_vline(EpdDisplayList *list, int x, int y,
+                                 int length, uint8_t color);
+bool epd_display_list_draw_line(EpdDisplayList *list, int x0, int y0, int x1,
+                                int y1, uint8_t color);
+bool epd_display_list_draw_rect(EpdDisplayList *list, int x, int y, int w,
+                                int h, uint8_t color);
+bool epd_display_list_fill_rect(EpdDisplayList *list, int x, int y, int w,
+                                int h, uint8_t color);
+bool epd_display_list_draw_circle(EpdDisplayList *list, int x, int y, int r,
+                                  uint8_t color);
+bool epd_display_list_fill_circle(EpdDisplayList *list, int x, int y, int r,
+                                  uint8_t color);
+bool epd_display_list_draw_triangle(EpdDisplayList *list, int x0, int y0,
+                                    int x1, int y1, int x2, int y2,
+                                    uint8_t color);
+bool epd_display_list_fill_triangle(EpdDisplayList *list, int x0, int y0,
+                                    int x1, int y1, int x2, int y2,
+                                    uint8_t color);
+
+/**
+ * Record `epd_copy_to_framebuffer`. The image data is not copied and
+ * must be valid until the display list is drawn for the last time.
+ */
+bool epd_display_list_copy_image(EpdDisplayList *list, Rect_t image_area,
+                                 const uint8_t *image_data);
+
+/**
+ * Record `write_band`. The string is copied, the font must be valid
+ * until the display list is drawn for the last time.
+ * The cursor is moved past the text, like when writing it.
+ */
+bool epd_display_list_write(EpdDisplayList *list, const GFXfont *font,
+                            const char *string, int *cursor_x, int *cursor_y,
+                            const FontProperties *properties);
+
+/**
+ * Run the commands of a display list on a band, in order.
+ * Commands outside of `band->clip` are skipped.
+ */
+void epd_display_list_rasterize(const EpdDisplayList *list,
+                                const EpdBand *band);
+
+/// Statistics of `epd_display_list_render`.
+typedef struct {
+  /// Number of tiles the framebuffer is split into.
+  int tiles;
+  /// Sum of the number of tiles covered by each command.
+  uint32_t binned_commands;
+  /// Non-empty tiles rasterized by the calling task and the helper task.
+  int tiles_per_core[2];
+  /// Time the calling task and the helper task spent rasterizing.
+  uint32_t busy_us[2];
+  /// Total time, including binning the commands.
+  uint32_t time_us;
+} EpdRenderReport;
+
+/**
+ * Run the commands of a display list on a full screen framebuffer,
+ * on both cores. The result is the same as drawing them in order.
+ *
+ * The framebuffer is split into tiles of `CONFIG_EPD_RENDER_TILE_SIZE`,
+ * and every command is sorted into the tiles its bounds cover.
+ * The calling task and a helper task take turns rasterizing the next tile.
+ * The helper is created once by `epd_init`, at the priority of the task
+ * calling it, and is not pinned to a core. Before `epd_init`, while another
+ * render uses the helper, or if there is not enough memory, the commands
+ * are run on the calling task.
+ *
+ * @param report: Statistics of the call, or NULL.
+ */
+void epd_display_list_render(const EpdDisplayList *list, uint8_t *framebuffer,
+                             EpdRenderReport *report);
+
+/**
+ * Draw a display list to an area of the display, on a white background.
+ * Nothing outside of the area is drawn.
+ *
+ * The bands are rasterized by the row producer. Bands are kept for the
+ * following frames while more than `CONFIG_EPD_BAND_CACHE_RESERVE` bytes of
+ * memory are left, the others are rasterized again in every frame.
+ */
+void epd_draw_display_list(Rect_t area, const EpdDisplayList *list,
+                           enum DrawMode mode);
+
 #ifdef __cplusplus
 }
 #endif
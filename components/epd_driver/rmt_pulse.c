@@ -1,6 +1,11 @@
 #include "rmt_pulse.h"
 #include "driver/rmt.h"
+#include "epd_trace.h"
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "xtensa/core-macros.h"
 
 static intr_handle_t gRMT_intr_handle = NULL;
 
@@ -10,15 +15,36 @@ static rmt_config_t row_rmt_config;
 // keep track of wether the current pulse is ongoing
 volatile bool rmt_tx_done = true;
 
+// given by the interrupt handler when a pulse is done,
+// so waiting tasks can block instead of spinning.
+static SemaphoreHandle_t rmt_done_smphr;
+
+// CPU cycle count at which the current pulse is expected to end.
+static uint32_t pulse_end_ccount;
+
+// called from the interrupt handler when a pulse is done.
+static void (*pulse_done_cb)(void);
+
 /**
  * Remote peripheral interrupt. Used to signal when transmission is done.
  */
 static void IRAM_ATTR rmt_interrupt_handler(void *arg) {
+  EPD_TRACE_BEGIN(EPD_TRACE_RMT_ISR);
   rmt_tx_done = true;
   RMT.int_clr.val = RMT.int_st.val;
+  if (pulse_done_cb != NULL) {
+    pulse_done_cb();
+  }
+
+  BaseType_t task_awoken = pdFALSE;
+  xSemaphoreGiveFromISR(rmt_done_smphr, &task_awoken);
+  EPD_TRACE_END(EPD_TRACE_RMT_ISR);
+  if (task_awoken == pdTRUE) {
+    portYIELD_FROM_ISR();
+  }
 }
 
-void rmt_pulse_init(gpio_num_t pin) {
+void rmt_pulse_init(gpio_num_t pin, void (*done_cb)(void)) {
 
   row_rmt_config.rmt_mode = RMT_MODE_TX;
   // currently hardcoded: use channel 0
@@ -36,6 +62,9 @@ void rmt_pulse_init(gpio_num_t pin) {
   row_rmt_config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
   row_rmt_config.tx_config.idle_output_en = true;
 
+  rmt_done_smphr = xSemaphoreCreateBinary();
+  pulse_done_cb = done_cb;
+
   #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 2, 0) && ESP_IDF_VERSION > ESP_IDF_VERSION_VAL(4, 0, 2)
     #error "This driver is not compatible with IDF version 4.1.\nPlease use 4.0 or >= 4.2!"
   #endif
@@ -46,10 +75,33 @@ void rmt_pulse_init(gpio_num_t pin) {
   rmt_set_tx_intr_en(row_rmt_config.channel, true);
 }
 
-void IRAM_ATTR pulse_ckv_ticks(uint16_t high_time_ticks,
-                               uint16_t low_time_ticks, bool wait) {
+void rmt_pulse_deinit() {
+  rmt_wait_idle();
+  rmt_set_tx_intr_en(row_rmt_config.channel, false);
+  esp_intr_free(gRMT_intr_handle);
+  gRMT_intr_handle = NULL;
+  vSemaphoreDelete(rmt_done_smphr);
+  rmt_done_smphr = NULL;
+  pulse_done_cb = NULL;
+}
+
+void IRAM_ATTR rmt_wait_idle() {
+  int32_t remaining_us =
+      (int32_t)(pulse_end_ccount - XTHAL_GET_CCOUNT()) /
+      CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+  if (!rmt_tx_done && remaining_us > CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US) {
+    // drop a stale signal from a previous pulse
+    xSemaphoreTake(rmt_done_smphr, 0);
+    while (!rmt_tx_done) {
+      xSemaphoreTake(rmt_done_smphr, portMAX_DELAY);
+    }
+  }
   while (!rmt_tx_done) {
   };
+}
+
+void IRAM_ATTR rmt_pulse_start(uint16_t high_time_ticks,
+                               uint16_t low_time_ticks) {
   volatile rmt_item32_t *rmt_mem_ptr =
       &(RMTMEM.chan[row_rmt_config.channel].data32[0]);
   if (high_time_ticks > 0) {
@@ -64,12 +116,39 @@ void IRAM_ATTR pulse_ckv_ticks(uint16_t high_time_ticks,
     rmt_mem_ptr->duration1 = 0;
   }
   RMTMEM.chan[row_rmt_config.channel].data32[1].val = 0;
+  // one tick is 0.1us
+  pulse_end_ccount =
+      XTHAL_GET_CCOUNT() + (high_time_ticks + low_time_ticks) *
+                               CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 10;
   rmt_tx_done = false;
   RMT.conf_ch[row_rmt_config.channel].conf1.mem_rd_rst = 1;
   RMT.conf_ch[row_rmt_config.channel].conf1.mem_owner = RMT_MEM_OWNER_TX;
   RMT.conf_ch[row_rmt_config.channel].conf1.tx_start = 1;
-  while (wait && !rmt_tx_done) {
-  };
+}
+
+void IRAM_ATTR rmt_delay_start(uint16_t ticks) {
+  volatile rmt_item32_t *rmt_mem_ptr =
+      &(RMTMEM.chan[row_rmt_config.channel].data32[0]);
+  rmt_mem_ptr->level0 = 0;
+  rmt_mem_ptr->duration0 = ticks;
+  rmt_mem_ptr->level1 = 0;
+  rmt_mem_ptr->duration1 = 0;
+  RMTMEM.chan[row_rmt_config.channel].data32[1].val = 0;
+  pulse_end_ccount =
+      XTHAL_GET_CCOUNT() + ticks * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 10;
+  rmt_tx_done = false;
+  RMT.conf_ch[row_rmt_config.channel].conf1.mem_rd_rst = 1;
+  RMT.conf_ch[row_rmt_config.channel].conf1.mem_owner = RMT_MEM_OWNER_TX;
+  RMT.conf_ch[row_rmt_config.channel].conf1.tx_start = 1;
+}
+
+void IRAM_ATTR pulse_ckv_ticks(uint16_t high_time_ticks,
+                               uint16_t low_time_ticks, bool wait) {
+  rmt_wait_idle();
+  rmt_pulse_start(high_time_ticks, low_time_ticks);
+  if (wait) {
+    rmt_wait_idle();
+  }
 }
 
 void IRAM_ATTR pulse_ckv_us(uint16_t high_time_us, uint16_t low_time_us,
@@ -10,8 +10,17 @@
 /**
  * Initializes RMT Channel 0 with a pin for RMT pulsing.
  * The pin will have to be re-initialized if subsequently used as GPIO.
+ *
+ * @param done_cb: Called from the interrupt handler when a pulse is done.
+ *   Must be placed in IRAM. May be NULL.
+ */
+void rmt_pulse_init(gpio_num_t pin, void (*done_cb)(void));
+
+/**
+ * Give up the interrupt and semaphore of `rmt_pulse_init`,
+ * so it can be called again.
  */
-void rmt_pulse_init(gpio_num_t pin);
+void rmt_pulse_deinit();
 
 /**
  * Outputs a single pulse (high -> low) on the configured pin.
@@ -23,11 +32,36 @@ void rmt_pulse_init(gpio_num_t pin);
  */
 void IRAM_ATTR pulse_ckv_us(uint16_t high_time_us, uint16_t low_time_us,
                             bool wait);
+/**
+ * Start a single pulse (high -> low) without waiting.
+ * Must only be called when no pulse is ongoing.
+ * Can be called from an interrupt handler.
+ *
+ * @param: high_time_ticks Pulse high time in clock ticks.
+ * @param: low_time_ticks Pulse low time in clock ticks.
+ */
+void IRAM_ATTR rmt_pulse_start(uint16_t high_time_ticks,
+                               uint16_t low_time_ticks);
+
+/**
+ * Keep the pin low for `ticks`, then call the done callback like after
+ * a pulse. Used as a short timer from interrupt handlers.
+ * Must only be called when no pulse is ongoing.
+ */
+void IRAM_ATTR rmt_delay_start(uint16_t ticks);
+
 /**
  * Indicates if the rmt is currently sending a pulse.
  */
 bool IRAM_ATTR rmt_busy();
 
+/**
+ * Wait until the current pulse is finished.
+ * Long waits block the calling task until the RMT interrupt fires,
+ * short waits are busy-waited.
+ */
+void IRAM_ATTR rmt_wait_idle();
+
 /**
  * Outputs a single pulse (high -> low) on the configured pin.
  * This function will always wait for a previous call to finish.
@@ -64,6 +64,8 @@ void read_task() {
 
 void app_main() {
   epd_init();
+  // keep the display powered while typing.
+  epd_set_power_hold_off(2000);
   delay(300);
   epd_poweron();
   epd_clear();
@@ -235,14 +235,8 @@ static void next_fontset(void);
 static void render_line();
 
 /* Globals */
-/// Framebuffer holding the currently drawn (updated image)
-static uint8_t* render_fb_back = NULL;
-/// Framebuffer holding the image state before the update
-static uint8_t* render_fb_front = NULL;
-/// A compact mask to store which pixels have changed
-static uint8_t* render_mask = NULL;
-/// The mask as framebuffer to draw
-static uint8_t* render_masked_buf = NULL;
+/// Displayed image and the image being rendered
+static EpdDoubleBuffer render_fb = {0};
 
 /// Queue of the lines to be rendered
 static QueueHandle_t line_render_queue = NULL;
@@ -250,8 +244,6 @@ static QueueHandle_t line_render_queue = NULL;
 /// Semaphore to signal how many lines have been processed
 static SemaphoreHandle_t render_lines_done_smphr = NULL;
 
-static uint32_t line_dirtyness[EPD_HEIGHT] = {0};
-
 static int screen_tainted = 0;
 static char* clipboard = NULL;
 extern FontSet fontsets[];
@@ -1112,9 +1104,7 @@ treset(void)
 	term.mode = MODE_WRAP|MODE_UTF8;
 	memset(term.trantbl, CS_USA, sizeof(term.trantbl));
 	term.charset = 0;
-    memset(render_fb_front, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-    memset(render_fb_back, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-    memset(render_mask, 255, EPD_WIDTH / 8 * EPD_HEIGHT);
+    epd_double_buffer_reset(&render_fb);
 
 
 	for (i = 0; i < 2; i++) {
@@ -2644,22 +2634,10 @@ tresize(int col, int row)
             &render_line, "lr2", 1 << 12, NULL, 5, NULL, 1));
     }
 
-    if (render_fb_front == NULL) {
-
-      render_fb_front = heap_caps_malloc(EPD_WIDTH / 2 * EPD_HEIGHT, MALLOC_CAP_SPIRAM);
-    }
-    if (render_fb_back == NULL) {
-      render_fb_back = heap_caps_malloc(EPD_WIDTH / 2 * EPD_HEIGHT, MALLOC_CAP_SPIRAM);
+    if (render_fb.front == NULL && !epd_double_buffer_init(&render_fb)) {
+        die("could not allocate framebuffers");
     }
-    if (render_mask == NULL) {
-      render_mask = heap_caps_malloc(EPD_WIDTH / 8 * EPD_HEIGHT, MALLOC_CAP_SPIRAM);
-    }
-    if (render_masked_buf == NULL) {
-      render_masked_buf = heap_caps_malloc(EPD_WIDTH / 2 * EPD_HEIGHT, MALLOC_CAP_SPIRAM);
-    }
-    memset(render_fb_front, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-    memset(render_fb_back, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-    memset(render_mask, 255, EPD_WIDTH / 8 * EPD_HEIGHT);
+    epd_double_buffer_reset(&render_fb);
 
 	/*
 	 * slide screen to keep cursor where we expect it -
@@ -2812,90 +2790,6 @@ static uint8_t displaycolor(uint32_t col) {
     return colorscheme[col];
 }
 
-// input buffers must be 32-bit line aligned.
-void IRAM_ATTR calculate_dirty_buffer(
-        uint8_t* dst, uint8_t* delete_buffer,
-        uint8_t* write_buffer, int lines, uint32_t* dirty_lines)
-{
-  uint32_t* p1 = (uint32_t*)delete_buffer;
-  uint32_t* p2 = (uint32_t*)write_buffer;
-  for (int l = 0; l < lines; l++) {
-    for (int i = 0; i < EPD_WIDTH / 8; i++) {
-      uint32_t c = ((*p1++) ^ (*p2++));
-      dirty_lines[l] |= c;
-      uint8_t d = 0;
-      d = ((c & 0xF) > 0) << 0;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 1;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 2;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 3;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 4;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 5;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 6;
-      c = c >> 4;
-      d |= ((c & 0xF) > 0) << 7;
-      (*dst++) = d;
-    }
-  }
-}
-
-static const DRAM_ATTR uint32_t mask_lut[256] = {
-    0x00000000, 0x0000000f, 0x000000f0, 0x000000ff, 0x00000f00, 0x00000f0f,
-    0x00000ff0, 0x00000fff, 0x0000f000, 0x0000f00f, 0x0000f0f0, 0x0000f0ff,
-    0x0000ff00, 0x0000ff0f, 0x0000fff0, 0x0000ffff, 0x000f0000, 0x000f000f,
-    0x000f00f0, 0x000f00ff, 0x000f0f00, 0x000f0f0f, 0x000f0ff0, 0x000f0fff,
-    0x000ff000, 0x000ff00f, 0x000ff0f0, 0x000ff0ff, 0x000fff00, 0x000fff0f,
-    0x000ffff0, 0x000fffff, 0x00f00000, 0x00f0000f, 0x00f000f0, 0x00f000ff,
-    0x00f00f00, 0x00f00f0f, 0x00f00ff0, 0x00f00fff, 0x00f0f000, 0x00f0f00f,
-    0x00f0f0f0, 0x00f0f0ff, 0x00f0ff00, 0x00f0ff0f, 0x00f0fff0, 0x00f0ffff,
-    0x00ff0000, 0x00ff000f, 0x00ff00f0, 0x00ff00ff, 0x00ff0f00, 0x00ff0f0f,
-    0x00ff0ff0, 0x00ff0fff, 0x00fff000, 0x00fff00f, 0x00fff0f0, 0x00fff0ff,
-    0x00ffff00, 0x00ffff0f, 0x00fffff0, 0x00ffffff, 0x0f000000, 0x0f00000f,
-    0x0f0000f0, 0x0f0000ff, 0x0f000f00, 0x0f000f0f, 0x0f000ff0, 0x0f000fff,
-    0x0f00f000, 0x0f00f00f, 0x0f00f0f0, 0x0f00f0ff, 0x0f00ff00, 0x0f00ff0f,
-    0x0f00fff0, 0x0f00ffff, 0x0f0f0000, 0x0f0f000f, 0x0f0f00f0, 0x0f0f00ff,
-    0x0f0f0f00, 0x0f0f0f0f, 0x0f0f0ff0, 0x0f0f0fff, 0x0f0ff000, 0x0f0ff00f,
-    0x0f0ff0f0, 0x0f0ff0ff, 0x0f0fff00, 0x0f0fff0f, 0x0f0ffff0, 0x0f0fffff,
-    0x0ff00000, 0x0ff0000f, 0x0ff000f0, 0x0ff000ff, 0x0ff00f00, 0x0ff00f0f,
-    0x0ff00ff0, 0x0ff00fff, 0x0ff0f000, 0x0ff0f00f, 0x0ff0f0f0, 0x0ff0f0ff,
-    0x0ff0ff00, 0x0ff0ff0f, 0x0ff0fff0, 0x0ff0ffff, 0x0fff0000, 0x0fff000f,
-    0x0fff00f0, 0x0fff00ff, 0x0fff0f00, 0x0fff0f0f, 0x0fff0ff0, 0x0fff0fff,
-    0x0ffff000, 0x0ffff00f, 0x0ffff0f0, 0x0ffff0ff, 0x0fffff00, 0x0fffff0f,
-    0x0ffffff0, 0x0fffffff, 0xf0000000, 0xf000000f, 0xf00000f0, 0xf00000ff,
-    0xf0000f00, 0xf0000f0f, 0xf0000ff0, 0xf0000fff, 0xf000f000, 0xf000f00f,
-    0xf000f0f0, 0xf000f0ff, 0xf000ff00, 0xf000ff0f, 0xf000fff0, 0xf000ffff,
-    0xf00f0000, 0xf00f000f, 0xf00f00f0, 0xf00f00ff, 0xf00f0f00, 0xf00f0f0f,
-    0xf00f0ff0, 0xf00f0fff, 0xf00ff000, 0xf00ff00f, 0xf00ff0f0, 0xf00ff0ff,
-    0xf00fff00, 0xf00fff0f, 0xf00ffff0, 0xf00fffff, 0xf0f00000, 0xf0f0000f,
-    0xf0f000f0, 0xf0f000ff, 0xf0f00f00, 0xf0f00f0f, 0xf0f00ff0, 0xf0f00fff,
-    0xf0f0f000, 0xf0f0f00f, 0xf0f0f0f0, 0xf0f0f0ff, 0xf0f0ff00, 0xf0f0ff0f,
-    0xf0f0fff0, 0xf0f0ffff, 0xf0ff0000, 0xf0ff000f, 0xf0ff00f0, 0xf0ff00ff,
-    0xf0ff0f00, 0xf0ff0f0f, 0xf0ff0ff0, 0xf0ff0fff, 0xf0fff000, 0xf0fff00f,
-    0xf0fff0f0, 0xf0fff0ff, 0xf0ffff00, 0xf0ffff0f, 0xf0fffff0, 0xf0ffffff,
-    0xff000000, 0xff00000f, 0xff0000f0, 0xff0000ff, 0xff000f00, 0xff000f0f,
-    0xff000ff0, 0xff000fff, 0xff00f000, 0xff00f00f, 0xff00f0f0, 0xff00f0ff,
-    0xff00ff00, 0xff00ff0f, 0xff00fff0, 0xff00ffff, 0xff0f0000, 0xff0f000f,
-    0xff0f00f0, 0xff0f00ff, 0xff0f0f00, 0xff0f0f0f, 0xff0f0ff0, 0xff0f0fff,
-    0xff0ff000, 0xff0ff00f, 0xff0ff0f0, 0xff0ff0ff, 0xff0fff00, 0xff0fff0f,
-    0xff0ffff0, 0xff0fffff, 0xfff00000, 0xfff0000f, 0xfff000f0, 0xfff000ff,
-    0xfff00f00, 0xfff00f0f, 0xfff00ff0, 0xfff00fff, 0xfff0f000, 0xfff0f00f,
-    0xfff0f0f0, 0xfff0f0ff, 0xfff0ff00, 0xfff0ff0f, 0xfff0fff0, 0xfff0ffff,
-    0xffff0000, 0xffff000f, 0xffff00f0, 0xffff00ff, 0xffff0f00, 0xffff0f0f,
-    0xffff0ff0, 0xffff0fff, 0xfffff000, 0xfffff00f, 0xfffff0f0, 0xfffff0ff,
-    0xffffff00, 0xffffff0f, 0xfffffff0, 0xffffffff,
-};
-
-void IRAM_ATTR mask_buffer(uint8_t* mask, uint32_t* input, uint32_t* output, int lines) {
-  for (int i=0; i < EPD_WIDTH / 8 * lines; i++) {
-    output[i] = input[i] & mask_lut[mask[i]];
-  }
-}
-
 static void render_line() {
     while (true) {
         int line = -1;
@@ -2903,14 +2797,11 @@ static void render_line() {
             die("term: failed to receive line to render");
         }
         Glyph* glyphs = term.line[line];
-        int min_y_px = EPD_HEIGHT + 1;
-        int max_y_px = -1;
-
         const GFXfont* font = get_font(glyphs[0]);
         int line_y = pixel_start_y + font->advance_y * line - font->ascender;
         int line_height = font->ascender - font->descender;
 
-        memset(render_fb_front + line_y * EPD_WIDTH / 2, 255, EPD_WIDTH / 2 * line_height);
+        memset(render_fb.back + line_y * EPD_WIDTH / 2, 255, EPD_WIDTH / 2 * line_height);
 
         char data[4 * term.col + 1];
         int idx = 0;
@@ -2950,52 +2841,18 @@ static void render_line() {
           };
           const GFXfont* f = get_font(c);
           int px_y = pixel_start_y + f->advance_y * line;
-          min_y_px = MIN(min_y_px, px_y - f->ascender);
-          max_y_px = MAX(min_y_px, px_y - f->descender);
 
-          write_mode((GFXfont*)f, data, &px_x, &px_y, render_fb_front, WHITE_ON_WHITE, &fprops);
+          write_mode((GFXfont*)f, data, &px_x, &px_y, render_fb.back, WHITE_ON_WHITE, &fprops);
         }
 
         if (term.c.y == line) {
             glyphs[term.c.x] = cursor_char;
         }
 
-        int height = max_y_px - min_y_px;
-        if (height > 0) {
-          height = MIN(height, EPD_HEIGHT - min_y_px);
-          int y_offset = EPD_WIDTH / 2 * min_y_px;
-          uint8_t* start_ptr = render_fb_front + y_offset;
-
-          uint8_t* mask_start = render_mask + (min_y_px * EPD_WIDTH / 8);
-
-          calculate_dirty_buffer(
-                  mask_start,
-                  render_fb_back + y_offset,
-                  start_ptr,
-                  height,
-                  &line_dirtyness[min_y_px]
-          );
-          mask_buffer(
-                  mask_start,
-                  (uint32_t*)start_ptr,
-                  (uint32_t*)(render_masked_buf + y_offset),
-                  height
-          );
-        }
         xSemaphoreGive(render_lines_done_smphr);
     }
 }
 
-static void draw_mask(Rect_t area, uint8_t* mask, bool* dirtyness) {
-    uint64_t start = esp_timer_get_time();
-    epd_draw_frame_1bit_lines(area, mask, BLACK_ON_WHITE, 200, dirtyness);
-    uint64_t time_ms = (esp_timer_get_time() - start) / 1000;
-    // The particles must be given ~20ms to follow the applied charge.
-    if (time_ms < 20) {
-      vTaskDelay(20 - time_ms);
-    }
-}
-
 static void full_refresh() {
   if (!screen_tainted) {
 	return;
@@ -3003,21 +2860,17 @@ static void full_refresh() {
 
   ESP_LOGI("term", "epd clear.");
   epd_poweron();
-  epd_draw_image(epd_full_screen(), render_fb_front, WHITE_ON_WHITE);
+  epd_draw_image(epd_full_screen(), render_fb.front, WHITE_ON_WHITE);
   epd_clear_area_cycles(epd_full_screen(), clear_cycles, clear_cycle_length);
   epd_poweroff();
   tfulldirt();
   screen_tainted = 0;
-  memset(render_fb_front, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-  memset(render_fb_back, 255, EPD_WIDTH / 2 * EPD_HEIGHT);
-  memset(render_mask, 255, EPD_WIDTH / 8 * EPD_HEIGHT);
+  epd_double_buffer_reset(&render_fb);
 }
 
 
 void epd_render(void) {
 
-  memset(line_dirtyness, 0, sizeof(line_dirtyness));
-
   bool is_full_clear = false;
 
   int drawn_lines = 0;
@@ -3044,52 +2897,11 @@ void epd_render(void) {
   if (drawn_lines) {
     screen_tainted = 1;
 
+    // waits until all capacitors are charged, if not still powered.
     epd_poweron();
-    uint64_t t_poweron = esp_timer_get_time();
-
-    bool boolean_line_dirtyness[EPD_HEIGHT];
-    for (int i=0; i < EPD_HEIGHT; i++) {
-      boolean_line_dirtyness[i] = line_dirtyness[i] > 0;
-    }
 
-    int min_y = 0;
-    int max_y = EPD_HEIGHT - 1;
-    int height = max_y - min_y;
-    if (height > 0) {
-      Rect_t area = {
-        .x = 0,
-        .y = min_y,
-        .width = EPD_WIDTH,
-        .height = height,
-      };
-
-      uint8_t* mask_start = render_mask + min_y * EPD_WIDTH / 8;
-      bool* dirtyness_start = boolean_line_dirtyness + min_y;
-
-      uint64_t time_since_poweron_ms = (esp_timer_get_time() - t_poweron) / 1000;
-      // poweron takes ~10ms until all capacitors are charged
-      if (time_since_poweron_ms < 10) {
-        vTaskDelay(10 - time_since_poweron_ms);
-      }
-
-      draw_mask(area, mask_start, dirtyness_start);
-      draw_mask(area, mask_start, dirtyness_start);
-      draw_mask(area, mask_start, dirtyness_start);
-
-      uint8_t* masked_start = render_masked_buf + min_y * EPD_WIDTH / 2;
-      epd_draw_image_lines(area, masked_start, WHITE_ON_BLACK, dirtyness_start);
-      epd_poweroff();
-
-      for (int i=0; i < EPD_HEIGHT; i++) {
-        if (boolean_line_dirtyness[i]) {
-          memcpy(
-              render_fb_back + EPD_WIDTH / 2 * i,
-              render_fb_front + EPD_WIDTH / 2 * i,
-              EPD_WIDTH / 2
-          );
-        }
-      }
-    }
+    epd_double_buffer_commit(&render_fb, NULL);
+    epd_poweroff();
   }
 }
 
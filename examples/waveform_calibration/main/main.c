@@ -0,0 +1,238 @@
+/* Waveform timing calibration for a panel.
+ *
+ * Draws charts of the 16 gray levels with candidate contrast cycles,
+ * to be measured with a reflectance meter or a calibrated camera.
+ * scripts/waveform_fit.py fits optimized contrast cycles to the
+ * measurements, which are pasted back into the serial console, checked
+ * and stored in NVS. The stored calibration is applied at every boot,
+ * so no reflashing is needed.
+ *
+ * Console commands:
+ *   sweep              draw the chart for each candidate step
+ *   chart <step>       draw the chart with `step` 0.1us in every frame
+ *   waveform <c0,...>  use 15 contrast cycles and draw a gradient
+ *   save               store the active contrast cycles
+ *   erase              remove the stored calibration, use the defaults
+ */
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "epd_driver.h"
+
+#define TAG "waveform_calibration"
+
+// candidate steps as fractions of the default total drive time, in 1/60.
+// The last one drives 1.5 times as long as the default waveform.
+static const int candidate_steps[] = {1, 2, 3, 4, 5, 6};
+#define CANDIDATES (sizeof(candidate_steps) / sizeof(candidate_steps[0]))
+
+static uint8_t *framebuffer;
+static int default_total_time;
+
+static void read_line(char *line, size_t size) {
+  size_t len = 0;
+  while (true) {
+    int c = getchar();
+    if (c == EOF) {
+      vTaskDelay(10 / portTICK_PERIOD_MS);
+      continue;
+    }
+    if (c == '\n') {
+      break;
+    }
+    if (c != '\r' && len < size - 1) {
+      line[len++] = c;
+    }
+  }
+  line[len] = 0;
+}
+
+static void fill_rect(Rect_t area, uint8_t value) {
+  for (int y = area.y; y < area.y + area.height; y++) {
+    for (int x = area.x; x < area.x + area.width; x++) {
+      uint8_t *byte = &framebuffer[y * epd_width() / 2 + x / 2];
+      if (x % 2) {
+        *byte = (*byte & 0x0F) | (value << 4);
+      } else {
+        *byte = (*byte & 0xF0) | value;
+      }
+    }
+  }
+}
+
+/*
+ * Patches of all 16 levels in two rows, darkest at the top left.
+ * With `step` 0.1us per frame, level v is driven (15 - v) * step.
+ */
+static void draw_chart(int step) {
+  int cycles[15];
+  for (int k = 0; k < 15; k++) {
+    cycles[k] = step;
+  }
+  memset(framebuffer, 0xFF, epd_width() / 2 * epd_height());
+  int patch_width = epd_width() / 8;
+  int patch_height = epd_height() / 2;
+  for (int v = 0; v < 16; v++) {
+    Rect_t patch = {.x = (v % 8) * patch_width + patch_width / 8,
+                    .y = (v / 8) * patch_height + patch_height / 8,
+                    .width = patch_width * 3 / 4,
+                    .height = patch_height * 3 / 4};
+    fill_rect(patch, v);
+  }
+
+  int active[15], active_white[15];
+  epd_get_contrast_cycles(active, active_white);
+  epd_set_contrast_cycles(cycles, active_white);
+  epd_poweron();
+  epd_clear();
+  epd_draw_grayscale_image(epd_full_screen(), framebuffer);
+  epd_poweroff();
+  epd_set_contrast_cycles(active, active_white);
+
+  printf("chart %d:", step);
+  for (int v = 0; v < 16; v++) {
+    printf(" %d", (15 - v) * step);
+  }
+  printf("\n");
+}
+
+static void draw_gradient() {
+  for (int v = 0; v < 16; v++) {
+    Rect_t band = {.x = v * epd_width() / 16,
+                   .y = 0,
+                   .width = epd_width() / 16,
+                   .height = epd_height()};
+    fill_rect(band, v);
+  }
+  epd_poweron();
+  epd_clear();
+  epd_draw_grayscale_image(epd_full_screen(), framebuffer);
+  epd_poweroff();
+}
+
+static void print_waveform() {
+  int cycles[15], white_cycles[15];
+  epd_get_contrast_cycles(cycles, white_cycles);
+  printf("waveform ");
+  for (int k = 0; k < 15; k++) {
+    printf(k < 14 ? "%d," : "%d\n", cycles[k]);
+  }
+}
+
+static void sweep() {
+  char line[16];
+  printf("measure the reflectance of every patch, record it as\n"
+         "step,level,reflectance and press enter for the next chart.\n");
+  for (int i = 0; i < CANDIDATES; i++) {
+    int step = default_total_time * candidate_steps[i] / 60;
+    draw_chart(step > 0 ? step : 1);
+    read_line(line, sizeof(line));
+  }
+  printf("sweep done, fit the measurements with scripts/waveform_fit.py\n");
+}
+
+static bool parse_waveform(const char *text, int *cycles) {
+  for (int k = 0; k < 15; k++) {
+    char *end;
+    cycles[k] = strtol(text, &end, 10);
+    if (end == text || (k < 14 && *end != ',')) {
+      return false;
+    }
+    text = end + 1;
+  }
+  return true;
+}
+
+static void save() {
+  EpdCalibration calibration;
+  epd_get_contrast_cycles(calibration.contrast_cycles_4,
+                          calibration.contrast_cycles_4_white);
+  // the fitted cycles already linearize the levels.
+  for (int v = 0; v < 16; v++) {
+    calibration.gray_map[v] = v;
+  }
+  esp_err_t err = epd_save_calibration(&calibration);
+  if (err != ESP_OK) {
+    printf("saving failed: %s\n", esp_err_to_name(err));
+  } else {
+    printf("calibration saved.\n");
+  }
+}
+
+static void calibration_task() {
+  EpdCalibration calibration;
+  esp_err_t err = epd_load_calibration(&calibration);
+  if (err == ESP_OK && epd_apply_calibration(&calibration)) {
+    printf("using the stored calibration.\n");
+  } else {
+    printf("no stored calibration, using the default waveform.\n");
+  }
+  print_waveform();
+
+  char line[256];
+  int cycles[15], white_cycles[15];
+  int step;
+  while (true) {
+    printf("> ");
+    fflush(stdout);
+    read_line(line, sizeof(line));
+    if (strcmp(line, "sweep") == 0) {
+      sweep();
+    } else if (sscanf(line, "chart %d", &step) == 1 && step > 0) {
+      draw_chart(step);
+    } else if (strncmp(line, "waveform ", 9) == 0) {
+      epd_get_contrast_cycles(cycles, white_cycles);
+      if (!parse_waveform(line + 9, cycles) ||
+          !epd_set_contrast_cycles(cycles, white_cycles)) {
+        printf("expected 15 comma separated cycles.\n");
+        continue;
+      }
+      draw_gradient();
+      print_waveform();
+    } else if (strcmp(line, "save") == 0) {
+      save();
+    } else if (strcmp(line, "erase") == 0) {
+      epd_erase_calibration();
+      epd_set_contrast_cycles(NULL, NULL);
+      epd_set_gray_map(NULL);
+      print_waveform();
+    } else if (line[0] != 0) {
+      printf("commands: sweep, chart <step>, waveform <c0,...,c14>, save, "
+             "erase\n");
+    }
+  }
+}
+
+void app_main() {
+  esp_err_t ret = nvs_flash_init();
+  if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+      ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    ESP_ERROR_CHECK(nvs_flash_erase());
+    ret = nvs_flash_init();
+  }
+  ESP_ERROR_CHECK(ret);
+
+  epd_init();
+  int cycles[15], white_cycles[15];
+  epd_get_contrast_cycles(cycles, white_cycles);
+  default_total_time = 0;
+  for (int k = 0; k < 15; k++) {
+    default_total_time += cycles[k];
+  }
+
+  framebuffer = (uint8_t *)heap_caps_malloc(epd_width() / 2 * epd_height(),
+                                            MALLOC_CAP_SPIRAM);
+  if (framebuffer == NULL) {
+    ESP_LOGE(TAG, "Could not allocate framebuffer in PSRAM!");
+    return;
+  }
+
+  xTaskCreate(&calibration_task, "calibration", 10000, NULL, 2, NULL);
+}
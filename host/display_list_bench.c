@@ -0,0 +1,364 @@
+/*
+ * Compares drawing a weather station like screen directly to a framebuffer
+ * with recording it into a display list and rendering that on two cores.
+ *
+ * Usage: epd_bench [-n repetitions]
+ *
+ * All framebuffers are checked to be identical to the directly drawn one.
+ * The host may have fewer cores than an ESP32, so the expected render time
+ * on two cores is also modeled from the time of every single tile,
+ * without the time for binning the commands and waking the helper task.
+ */
+
+#include "epd_bus.h"
+#include "epd_bus_mock.h"
+#include "epd_display_list.h"
+#include "epd_driver.h"
+
+#include "../examples/weather/main/opensans12b.h"
+#include "../examples/weather/main/opensans24.h"
+#include "../examples/weather/main/opensans8b.h"
+
+#include "esp_timer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Draws either directly to a framebuffer or into a display list.
+typedef struct {
+  uint8_t *framebuffer;
+  EpdDisplayList *list;
+} Target;
+
+static void text(Target *t, const GFXfont *font, const char *s, int x, int y) {
+  if (t->list != NULL) {
+    epd_display_list_write(t->list, font, s, &x, &y, NULL);
+  } else {
+    writeln(font, s, &x, &y, t->framebuffer);
+  }
+}
+
+static void line(Target *t, int x0, int y0, int x1, int y1, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_draw_line(t->list, x0, y0, x1, y1, color);
+  } else {
+    epd_draw_line(x0, y0, x1, y1, color, t->framebuffer);
+  }
+}
+
+static void hline(Target *t, int x, int y, int length, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_draw_hline(t->list, x, y, length, color);
+  } else {
+    epd_draw_hline(x, y, length, color, t->framebuffer);
+  }
+}
+
+static void rect(Target *t, int x, int y, int w, int h, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_draw_rect(t->list, x, y, w, h, color);
+  } else {
+    epd_draw_rect(x, y, w, h, color, t->framebuffer);
+  }
+}
+
+static void fill_rect(Target *t, int x, int y, int w, int h, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_fill_rect(t->list, x, y, w, h, color);
+  } else {
+    epd_fill_rect(x, y, w, h, color, t->framebuffer);
+  }
+}
+
+static void fill_circle(Target *t, int x, int y, int r, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_fill_circle(t->list, x, y, r, color);
+  } else {
+    epd_fill_circle(x, y, r, color, t->framebuffer);
+  }
+}
+
+static void circle(Target *t, int x, int y, int r, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_draw_circle(t->list, x, y, r, color);
+  } else {
+    epd_draw_circle(x, y, r, color, t->framebuffer);
+  }
+}
+
+static void fill_triangle(Target *t, int x0, int y0, int x1, int y1, int x2,
+                          int y2, uint8_t color) {
+  if (t->list != NULL) {
+    epd_display_list_fill_triangle(t->list, x0, y0, x1, y1, x2, y2, color);
+  } else {
+    epd_fill_triangle(x0, y0, x1, y1, x2, y2, color, t->framebuffer);
+  }
+}
+
+static void sun(Target *t, int x, int y, int r) {
+  for (int i = 0; i < 8; i++) {
+    double a = i * M_PI / 4;
+    line(t, x + cos(a) * r * 1.4, y + sin(a) * r * 1.4, x + cos(a) * r * 2,
+         y + sin(a) * r * 2, 0x00);
+  }
+  fill_circle(t, x, y, r, 0x00);
+  fill_circle(t, x, y, r - 2, 0xF0);
+}
+
+static void cloud(Target *t, int x, int y, int r) {
+  fill_circle(t, x - r, y, r * 2 / 3, 0x00);
+  fill_circle(t, x + r, y, r * 2 / 3, 0x00);
+  fill_circle(t, x, y - r / 2, r, 0x00);
+  fill_rect(t, x - r, y - r / 4, 2 * r, r * 2 / 3 + 1, 0x00);
+  fill_circle(t, x - r, y, r * 2 / 3 - 2, 0xF0);
+  fill_circle(t, x + r, y, r * 2 / 3 - 2, 0xF0);
+  fill_circle(t, x, y - r / 2, r - 2, 0xF0);
+  fill_rect(t, x - r, y - r / 4 + 2, 2 * r, r * 2 / 3 - 3, 0xF0);
+}
+
+static void rain(Target *t, int x, int y, int r) {
+  for (int i = -2; i <= 2; i++) {
+    line(t, x + i * r / 2, y + r, x + i * r / 2 - r / 4, y + 2 * r, 0x00);
+  }
+}
+
+/*
+ * A weather station screen: current conditions, a row of forecast
+ * panels and temperature and rain graphs, a few hundred commands.
+ */
+static void draw_weather(Target *t, int width, int height) {
+  char s[64];
+  fill_rect(t, 0, 0, width, 40, 0xD0);
+  text(t, &OpenSans12B, "Weather Station - Saturday 18 October", 10, 28);
+  hline(t, 0, 40, width, 0x00);
+
+  sun(t, 90, 120, 28);
+  cloud(t, 120, 140, 26);
+  text(t, &OpenSans24, "17.5\xc2\xb0", 190, 140);
+  text(t, &OpenSans8B, "Feels like 16\xc2\xb0  Humidity 64%", 190, 170);
+  text(t, &OpenSans8B, "Wind 12 km/h SW  Pressure 1013 hPa", 190, 190);
+  for (int i = 0; i < 16; i++) {
+    fill_triangle(t, 600 + i * 20, 110, 610 + i * 20, 90, 620 + i * 20, 110,
+                  i * 0x10);
+  }
+
+  int panels = 8;
+  int pw = width / panels;
+  for (int p = 0; p < panels; p++) {
+    int x = p * pw;
+    rect(t, x + 2, 220, pw - 4, 130, 0x00);
+    snprintf(s, sizeof(s), "%02d:00", (p * 3 + 9) % 24);
+    text(t, &OpenSans8B, s, x + 30, 240);
+    if (p % 3 == 0) {
+      sun(t, x + pw / 2, 280, 14);
+    } else {
+      cloud(t, x + pw / 2, 285, 14);
+      if (p % 3 == 2) {
+        rain(t, x + pw / 2, 285, 14);
+      }
+    }
+    snprintf(s, sizeof(s), "%d\xc2\xb0 / %d\xc2\xb0", 12 + p % 5, 4 + p % 3);
+    text(t, &OpenSans8B, s, x + 20, 335);
+  }
+  for (int p = 0; p < panels; p++) {
+    // details below the panels.
+    int x = p * pw + 8;
+    snprintf(s, sizeof(s), "Wind %d km/h", 5 + p * 3 % 17);
+    text(t, &OpenSans8B, s, x, 370);
+    snprintf(s, sizeof(s), "Rain %d.%d mm", p % 4, p * 7 % 10);
+    text(t, &OpenSans8B, s, x, 388);
+    snprintf(s, sizeof(s), "Humidity %d%%", 50 + p * 5 % 40);
+    text(t, &OpenSans8B, s, x, 406);
+  }
+
+  // temperature and rain graphs with labeled axes.
+  int gy = 430, gh = height - gy - 30;
+  for (int g = 0; g < 2; g++) {
+    int gx = 40 + g * width / 2;
+    int gw = width / 2 - 60;
+    rect(t, gx, gy, gw, gh, 0x00);
+    for (int i = 0; i <= 4; i++) {
+      snprintf(s, sizeof(s), "%d", g == 0 ? 20 - i * 5 : 10 - i * 2);
+      text(t, &OpenSans8B, s, gx - 30, gy + i * gh / 4 + 5);
+      for (int x = gx; x < gx + gw; x += 8) {
+        hline(t, x, gy + i * gh / 4, 3, 0x80);
+      }
+    }
+    for (int i = 0; i < 40; i++) {
+      int x0 = gx + i * gw / 40, x1 = gx + (i + 1) * gw / 40;
+      if (g == 0) {
+        int y0 = gy + gh / 2 + sin(i / 5.0) * gh / 3;
+        int y1 = gy + gh / 2 + sin((i + 1) / 5.0) * gh / 3;
+        line(t, x0, y0, x1, y1, 0x00);
+        line(t, x0, y0 + 1, x1, y1 + 1, 0x00);
+        if (i % 4 == 0) {
+          snprintf(s, sizeof(s), "%.1f", 10 + sin(i / 5.0) * 7.5);
+          text(t, &OpenSans8B, s, x0 - 8, y0 - 8);
+        }
+      } else {
+        int h = (i * 37 % 11) * gh / 12;
+        fill_rect(t, x0 + 1, gy + gh - h, x1 - x0 - 1, h, 0x80);
+        snprintf(s, sizeof(s), "%d", i * 37 % 11);
+        text(t, &OpenSans8B, s, x0 + 2, gy + gh - h - 4);
+      }
+    }
+    for (int i = 0; i < 8; i++) {
+      snprintf(s, sizeof(s), "%02d", i * 3);
+      text(t, &OpenSans8B, s, gx + i * gw / 8, gy + gh + 20);
+    }
+  }
+  for (int i = 0; i < 30; i++) {
+    circle(t, width - 20, 60 + i * 4, 3, 0x40);
+  }
+}
+
+/// Time of the best of `reps` calls of `fn`, in microseconds.
+#define BEST_OF(reps, result, setup, fn)                                       \
+  do {                                                                         \
+    result = INT64_MAX;                                                        \
+    for (int r_ = 0; r_ < (reps); r_++) {                                      \
+      setup;                                                                   \
+      int64_t start_ = esp_timer_get_time();                                   \
+      fn;                                                                      \
+      int64_t t_ = esp_timer_get_time() - start_;                              \
+      result = t_ < result ? t_ : result;                                      \
+    }                                                                          \
+  } while (0)
+
+static int compare(const char *name, const uint8_t *a, const uint8_t *b,
+                   size_t size) {
+  if (memcmp(a, b, size) != 0) {
+    printf("%s differs from immediate drawing!\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+static bool intersects(Rect_t a, Rect_t b) {
+  return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+         b.y < a.y + a.height;
+}
+
+/*
+ * Time rasterizing every tile on its own, with only the commands binned
+ * to it, and schedule the tiles on two workers taking the next tile
+ * when idle, like epd_display_list_render.
+ */
+static int64_t modeled_two_core_us(const EpdDisplayList *list, uint8_t *fb,
+                                   int width, int height) {
+  const int tile = CONFIG_EPD_RENDER_TILE_SIZE & ~1;
+  int64_t worker[2] = {0, 0};
+  // the commands are shared with `list`, only the array is owned.
+  EpdDisplayList bin = {
+      .commands = malloc(list->count * sizeof(EpdDrawCommand))};
+  memset(fb, 0xFF, width / 2 * height);
+  for (int y = 0; y < height; y += tile) {
+    for (int x = 0; x < width; x += tile) {
+      EpdBand band = {.data = fb + y * width / 2,
+                      .clip = {.x = x,
+                               .y = y,
+                               .width = width - x < tile ? width - x : tile,
+                               .height = height - y < tile ? height - y
+                                                           : tile}};
+      bin.count = 0;
+      for (int i = 0; i < list->count; i++) {
+        if (intersects(list->commands[i].bounds, band.clip)) {
+          bin.commands[bin.count++] = list->commands[i];
+        }
+      }
+      int64_t start = esp_timer_get_time();
+      epd_display_list_rasterize(&bin, &band);
+      int idle = worker[1] < worker[0];
+      worker[idle] += esp_timer_get_time() - start;
+    }
+  }
+  free(bin.commands);
+  return worker[0] > worker[1] ? worker[0] : worker[1];
+}
+
+int main(int argc, char **argv) {
+  int reps = 10;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      reps = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n repetitions]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  epd_set_bus_backend(&epd_bus_mock);
+  epd_init();
+  const int width = epd_width();
+  const int height = epd_height();
+  const size_t size = width / 2 * height;
+  uint8_t *reference = malloc(size);
+  uint8_t *fb = malloc(size);
+
+  Target immediate = {.framebuffer = reference};
+  int64_t immediate_us;
+  BEST_OF(reps, immediate_us, memset(reference, 0xFF, size),
+          draw_weather(&immediate, width, height));
+
+  EpdDisplayList list;
+  epd_display_list_init(&list);
+  Target recorder = {.list = &list};
+  int64_t record_us;
+  BEST_OF(reps, record_us, epd_display_list_clear(&list),
+          draw_weather(&recorder, width, height));
+
+  int errors = 0;
+  EpdBand screen = {.data = fb, .clip = epd_full_screen()};
+  int64_t serial_us;
+  BEST_OF(reps, serial_us, memset(fb, 0xFF, size),
+          epd_display_list_rasterize(&list, &screen));
+  errors += compare("serial rasterization", reference, fb, size);
+
+  EpdRenderReport report;
+  int64_t render_us;
+  BEST_OF(reps, render_us, memset(fb, 0xFF, size),
+          epd_display_list_render(&list, fb, &report));
+  errors += compare("tiled rendering", reference, fb, size);
+
+  int64_t modeled_us = INT64_MAX;
+  for (int r = 0; r < reps; r++) {
+    int64_t t = modeled_two_core_us(&list, fb, width, height);
+    modeled_us = t < modeled_us ? t : modeled_us;
+  }
+  errors += compare("tile by tile rasterization", reference, fb, size);
+
+  printf("display: %dx%d, %d commands, %d tiles of %d, %u binned, "
+         "%ld host cores\n",
+         width, height, list.count, report.tiles,
+         CONFIG_EPD_RENDER_TILE_SIZE & ~1, report.binned_commands,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-28s %10s %8s\n", "", "time[ms]", "speedup");
+  printf("%-28s %10.2f %8.2f\n", "immediate", immediate_us / 1000.0, 1.0);
+  printf("%-28s %10.2f\n", "recording", record_us / 1000.0);
+  printf("%-28s %10.2f %8.2f\n", "rasterize, one core", serial_us / 1000.0,
+         (double)immediate_us / serial_us);
+  printf("%-28s %10.2f %8.2f  (tiles %d/%d)\n", "render, two tasks",
+         render_us / 1000.0, (double)immediate_us / render_us,
+         report.tiles_per_core[0], report.tiles_per_core[1]);
+  uint32_t busy_us = report.busy_us[0] > report.busy_us[1]
+                         ? report.busy_us[0]
+                         : report.busy_us[1];
+  printf("%-28s %10.2f\n", "  binning and hand-off",
+         (report.time_us - busy_us) / 1000.0);
+  printf("%-28s %10.2f %8.2f\n", "render, two cores (modeled)",
+         modeled_us / 1000.0, (double)immediate_us / modeled_us);
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+    printf("only one host core, the two tasks cannot render in parallel.\n");
+  }
+
+  epd_display_list_free(&list);
+  free(reference);
+  free(fb);
+  return errors != 0;
+}
@@ -0,0 +1,517 @@
+/*
+ * Runs the driver against a virtual panel and reports
+ * the resulting images and bus timings.
+ *
+ * Usage: epd_sim [-d display] [-o output directory] [-s] [-t] [-w spin|block]
+ *
+ * With -s, the driver runs in single task mode.
+ * With -w, the bus operations take their modeled time in real time,
+ * busy-waiting or blocking, and the CPU time of the frame output is shown.
+ * With -t, the pipeline trace of the last scene is printed,
+ * if the simulator was built with TRACE=1.
+ */
+
+#include "epd_bus.h"
+#include "epd_bus_mock.h"
+#include "epd_driver.h"
+#include "panel_sim.h"
+
+#include "../examples/demo/main/firasans.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+static const struct {
+  const char *name;
+  const EpdDisplay *display;
+} displays[] = {
+    {"ed097oc4", &epd_display_ed097oc4},
+    {"ed097oc4_lq", &epd_display_ed097oc4_lq},
+    {"ed097tc2", &epd_display_ed097tc2},
+    {"ed060sc4", &epd_display_ed060sc4},
+    {"ed047tc1", &epd_display_ed047tc1},
+    {"ed133ut2", &epd_display_ed133ut2},
+};
+
+static PanelSim sim;
+static const char *out_dir = ".";
+static int scene_index = 0;
+
+static uint32_t estimate_us;
+static bool real_time = false;
+
+/*
+ * Start a scene, with the estimated time of its draw operations.
+ */
+static void begin_scene(uint32_t estimate) {
+  estimate_us = estimate;
+  epd_reset_stats();
+  epd_trace_clear();
+  panel_sim_begin(&sim);
+}
+
+static void end_scene(const char *name) {
+  PanelSimReport report;
+  panel_sim_end(&sim, &report);
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%02d_%s.pgm", out_dir, scene_index++,
+           name);
+  if (panel_sim_write_pgm(&sim, path) != 0) {
+    perror(path);
+    exit(1);
+  }
+  printf("%-16s %6u %8u %8u %8u %10.2f %10.2f %9.1f\n", name, report.frames,
+         report.rows_driven, report.rows_skipped, report.rows_active,
+         report.drive_time / 1e4, report.bus_time / 1e4,
+         report.wall_time_us / 1e3);
+
+  EpdDrawStats stats;
+  epd_get_stats(&stats);
+  printf("  producer %.1fms, consumer %.1fms, lut %.1fms, frame delay %.1fms, "
+         "starved %u, full %u, row reads %.1fms (%lluKB), merged %u, "
+         "raster %.1fms (%u bands), estimate %.1fms\n",
+         stats.producer_busy_us / 1e3, stats.consumer_busy_us / 1e3,
+         stats.lut_time_us / 1e3, stats.frame_delay_us / 1e3,
+         stats.queue_starved, stats.queue_full, stats.row_read_us / 1e3,
+         (unsigned long long)stats.row_read_bytes / 1024, stats.draws_merged,
+         stats.raster_us / 1e3, stats.bands_rasterized, estimate_us / 1e3);
+  if (real_time) {
+    uint64_t wall_us, cpu_us;
+    epd_bus_mock_frame_times(&wall_us, &cpu_us);
+    printf("  frames %.1fms, frame output cpu %.1fms (%.0f%%)\n", wall_us / 1e3,
+           cpu_us / 1e3, wall_us > 0 ? 100.0 * cpu_us / wall_us : 0.0);
+  }
+}
+
+typedef struct {
+  Rect_t area;
+  const uint8_t *data;
+  SemaphoreHandle_t done;
+} QuadrantDraw;
+
+static void draw_quadrant(void *arg) {
+  QuadrantDraw *draw = arg;
+  epd_draw_grayscale_image(draw->area, draw->data);
+  xSemaphoreGive(draw->done);
+  vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv) {
+  const EpdDisplay *display = epd_default_display();
+  bool dump_trace = false;
+  EpdTaskConfig tasks = epd_default_task_config();
+  int opt;
+  while ((opt = getopt(argc, argv, "d:o:stw:")) != -1) {
+    switch (opt) {
+    case 'd':
+      display = NULL;
+      for (size_t i = 0; i < sizeof(displays) / sizeof(displays[0]); i++) {
+        if (strcmp(optarg, displays[i].name) == 0) {
+          display = displays[i].display;
+        }
+      }
+      if (display == NULL) {
+        fprintf(stderr, "unknown display: %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'o':
+      out_dir = optarg;
+      break;
+    case 's':
+      tasks.single_task = true;
+      break;
+    case 't':
+      dump_trace = true;
+      break;
+    case 'w':
+      real_time = true;
+      if (strcmp(optarg, "spin") == 0) {
+        epd_bus_mock_set_wait(EPD_BUS_MOCK_SPIN);
+      } else if (strcmp(optarg, "block") == 0) {
+        // wake up on time from short sleeps.
+        prctl(PR_SET_TIMERSLACK, 1);
+        epd_bus_mock_set_wait(EPD_BUS_MOCK_BLOCK);
+      } else {
+        fprintf(stderr, "unknown wait mode: %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-d display] [-o output directory] [-s] [-t] "
+              "[-w spin|block]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  epd_set_bus_backend(&epd_bus_mock);
+  epd_init_display_tasks(display, &tasks);
+  panel_sim_init(&sim, display);
+
+  const int width = epd_width();
+  const int height = epd_height();
+  uint8_t *image = malloc(width / 2 * height);
+  uint8_t *image_1bpp = malloc(width / 8 * height);
+
+  printf("display: %dx%d\n", width, height);
+  printf("%-16s %6s %8s %8s %8s %10s %10s %9s\n", "scene", "frames",
+         "driven", "skipped", "active", "drive[ms]", "bus[ms]", "host[ms]");
+
+  const EpdDrawOptions clear_options = {.type = EPD_DRAW_CLEAR,
+                                       .time = display->clear_cycle_time,
+                                       .cycles = 3};
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("clear");
+
+  // 16 vertical gray bands.
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      uint8_t v = x * 32 / width;
+      image[y * width / 2 + x] = v | v << 4;
+    }
+  }
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE, NULL));
+  epd_draw_grayscale_image(epd_full_screen(), image);
+  end_scene("gradient");
+
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("clear");
+
+  // the gradient again, with a black and white preview.
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE, NULL));
+  epd_draw_image_progressive(epd_full_screen(), image, BLACK_ON_WHITE);
+  end_scene("progressive");
+
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("clear");
+
+  // the gradient with its dark levels spread out.
+  static const uint8_t gray_map[16] = {0, 2, 4, 5, 7, 8, 9, 10,
+                                       11, 11, 12, 13, 13, 14, 14, 15};
+  epd_set_gray_map(gray_map);
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE, NULL));
+  epd_draw_grayscale_image(epd_full_screen(), image);
+  end_scene("gray_map");
+  epd_set_gray_map(NULL);
+
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("clear");
+
+  // the gradient with a calibration of evenly spaced frame times.
+  EpdCalibration calibration;
+  int total_time = 0;
+  for (int k = 0; k < 15; k++) {
+    total_time += display->contrast_cycles_4[k];
+  }
+  for (int k = 0; k < 15; k++) {
+    calibration.contrast_cycles_4[k] = total_time / 15;
+    calibration.contrast_cycles_4_white[k] = display->contrast_cycles_4_white[k];
+  }
+  for (int v = 0; v < 16; v++) {
+    calibration.gray_map[v] = v;
+  }
+  epd_apply_calibration(&calibration);
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE, NULL));
+  epd_draw_grayscale_image(epd_full_screen(), image);
+  end_scene("calibrated");
+  epd_set_contrast_cycles(NULL, NULL);
+
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("clear");
+
+  // a partial update of a black rectangle.
+  Rect_t area = {
+      .x = width / 4, .y = height / 4, .width = width / 2, .height = height / 2};
+  memset(image, 0, width / 2 * height);
+  begin_scene(epd_estimate_draw_time(area, BLACK_ON_WHITE, NULL));
+  epd_draw_grayscale_image(area, image);
+  end_scene("partial");
+
+  // the quadrants of the gradient, drawn by four tasks at once.
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      uint8_t v = x * 32 / width;
+      image[y * width / 2 + x] = v | v << 4;
+    }
+  }
+  QuadrantDraw quadrants[4];
+  uint32_t quadrant_estimate = 0;
+  SemaphoreHandle_t quadrants_done = xSemaphoreCreateCounting(4, 0);
+  for (int i = 0; i < 4; i++) {
+    Rect_t quadrant = {.x = i % 2 * width / 2,
+                       .y = i / 2 * height / 2,
+                       .width = width / 2,
+                       .height = i / 2 ? height - height / 2 : height / 2};
+    quadrants[i].area = quadrant;
+    quadrants[i].data = malloc(width / 4 * quadrant.height);
+    for (int y = 0; y < quadrant.height; y++) {
+      memcpy((uint8_t *)quadrants[i].data + y * width / 4,
+             image + (quadrant.y + y) * width / 2 + quadrant.x / 2, width / 4);
+    }
+    quadrants[i].done = quadrants_done;
+    quadrant_estimate +=
+        epd_estimate_draw_time(quadrant, BLACK_ON_WHITE, NULL);
+  }
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options) +
+              quadrant_estimate);
+  epd_clear();
+  for (int i = 0; i < 4; i++) {
+    xTaskCreate(draw_quadrant, "quadrant", 4096, &quadrants[i], 5, NULL);
+  }
+  for (int i = 0; i < 4; i++) {
+    xSemaphoreTake(quadrants_done, portMAX_DELAY);
+  }
+  end_scene("quadrants");
+  for (int i = 0; i < 4; i++) {
+    free((uint8_t *)quadrants[i].data);
+  }
+  vSemaphoreDelete(quadrants_done);
+
+  // repeated partial updates of a tile aligned area, cleaned by the
+  // ghosting manager once the update threshold is reached.
+  Rect_t widget = {.x = 128, .y = 128, .width = 128, .height = 128};
+  memset(image, 0x77, widget.width / 2 * widget.height);
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options) +
+              20 * epd_estimate_draw_time(widget, BLACK_ON_WHITE, NULL));
+  epd_clear();
+  for (int i = 0; i < 20; i++) {
+    epd_draw_grayscale_image(widget, image);
+  }
+  end_scene("ghosting");
+  EpdGhostingStatus ghosting;
+  epd_get_ghosting_status(&ghosting);
+  printf("  %dx%d tiles, %u pending, %u refreshed\n", ghosting.columns,
+         ghosting.rows, ghosting.pending_tiles, ghosting.refreshed_tiles);
+
+  // replace a line of text next to an unchanged photo, clearing adaptively.
+  uint8_t *old_fb = malloc(width / 2 * height);
+  uint8_t *new_fb = malloc(width / 2 * height);
+  bool *lines = malloc(height * sizeof(bool));
+  memset(old_fb, 0xFF, width / 2 * height);
+  for (int y = 100; y < 116; y++) {
+    for (int x = 50; x < 350; x += 4) {
+      old_fb[y * width / 2 + x] = 0x00;
+    }
+  }
+  for (int y = 300; y < 600; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      uint8_t v = x * 32 / width;
+      old_fb[y * width / 2 + x] = v | v << 4;
+    }
+  }
+  memcpy(new_fb, old_fb, width / 2 * height);
+  for (int y = 100; y < 116; y++) {
+    memset(new_fb + y * width / 2, 0xFF, width / 2);
+    for (int x = 52; x < 300; x += 4) {
+      new_fb[y * width / 2 + x] = 0x00;
+    }
+  }
+  epd_clear();
+  epd_draw_grayscale_image(epd_full_screen(), old_fb);
+  begin_scene(0);
+  epd_clear_area_adaptive(epd_full_screen(), old_fb, new_fb, lines);
+  epd_draw_image_lines(epd_full_screen(), new_fb, BLACK_ON_WHITE, lines);
+  end_scene("adaptive");
+  free(old_fb);
+  free(new_fb);
+  free(lines);
+
+  // a black bar moving across the screen.
+  const int anim_frames = 24;
+  uint8_t *anim = calloc(anim_frames, width / 8 * height);
+  for (int f = 0; f < anim_frames; f++) {
+    uint8_t *frame = anim + f * width / 8 * height;
+    for (int y = height / 3; y < height * 2 / 3; y++) {
+      memset(frame + y * width / 8 + f * 4, 0xFF, 8);
+    }
+  }
+  EpdFrameArray frame_array = {.frames = anim, .count = anim_frames};
+  EpdAnimation animation = {.source = epd_frame_array_source,
+                            .ctx = &frame_array,
+                            .fps = 20,
+                            .time = 50,
+                            .passes = 2};
+  EpdAnimationReport anim_report;
+  epd_clear();
+  begin_scene(0);
+  epd_play_animation(&animation, &anim_report);
+  end_scene("animation");
+  printf("  %u frames, %.1f fps, %u late, latency %.1fms avg, %.1fms max\n",
+         anim_report.frames, anim_report.fps, anim_report.late_frames,
+         anim_report.avg_latency_us / 1e3, anim_report.max_latency_us / 1e3);
+  free(anim);
+
+  // a framebuffer pair: gray bands on white, then a box over some of them.
+  EpdDoubleBuffer buffer;
+  EpdCommitReport commit;
+  if (!epd_double_buffer_init(&buffer)) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  epd_clear();
+  begin_scene(0);
+  for (int v = 0; v < 16; v++) {
+    epd_fill_rect(v * width / 16, height / 4, width / 16, height / 4, v << 4,
+                  buffer.back);
+  }
+  epd_double_buffer_commit(&buffer, &commit);
+  printf("  %d lines, %u pixels changed%s, %u bytes copied\n",
+         commit.changed_lines, commit.changed_pixels,
+         commit.darken_only ? ", darken only" : "", commit.copied_bytes);
+  epd_fill_rect(width / 4, height / 8, width / 2, height / 4, 0x80,
+                buffer.back);
+  epd_double_buffer_commit(&buffer, &commit);
+  end_scene("double_buffer");
+  printf("  %d lines, %u pixels changed%s, %u bytes copied\n",
+         commit.changed_lines, commit.changed_pixels,
+         commit.darken_only ? ", darken only" : "", commit.copied_bytes);
+  epd_double_buffer_free(&buffer);
+
+  // a gradient background, a black frame with a transparent inside and
+  // a half transparent overlay, which is moved afterwards.
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width / 2; x++) {
+      uint8_t v = x * 32 / width;
+      image[y * width / 2 + x] = v | v << 4;
+    }
+  }
+  const int frame_width = width / 4 + 1;
+  const int frame_height = height / 4;
+  uint8_t *frame_data = malloc((frame_width + 1) / 2 * frame_height);
+  memset(frame_data, 0x00, (frame_width + 1) / 2 * frame_height);
+  for (int y = 16; y < frame_height - 16; y++) {
+    memset(frame_data + y * ((frame_width + 1) / 2) + 8, 0xFF,
+           (frame_width + 1) / 2 - 16);
+  }
+  uint8_t *overlay_data = calloc(width / 8 * (height / 8), 1);
+  EpdLayer background = {
+      .data = image, .width = width, .height = height, .blend = EPD_BLEND_OPAQUE};
+  EpdLayer frame_layer = {.data = frame_data,
+                          .width = frame_width,
+                          .height = frame_height,
+                          .x = width / 8,
+                          .y = height / 8,
+                          .blend = EPD_BLEND_KEY,
+                          .key = 0xF};
+  EpdLayer overlay = {.data = overlay_data,
+                      .width = width / 4,
+                      .height = height / 8,
+                      .x = width / 2 + 1,
+                      .y = height / 2,
+                      .blend = EPD_BLEND_ALPHA,
+                      .alpha = 8};
+  EpdCompositor compositor;
+  epd_compositor_init(&compositor);
+  epd_compositor_add_layer(&compositor, &background);
+  epd_compositor_add_layer(&compositor, &frame_layer);
+  epd_compositor_add_layer(&compositor, &overlay);
+  // the screen is white, the first render needs no clear.
+  epd_clear();
+  compositor.clear_cycles = 0;
+  begin_scene(0);
+  epd_compositor_render(&compositor);
+  end_scene("layers");
+  compositor.clear_cycles = 3;
+
+  epd_layer_move(&compositor, &overlay, width / 8 + 1, height * 3 / 4);
+  printf("  %d dirty areas after the move\n", compositor.dirty_count);
+  begin_scene(0);
+  epd_compositor_render(&compositor);
+  end_scene("layers_moved");
+  free(frame_data);
+  free(overlay_data);
+
+  // shapes, text and an image drawn from a display list, without
+  // a framebuffer.
+  EpdDisplayList list;
+  epd_display_list_init(&list);
+  for (int v = 0; v < 16; v++) {
+    epd_display_list_fill_rect(&list, v * width / 16, 0, width / 16,
+                               height / 8, v << 4);
+  }
+  epd_display_list_fill_circle(&list, width / 4, height / 2, height / 6, 0x40);
+  epd_display_list_draw_circle(&list, width / 4, height / 2, height / 5, 0x00);
+  epd_display_list_fill_triangle(&list, width / 2, height * 3 / 4,
+                                 width * 3 / 4, height / 4, width - 16,
+                                 height * 7 / 8, 0x80);
+  epd_display_list_draw_rect(&list, 8, 8, width - 16, height - 16, 0x00);
+  for (int i = 0; i < 8; i++) {
+    epd_display_list_draw_line(&list, 0, height - 1, width - 1 - i * width / 8,
+                               height / 8, 0x20);
+  }
+  int cursor_x = width / 8;
+  int cursor_y = height / 4 + FiraSans.ascender;
+  epd_display_list_write(&list, &FiraSans, "Display list ➸", &cursor_x,
+                         &cursor_y, NULL);
+  const FontProperties inverted = {
+      .fg_color = 15, .bg_color = 0, .flags = DRAW_BACKGROUND};
+  cursor_x += 16;
+  epd_display_list_write(&list, &FiraSans, "bands", &cursor_x, &cursor_y,
+                         &inverted);
+  const Rect_t image_area = {
+      .x = width / 2 + 1, .y = height / 2, .width = width / 4, .height = 64};
+  epd_display_list_copy_image(&list, image_area, image);
+  epd_clear();
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE, NULL));
+  epd_draw_display_list(epd_full_screen(), &list, BLACK_ON_WHITE);
+  end_scene("display_list");
+  epd_display_list_free(&list);
+
+  // a 1bpp checkerboard of 8x8 pixel tiles.
+  for (int y = 0; y < height; y++) {
+    memset(image_1bpp + y * width / 8, (y / 8) % 2 ? 0xFF : 0x00, width / 8);
+    for (int x = 1; x < width / 8; x += 2) {
+      image_1bpp[y * width / 8 + x] ^= 0xFF;
+    }
+  }
+  const EpdDrawOptions frame_options = {.type = EPD_DRAW_FRAME_1BIT,
+                                       .time = 50};
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options) +
+              epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &frame_options));
+  epd_clear();
+  epd_draw_frame_1bit(epd_full_screen(), image_1bpp, BLACK_ON_WHITE, 50);
+  end_scene("checkerboard");
+
+  if (dump_trace) {
+    epd_trace_dump();
+  }
+
+  // the driver can be set up again after a deinit.
+  epd_deinit();
+  epd_init_display_tasks(display, &tasks);
+  begin_scene(epd_estimate_draw_time(epd_full_screen(), BLACK_ON_WHITE,
+                                     &clear_options));
+  epd_clear();
+  end_scene("reinit");
+  epd_deinit();
+
+  panel_sim_free(&sim);
+  free(image);
+  free(image_1bpp);
+  return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * Fixed ambient temperature for host builds.
+ */
+
+#include "epd_temperature.h"
+
+#define HOST_TEMPERATURE 22.0
+
+void epd_temperature_init() {}
+
+float epd_ambient_temperature() { return HOST_TEMPERATURE; }
+
+esp_err_t epd_get_ambient_temperature(float *temperature, uint32_t *age_ms) {
+  *temperature = HOST_TEMPERATURE;
+  if (age_ms != NULL) {
+    *age_ms = 0;
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,399 @@
+/*
+ * POSIX implementation of the FreeRTOS and ESP-IDF functions
+ * used by the driver, for host builds.
+ */
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "xtensa/core-macros.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct timespec deadline(TickType_t ticks) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t ns = ts.tv_nsec + (uint64_t)ticks * 1000000000 / configTICK_RATE_HZ;
+  ts.tv_sec += ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return ts;
+}
+
+struct host_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *params;
+  BaseType_t core_id;
+  UBaseType_t priority;
+  /// Condition the task is blocked on, so vTaskDelete can wake it.
+  pthread_cond_t *_Atomic waiting_cond;
+  pthread_mutex_t *_Atomic waiting_mutex;
+  /// Set by vTaskDelete, the task exits at its next wait.
+  atomic_bool deleted;
+  /// Used by vTaskDelay, nothing gives it.
+  pthread_mutex_t delay_mutex;
+  pthread_cond_t delay_cond;
+};
+
+/// The calling task, NULL for the main thread.
+static __thread struct host_task *current_task = NULL;
+
+/*
+ * Wait on `cond` with `mutex` held. Returns false on timeout.
+ * A task deleted by another one exits here, with `mutex` released.
+ */
+static bool wait_cond(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                      TickType_t ticks, const struct timespec *until) {
+  struct host_task *task = current_task;
+  if (task != NULL) {
+    atomic_store(&task->waiting_mutex, mutex);
+    atomic_store(&task->waiting_cond, cond);
+    if (atomic_load(&task->deleted)) {
+      pthread_mutex_unlock(mutex);
+      pthread_exit(NULL);
+    }
+  }
+  bool woken = true;
+  if (ticks == portMAX_DELAY) {
+    pthread_cond_wait(cond, mutex);
+  } else {
+    woken = pthread_cond_timedwait(cond, mutex, until) != ETIMEDOUT;
+  }
+  if (task != NULL) {
+    atomic_store(&task->waiting_cond, NULL);
+    if (atomic_load(&task->deleted)) {
+      pthread_mutex_unlock(mutex);
+      pthread_exit(NULL);
+    }
+  }
+  return woken;
+}
+
+int64_t esp_timer_get_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t host_ccount() { return (uint32_t)(esp_timer_get_time() * 240); }
+
+struct host_semaphore {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max,
+                                           UBaseType_t initial) {
+  SemaphoreHandle_t sem = calloc(1, sizeof(struct host_semaphore));
+  pthread_mutex_init(&sem->mutex, NULL);
+  pthread_cond_init(&sem->cond, NULL);
+  sem->count = initial;
+  sem->max = max;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+  struct timespec until = deadline(ticks == portMAX_DELAY ? 0 : ticks);
+  pthread_mutex_lock(&sem->mutex);
+  while (sem->count == 0) {
+    if (!wait_cond(&sem->cond, &sem->mutex, ticks, &until)) {
+      pthread_mutex_unlock(&sem->mutex);
+      return pdFALSE;
+    }
+  }
+  sem->count--;
+  pthread_mutex_unlock(&sem->mutex);
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  BaseType_t given = pdFALSE;
+  pthread_mutex_lock(&sem->mutex);
+  if (sem->count < sem->max) {
+    sem->count++;
+    given = pdTRUE;
+    pthread_cond_signal(&sem->cond);
+  }
+  pthread_mutex_unlock(&sem->mutex);
+  return given;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken) {
+  if (woken != NULL) {
+    *woken = pdFALSE;
+  }
+  return xSemaphoreGive(sem);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  pthread_mutex_destroy(&sem->mutex);
+  pthread_cond_destroy(&sem->cond);
+  free(sem);
+}
+
+struct host_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t head;
+  UBaseType_t count;
+  uint8_t *items;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  QueueHandle_t queue = calloc(1, sizeof(struct host_queue));
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  queue->length = length;
+  queue->item_size = item_size;
+  queue->items = malloc(length * item_size);
+  return queue;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item,
+                            TickType_t ticks) {
+  struct timespec until = deadline(ticks == portMAX_DELAY ? 0 : ticks);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == queue->length) {
+    if (!wait_cond(&queue->not_full, &queue->mutex, ticks, &until)) {
+      pthread_mutex_unlock(&queue->mutex);
+      return pdFALSE;
+    }
+  }
+  UBaseType_t tail = (queue->head + queue->count) % queue->length;
+  memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+  queue->count++;
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdTRUE;
+}
+
+static BaseType_t queue_read(QueueHandle_t queue, void *item,
+                             TickType_t ticks, bool remove) {
+  struct timespec until = deadline(ticks == portMAX_DELAY ? 0 : ticks);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0) {
+    if (!wait_cond(&queue->not_empty, &queue->mutex, ticks, &until)) {
+      pthread_mutex_unlock(&queue->mutex);
+      return pdFALSE;
+    }
+  }
+  memcpy(item, queue->items + queue->head * queue->item_size,
+         queue->item_size);
+  if (remove) {
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return queue_read(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return queue_read(queue, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t count = queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t spaces = queue->length - queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return spaces;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  free(queue->items);
+  free(queue);
+}
+
+/// Core a task is pinned to, so traces show the task placement.
+static __thread BaseType_t current_core = 0;
+/// Priority the task was created with, the main task has priority 1.
+static __thread UBaseType_t current_priority = 1;
+
+static void free_task(struct host_task *task) {
+  pthread_mutex_destroy(&task->delay_mutex);
+  pthread_cond_destroy(&task->delay_cond);
+  free(task);
+}
+
+static void *task_entry(void *arg) {
+  struct host_task *task = arg;
+  current_task = task;
+  current_core = task->core_id == tskNO_AFFINITY ? 0 : task->core_id;
+  current_priority = task->priority;
+  task->fn(task->params);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack_depth, void *params,
+                                   UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id) {
+  TaskHandle_t task = calloc(1, sizeof(struct host_task));
+  task->fn = fn;
+  task->params = params;
+  task->core_id = core_id;
+  task->priority = priority;
+  pthread_mutex_init(&task->delay_mutex, NULL);
+  pthread_cond_init(&task->delay_cond, NULL);
+  if (pthread_create(&task->thread, NULL, task_entry, task) != 0) {
+    free_task(task);
+    return pdFAIL;
+  }
+  if (handle != NULL) {
+    *handle = task;
+  }
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL) {
+    if (current_task != NULL) {
+      free_task(current_task);
+    }
+    pthread_detach(pthread_self());
+    pthread_exit(NULL);
+  }
+  // no pthread_cancel, the task exits at its next wait. Wake it if it
+  // is blocked already, like FreeRTOS it is gone when this returns.
+  atomic_store(&task->deleted, true);
+  pthread_cond_t *cond = atomic_load(&task->waiting_cond);
+  pthread_mutex_t *mutex = atomic_load(&task->waiting_mutex);
+  if (cond != NULL) {
+    pthread_mutex_lock(mutex);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(mutex);
+  }
+  pthread_join(task->thread, NULL);
+  free_task(task);
+}
+
+void vTaskDelay(TickType_t ticks) {
+  struct host_task *task = current_task;
+  if (task == NULL) {
+    usleep((useconds_t)ticks * 1000000 / configTICK_RATE_HZ);
+    return;
+  }
+  // a deleted task must not sleep through vTaskDelete.
+  struct timespec until = deadline(ticks);
+  pthread_mutex_lock(&task->delay_mutex);
+  while (wait_cond(&task->delay_cond, &task->delay_mutex, ticks, &until)) {
+  }
+  pthread_mutex_unlock(&task->delay_mutex);
+}
+
+TickType_t xTaskGetTickCount() {
+  return esp_timer_get_time() * configTICK_RATE_HZ / 1000000;
+}
+
+BaseType_t xPortGetCoreID() { return current_core; }
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+  return task == NULL ? current_priority : task->priority;
+}
+
+struct esp_timer {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  void (*callback)(void *arg);
+  void *arg;
+  /// Expiry time in us, 0 if stopped.
+  int64_t expiry;
+};
+
+static void *timer_thread(void *arg) {
+  esp_timer_handle_t timer = arg;
+  pthread_mutex_lock(&timer->mutex);
+  while (true) {
+    if (timer->expiry == 0) {
+      pthread_cond_wait(&timer->cond, &timer->mutex);
+      continue;
+    }
+    int64_t remaining = timer->expiry - esp_timer_get_time();
+    if (remaining > 0) {
+      struct timespec until = deadline(0);
+      uint64_t ns = until.tv_nsec + remaining * 1000;
+      until.tv_sec += ns / 1000000000;
+      until.tv_nsec = ns % 1000000000;
+      pthread_cond_timedwait(&timer->cond, &timer->mutex, &until);
+      continue;
+    }
+    timer->expiry = 0;
+    pthread_mutex_unlock(&timer->mutex);
+    timer->callback(timer->arg);
+    pthread_mutex_lock(&timer->mutex);
+  }
+  return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out_handle) {
+  esp_timer_handle_t timer = calloc(1, sizeof(struct esp_timer));
+  pthread_mutex_init(&timer->mutex, NULL);
+  pthread_cond_init(&timer->cond, NULL);
+  timer->callback = args->callback;
+  timer->arg = args->arg;
+  pthread_create(&timer->thread, NULL, timer_thread, timer);
+  pthread_detach(timer->thread);
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  pthread_mutex_lock(&timer->mutex);
+  timer->expiry = esp_timer_get_time() + timeout_us;
+  if (timer->expiry == 0) {
+    timer->expiry = 1;
+  }
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->mutex);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->mutex);
+  esp_err_t err = timer->expiry == 0 ? ESP_ERR_INVALID_STATE : ESP_OK;
+  timer->expiry = 0;
+  pthread_cond_signal(&timer->cond);
+  pthread_mutex_unlock(&timer->mutex);
+  return err;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  esp_timer_stop(timer);
+  return ESP_OK;
+}
@@ -0,0 +1,20 @@
+/*
+ * Inflate for compressed fonts, with zlib instead of the ESP32 ROM.
+ * Fonts are always inflated in one call, see font.c.
+ */
+
+#include "esp32/rom/miniz.h"
+
+#include <zlib.h>
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in,
+                              uint32_t *in_size, uint8_t *out_start,
+                              uint8_t *out_next, uint32_t *out_size,
+                              uint32_t flags) {
+  uLongf len = *out_size;
+  if (uncompress(out_next, &len, in, *in_size) != Z_OK) {
+    return TINFL_STATUS_FAILED;
+  }
+  *out_size = len;
+  return TINFL_STATUS_DONE;
+}
@@ -0,0 +1,126 @@
+#include "panel_sim.h"
+#include "esp_timer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EVENT_CAPACITY (1 << 20)
+
+/*
+ * The drive code of pixel `x` in a row as output by the driver.
+ * Rows are sent as 32 bit words of 16 pixels, with the 16 bit halves
+ * swapped to account for the I2S FIFO order.
+ */
+static inline int drive_code(const uint8_t *data, int x) {
+  const uint8_t *word = data + (x / 16) * 4;
+  uint32_t val = word[0] | word[1] << 8 | word[2] << 16 | (uint32_t)word[3] << 24;
+  return (val >> (((x % 16) * 2 + 16) % 32)) & 3;
+}
+
+static void apply_row(int32_t row, const uint8_t *data, uint16_t high_time,
+                      void *ctx) {
+  PanelSim *sim = ctx;
+  float step = high_time / sim->saturation_time;
+  float *px = &sim->darkness[row * sim->width];
+  bool active = false;
+  for (int x = 0; x < sim->width; x++) {
+    switch (drive_code(data, x)) {
+    case 1:
+      px[x] = px[x] + step > 1.0f ? 1.0f : px[x] + step;
+      active = true;
+      break;
+    case 2:
+      px[x] = px[x] - step < 0.0f ? 0.0f : px[x] - step;
+      active = true;
+      break;
+    default:
+      break;
+    }
+  }
+  if (active) {
+    sim->rows_active++;
+  }
+}
+
+void panel_sim_init(PanelSim *sim, const EpdDisplay *display) {
+  sim->width = display->width;
+  sim->height = display->height;
+  sim->darkness = calloc(sim->width * sim->height, sizeof(float));
+  sim->saturation_time = 0;
+  for (int i = 0; i < 15; i++) {
+    sim->saturation_time += display->contrast_cycles_4[i];
+  }
+  sim->events = malloc(EVENT_CAPACITY * sizeof(EpdBusEvent));
+  sim->event_capacity = EVENT_CAPACITY;
+  assert(sim->darkness != NULL && sim->events != NULL);
+  epd_bus_mock_configure(sim->events, sim->event_capacity, apply_row, sim);
+}
+
+void panel_sim_free(PanelSim *sim) {
+  epd_bus_mock_configure(NULL, 0, NULL, NULL);
+  free(sim->darkness);
+  free(sim->events);
+}
+
+void panel_sim_begin(PanelSim *sim) {
+  epd_bus_mock_reset();
+  sim->rows_active = 0;
+  sim->start_time = epd_bus_mock_time();
+  sim->start_wall_time = esp_timer_get_time();
+}
+
+void panel_sim_end(PanelSim *sim, PanelSimReport *report) {
+  report->wall_time_us = esp_timer_get_time() - sim->start_wall_time;
+  report->bus_time = epd_bus_mock_time() - sim->start_time;
+  report->frames = 0;
+  report->rows_driven = 0;
+  report->rows_skipped = 0;
+  report->drive_time = 0;
+  report->rows_active = sim->rows_active;
+
+  size_t count = epd_bus_mock_event_count();
+  if (count > sim->event_capacity) {
+    fprintf(stderr, "panel_sim: %zu bus events dropped\n",
+            count - sim->event_capacity);
+    count = sim->event_capacity;
+  }
+  bool in_frame = false;
+  for (size_t i = 0; i < count; i++) {
+    const EpdBusEvent *ev = &sim->events[i];
+    switch (ev->type) {
+    case EPD_BUS_EVENT_FRAME_START:
+      in_frame = true;
+      report->frames++;
+      break;
+    case EPD_BUS_EVENT_FRAME_END:
+      in_frame = false;
+      break;
+    case EPD_BUS_EVENT_CKV:
+      if (!in_frame) {
+        break;
+      }
+      if (i > 0 && sim->events[i - 1].type == EPD_BUS_EVENT_LATCH) {
+        report->rows_driven++;
+      } else {
+        report->rows_skipped++;
+      }
+      report->drive_time += ev->high_time;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+int panel_sim_write_pgm(const PanelSim *sim, const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    return -1;
+  }
+  fprintf(f, "P5\n%d %d\n255\n", sim->width, sim->height);
+  for (int i = 0; i < sim->width * sim->height; i++) {
+    fputc((int)(255.0f * (1.0f - sim->darkness[i]) + 0.5f), f);
+  }
+  return fclose(f) == 0 ? 0 : -1;
+}
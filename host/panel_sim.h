@@ -0,0 +1,75 @@
+/**
+ * A virtual e-paper panel, driven by the rows of the mock display bus.
+ */
+
+#pragma once
+
+#include "epd_bus_mock.h"
+#include "epd_driver.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Summary of the bus activity of a draw.
+typedef struct {
+  /// Number of draw cycles (frames).
+  uint32_t frames;
+  /// Gate pulses with a freshly latched row.
+  uint32_t rows_driven;
+  /// Gate pulses without a latch.
+  uint32_t rows_skipped;
+  /// Gate pulses with at least one pixel driven.
+  uint32_t rows_active;
+  /// Sum of the gate pulse high times, in 0.1us.
+  uint64_t drive_time;
+  /// Modeled bus time of the draw, in 0.1us.
+  uint64_t bus_time;
+  /// Host time spent in the draw, in us.
+  int64_t wall_time_us;
+} PanelSimReport;
+
+/**
+ * The simulated panel state.
+ *
+ * Every pixel holds a darkness in [0, 1] (0: white, 1: black).
+ * A pulse with drive code 01 (darken) or 10 (lighten) moves it linearly
+ * by `high_time / saturation_time`, which is a first-order approximation
+ * of the particle movement.
+ */
+typedef struct {
+  int width;
+  int height;
+  float *darkness;
+  /// Drive time for a full white-to-black transition, in 0.1us.
+  float saturation_time;
+  /// Bus events of the current draw.
+  EpdBusEvent *events;
+  size_t event_capacity;
+  uint32_t rows_active;
+  uint64_t start_time;
+  int64_t start_wall_time;
+} PanelSim;
+
+/**
+ * Create a white panel for `display` and attach it to the mock bus.
+ * The saturation time is the sum of the display's contrast cycles.
+ */
+void panel_sim_init(PanelSim *sim, const EpdDisplay *display);
+
+void panel_sim_free(PanelSim *sim);
+
+/**
+ * Start recording a draw.
+ */
+void panel_sim_begin(PanelSim *sim);
+
+/**
+ * Finish recording a draw and summarize its bus activity.
+ */
+void panel_sim_end(PanelSim *sim, PanelSimReport *report);
+
+/**
+ * Write the panel state as 8 bit binary PGM image.
+ * Returns 0 on success.
+ */
+int panel_sim_write_pgm(const PanelSim *sim, const char *path);
@@ -0,0 +1,26 @@
+/*
+ * The ROM inflate functions used by font.c, see miniz_host.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define TINFL_FLAG_PARSE_ZLIB_HEADER 1
+#define TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF 4
+
+typedef enum {
+  TINFL_STATUS_FAILED = -1,
+  TINFL_STATUS_DONE = 0,
+} tinfl_status;
+
+typedef struct {
+  int unused;
+} tinfl_decompressor;
+
+#define tinfl_init(r) ((void)(r))
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in,
+                              uint32_t *in_size, uint8_t *out_start,
+                              uint8_t *out_next, uint32_t *out_size,
+                              uint32_t flags);
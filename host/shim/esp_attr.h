@@ -0,0 +1,7 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
@@ -0,0 +1,87 @@
+/*
+ * Configuration for host builds of the driver.
+ * Values can be overridden on the compiler command line.
+ */
+
+#pragma once
+
+#if !defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4) &&                              \
+    !defined(CONFIG_EPD_DISPLAY_TYPE_ED097OC4_LQ) &&                           \
+    !defined(CONFIG_EPD_DISPLAY_TYPE_ED097TC2) &&                              \
+    !defined(CONFIG_EPD_DISPLAY_TYPE_ED060SC4) &&                              \
+    !defined(CONFIG_EPD_DISPLAY_TYPE_ED047TC1) &&                              \
+    !defined(CONFIG_EPD_DISPLAY_TYPE_ED133UT2)
+#define CONFIG_EPD_DISPLAY_TYPE_ED097TC2 1
+#endif
+
+#define CONFIG_EPD_BUS_MOCK 1
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 240
+
+#if defined(CONFIG_EPD_TRACE) && !defined(CONFIG_EPD_TRACE_BUFFER_SIZE)
+#define CONFIG_EPD_TRACE_BUFFER_SIZE 65536
+#endif
+
+#ifndef CONFIG_EPD_ROW_BUFFERS
+#define CONFIG_EPD_ROW_BUFFERS 8
+#endif
+
+#ifndef CONFIG_EPD_PRODUCER_CORE
+#define CONFIG_EPD_PRODUCER_CORE 0
+#define CONFIG_EPD_PRODUCER_PRIORITY 5
+#define CONFIG_EPD_PRODUCER_STACK_SIZE 4096
+#define CONFIG_EPD_CONSUMER_CORE 1
+#define CONFIG_EPD_CONSUMER_PRIORITY 5
+#define CONFIG_EPD_CONSUMER_STACK_SIZE 4096
+#endif
+
+#ifndef CONFIG_EPD_DRAW_QUEUE_LENGTH
+#define CONFIG_EPD_DRAW_QUEUE_LENGTH 8
+#endif
+
+#ifndef CONFIG_EPD_GHOSTING_TILE_SIZE
+#define CONFIG_EPD_GHOSTING_TILE_SIZE 64
+#endif
+
+#ifndef CONFIG_EPD_GHOSTING_MAX_UPDATES
+#define CONFIG_EPD_GHOSTING_MAX_UPDATES 16
+#endif
+
+#ifndef CONFIG_EPD_GHOSTING_MAX_ENERGY
+#define CONFIG_EPD_GHOSTING_MAX_ENERGY 10000
+#endif
+
+#ifndef CONFIG_EPD_IDLE_REFRESH_STACK_SIZE
+#define CONFIG_EPD_IDLE_REFRESH_STACK_SIZE 4096
+#endif
+
+#ifndef CONFIG_EPD_PREFETCH_ROWS
+#define CONFIG_EPD_PREFETCH_ROWS 16
+#endif
+
+#ifndef CONFIG_EPD_BAND_ROWS
+#define CONFIG_EPD_BAND_ROWS 32
+#endif
+
+#ifndef CONFIG_EPD_BAND_CACHE_RESERVE
+#define CONFIG_EPD_BAND_CACHE_RESERVE 32768
+#endif
+
+#ifndef CONFIG_EPD_RENDER_TILE_SIZE
+#define CONFIG_EPD_RENDER_TILE_SIZE 64
+#endif
+
+#ifndef CONFIG_EPD_POWER_HOLD_OFF_MS
+#define CONFIG_EPD_POWER_HOLD_OFF_MS 0
+#endif
+
+#ifndef CONFIG_EPD_POWER_SETTLE_MS
+#define CONFIG_EPD_POWER_SETTLE_MS 10
+#endif
+
+#ifndef CONFIG_EPD_TEMPERATURE_SAMPLE_PERIOD_MS
+#define CONFIG_EPD_TEMPERATURE_SAMPLE_PERIOD_MS 1000
+#endif
+
+#ifndef CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US
+#define CONFIG_EPD_BLOCKING_WAIT_THRESHOLD_US 15
+#endif
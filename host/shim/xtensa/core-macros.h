@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+/// Host stand-in for the CPU cycle counter, at 240MHz.
+uint32_t host_ccount();
+#define XTHAL_GET_CCOUNT() host_ccount()
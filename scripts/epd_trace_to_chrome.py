@@ -0,0 +1,131 @@
+#!python3
+
+"""
+Convert a pipeline trace printed by epd_trace_dump() to the Chrome trace
+event format. Open the result in chrome://tracing or https://ui.perfetto.dev.
+
+The input may be a complete console log, only the part between
+EPD_TRACE_START and EPD_TRACE_STOP is used.
+
+The cycle counters of the two cores are not synchronized. Each core's
+events are converted to microseconds against that core's reference to
+the shared esp_timer clock (EPD_TRACE_CLOCK), so events of both cores
+line up to within a microsecond or so.
+"""
+
+from argparse import ArgumentParser
+import json
+import re
+import sys
+
+START = re.compile(r"EPD_TRACE_START (\d+) (\d+) (\d+)")
+CLOCK = re.compile(r"^EPD_TRACE_CLOCK (\d+) (\d+) (-?\d+)$")
+EVENT = re.compile(r"^(\d+) (\d+) ([BE]) (\w+)$")
+STOP = "EPD_TRACE_STOP"
+
+parser = ArgumentParser()
+parser.add_argument('-i', action="store", dest="inputfile",
+                    help="console log with the trace dump (default: stdin)")
+parser.add_argument('-o', action="store", dest="outputfile",
+                    help="trace JSON file (default: stdout)")
+
+args = parser.parse_args()
+
+infile = open(args.inputfile) if args.inputfile else sys.stdin
+lines = infile.read().splitlines()
+
+# use the last dump in the log
+start = None
+for i, line in enumerate(lines):
+    if START.search(line):
+        start = i
+if start is None:
+    print("no EPD_TRACE_START found!", file=sys.stderr)
+    sys.exit(1)
+
+cpu_mhz, count, dropped = map(int, START.search(lines[start]).groups())
+if dropped:
+    print("{} events were overwritten before the dump.".format(dropped),
+          file=sys.stderr)
+
+# clock reference per core: (cycle count, esp_timer time in us)
+clocks = {}
+records = []
+for line in lines[start + 1:]:
+    line = line.strip()
+    if line == STOP:
+        break
+    match = CLOCK.match(line)
+    if match:
+        core, ccount, time_us = map(int, match.groups())
+        clocks[core] = (ccount, time_us)
+        continue
+    match = EVENT.match(line)
+    if not match:
+        continue
+    ccount, core, phase, name = match.groups()
+    records.append([int(ccount), int(core), phase, name, None])
+
+
+def signed_delta(a, b):
+    """Cycles from b to a, the 32 bit counter wraps every few seconds."""
+    delta = (a - b) & 0xFFFFFFFF
+    return delta - (1 << 32) if delta >= 1 << 31 else delta
+
+
+# walk each core's events back from its clock reference,
+# which is at most half a second older than its last event.
+for core in set(r[1] for r in records):
+    if core in clocks:
+        ref_ccount, ref_us = clocks[core]
+    else:
+        print("no clock reference for core {}, its events are not aligned "
+              "with the other core.".format(core), file=sys.stderr)
+        ref_ccount, ref_us = [r[0] for r in records if r[1] == core][-1], 0
+    cycles = ref_us * cpu_mhz
+    last_ccount = ref_ccount
+    for record in reversed(records):
+        if record[1] != core:
+            continue
+        cycles += signed_delta(record[0], last_ccount)
+        last_ccount = record[0]
+        record[4] = cycles / cpu_mhz
+
+origin = min((r[4] for r in records), default=0)
+# stable, so the per core order of events with equal times is kept.
+records.sort(key=lambda r: r[4])
+
+events = []
+cores = set()
+# open events per core and name, to drop unmatched ends
+# at the start of the ring buffer.
+depth = {}
+for ccount, core, phase, name, time in records:
+    key = (core, name)
+    if phase == 'B':
+        depth[key] = depth.get(key, 0) + 1
+    elif depth.get(key, 0) > 0:
+        depth[key] -= 1
+    else:
+        continue
+
+    cores.add(core)
+    events.append({
+        "name": name,
+        "ph": phase,
+        "ts": time - origin,
+        "pid": 0,
+        "tid": core,
+    })
+
+for core in sorted(cores):
+    events.append({
+        "name": "thread_name",
+        "ph": "M",
+        "pid": 0,
+        "tid": core,
+        "args": {"name": "core {}".format(core)},
+    })
+
+outfile = open(args.outputfile, 'w') if args.outputfile else sys.stdout
+json.dump({"traceEvents": events, "displayTimeUnit": "ns"}, outfile)
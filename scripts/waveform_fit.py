@@ -0,0 +1,147 @@
+#!python3
+
+"""
+Fit contrast cycles (waveform timings) of a panel to reflectance
+measurements of the charts drawn by examples/waveform_calibration.
+
+The input is a CSV file with the columns step,level,reflectance: the
+step of the chart, the gray level of the patch and its measured
+reflectance (any linear unit, e.g. 0-1 or 0-100). With `step` 0.1us in
+every frame, level v is driven for (15 - v) * step, so the charts sample
+the reflectance as a function of the total drive time.
+
+The fitted waveform reaches each level of the target curve with the
+shortest drive time the measurements allow, which also minimizes the
+total frame time. The result is printed as a C array and as a console
+command for the calibration example.
+"""
+
+from argparse import ArgumentParser
+import csv
+import sys
+
+parser = ArgumentParser()
+parser.add_argument('-i', action="store", dest="inputfile",
+                    help="CSV file with step,level,reflectance (default: stdin)")
+parser.add_argument('--curve', choices=["lstar", "linear"], default="lstar",
+                    help="target curve, evenly spaced in CIE L* or in "
+                    "reflectance (default: lstar)")
+parser.add_argument('--black', type=float, default=1.0,
+                    help="fraction of the darkest measured contrast used for "
+                    "level 0. Lower values trade contrast for frame time "
+                    "(default: 1.0)")
+parser.add_argument('--tolerance', type=float, default=1.0,
+                    help="L* difference to the darkest measurement accepted as "
+                    "black, so the saturated tail is not driven (default: 1.0)")
+parser.add_argument('--name', default="contrast_cycles_4_calibrated",
+                    help="name of the C array")
+
+args = parser.parse_args()
+
+
+def lstar(y):
+    """CIE L* of a relative luminance 0-1."""
+    if y > (6 / 29) ** 3:
+        return 116 * y ** (1 / 3) - 16
+    return 116 * y * (29 / 6) ** 2 / 3 + 4 / 29 * 116 - 16
+
+
+def luminance(l):
+    """Inverse of `lstar`."""
+    f = (l + 16) / 116
+    if f > 6 / 29:
+        return f ** 3
+    return 3 * (6 / 29) ** 2 * (f - 4 / 29)
+
+
+infile = open(args.inputfile) if args.inputfile else sys.stdin
+samples = {}
+for row in csv.reader(infile):
+    if not row or row[0].strip().startswith("#"):
+        continue
+    try:
+        step, level, reflectance = int(row[0]), int(row[1]), float(row[2])
+    except ValueError:
+        continue  # header
+    if not 0 <= level <= 15:
+        print(f"invalid level {level}!", file=sys.stderr)
+        sys.exit(1)
+    samples.setdefault((15 - level) * step, []).append(reflectance)
+
+if len(samples) < 2 or 0 not in samples:
+    print("need measurements of white (level 15) and at least one other "
+          "patch!", file=sys.stderr)
+    sys.exit(1)
+
+# mean reflectance per drive time, normalized to the white patches.
+times = sorted(samples)
+white = sum(samples[0]) / len(samples[0])
+# blocks of [first time, reflectance, weight, last time]
+points = [[t, sum(samples[t]) / len(samples[t]) / white, 1, t] for t in times]
+
+# Driving longer never makes a patch lighter: pool adjacent violators
+# to get the best non-increasing fit through the measurements.
+pooled = []
+for p in points:
+    pooled.append(p)
+    while len(pooled) > 1 and pooled[-2][1] < pooled[-1][1]:
+        b = pooled.pop()
+        a = pooled.pop()
+        n = a[2] + b[2]
+        pooled.append([a[0], (a[1] * a[2] + b[1] * b[2]) / n, n, b[3]])
+fit = []
+for p in pooled:
+    # a pooled block is flat, its first time reaches its reflectance.
+    fit.append((p[0], p[1]))
+    if p[3] != p[0]:
+        fit.append((p[3], p[1]))
+
+
+def time_for(target):
+    """Shortest drive time with a fitted reflectance of at most `target`."""
+    if target >= fit[0][1]:
+        return 0.0
+    for (t0, r0), (t1, r1) in zip(fit, fit[1:]):
+        if r1 <= target:
+            if r0 == r1:
+                return t1
+            return t0 + (t1 - t0) * (r0 - target) / (r0 - r1)
+    return None
+
+
+# black: the darkest measurement within the tolerance, scaled by --black.
+darkest = min(r for _, r in fit)
+black_l = min(lstar(darkest) + args.tolerance, 100)
+black_l = 100 - args.black * (100 - black_l)
+
+targets = []
+for level in range(16):
+    if args.curve == "lstar":
+        targets.append(luminance(black_l + (100 - black_l) * level / 15))
+    else:
+        black = luminance(black_l)
+        targets.append(black + (1 - black) * level / 15)
+
+drive = [time_for(r) for r in targets]
+if None in drive:
+    print("the target black is out of the measured range!", file=sys.stderr)
+    sys.exit(1)
+
+# level v is driven in frames 0 .. 14 - v, so frame k adds the time
+# between levels 15 - k and 14 - k. Round the cumulative times so the
+# rounding errors do not add up.
+cumulative = [round(t) for t in drive]
+cycles = [cumulative[14 - k] - cumulative[15 - k] for k in range(15)]
+if min(cycles) <= 0:
+    print("warning: the measurements do not resolve all levels, some frames "
+          "have no drive time. Measure charts with smaller steps.",
+          file=sys.stderr)
+    cycles = [max(c, 0) for c in cycles]
+
+print("// level  target L*  drive [0.1us]")
+for level in range(16):
+    print(f"// {level:5d}  {lstar(targets[level]):9.1f}  {cumulative[level]:13d}")
+print(f"// total drive time per row: {sum(cycles)} x 0.1us")
+print(f"static const int {args.name}[15] = {{{', '.join(map(str, cycles))}}};")
+print()
+print("waveform " + ",".join(map(str, cycles)))